@@ -6,6 +6,7 @@
 #include "ARCbus.h"
 #include "crc.h"
 #include "spi.h"
+#include "DMA.h"
 
 #include "ARCbus_internal.h"
 
@@ -225,19 +226,13 @@ int addr_chk(unsigned char addr){
 static ticker packet_time=0;
 
 static unsigned BUS_I2C_lock(void){
-  int i;
-  //try to capture mutex
-  if(0==ctl_mutex_lock(&arcBus_stat.i2c_stat.mutex,CTL_TIMEOUT_DELAY,100)){
+  //wait for the bus, higher priority tasks get the bus first
+  if(BUS_arb_lock(BUS_I2C_LOCK_TIMEOUT)!=RET_SUCCESS){
      return ERR_BUSY;
   }
   return 0;
 } 
 
-//release the I2C bus
-void BUS_I2C_release(void){
-  ctl_mutex_unlock(&arcBus_stat.i2c_stat.mutex);
-}
-
 //keep track of which errors have happened
 static int BUS_I2C_err_track(int error){
   //keep track of how many errors have happened
@@ -283,127 +278,128 @@ static int BUS_I2C_err_track(int error){
       errors++;
     break;
   }
+  //update credits, slave address is still set for the packet that was sent
+  BUS_link_tx_result(UCB0I2CSA,error);
+  //start queued packets
+  BUS_tx_release();
   //release I2C bus
   BUS_I2C_release();
   //return error
   return error;
 }
 
-//send command
-int BUS_cmd_tx(unsigned char addr,void *buff,unsigned short len,unsigned short flags){
-  unsigned int e;
-  short ret;
+//return receive flags for a packet sent to addr and parsed locally
+static unsigned char BUS_loopback_flags(unsigned char addr){
   unsigned char addr_flags;
-  int i;
-  unsigned char resp[2];
-  //check address
-  if((ret=addr_chk(addr))!=RET_SUCCESS){
-    //return error if it occured
-    return ret;
-  }
-  //check packet length
-  if(len>BUS_I2C_MAX_PACKET_LEN){
-    return ERR_PACKET_TOO_LONG;
-  }
-  //add standard header length
-  len+=BUS_I2C_HDR_LEN;
-  //add NACK flag if requested
-  if(flags&BUS_CMD_FL_NACK){
-    //request NACK
-    ((unsigned char*)buff)[0]|=CMD_TX_NACK;
+  //check if sending to the general call address
+  if(addr==BUS_ADDR_GC){
+    //get thread address flags
+    addr_flags=BUS_thread_addr_flags;
+    //check if own address not set
+    if(addr_flags==0){
+      //default to ADDR0
+      //TODO: is this always correct
+      addr_flags=CMD_PARSE_ADDR0;
+    }
+    //set flags for general call address
+    return BUS_FLAGS_SW_GC|addr_flags;
   }else{
-    //clear NACK request
-    ((unsigned char*)buff)[0]&=~CMD_TX_NACK;
+    //set flags
+    return BUS_addr_to_flags(addr);
   }
-  //calculate CRC
-  ((unsigned char*)buff)[len]=crc7(buff,len);
-  //add a byte for the CRC
-  len+=BUS_I2C_CRC_LEN;
-  //check for zero length
-  if(len==0){
-    return ERR_BAD_LEN;
+}
+
+//copy a packet into the receive queue so it is parsed locally, interrupts must be disabled
+int BUS_cmd_loopbackv(unsigned char addr,const BUS_IOVEC *seg,unsigned short nseg){
+  I2C_PACKET *pk;
+  unsigned short len,i;
+  //check if the ISR is receiving, the ISR owns the next packet until it is published
+  pk=(arcBus_stat.i2c_stat.mode==BUS_I2C_RX)?NULL:I2C_rx_start();
+  //check if buffer is in use
+  if(pk==NULL){
+    return ERR_BUSY;
+  }
+  //set flags
+  pk->flags=BUS_loopback_flags(addr);
+  //copy parts into buffer
+  for(i=0,len=0;i<nseg;i++){
+    memcpy(&pk->dat[len],seg[i].ptr,seg[i].len);
+    len+=seg[i].len;
   }
+  //set length
+  pk->len=len;
+  //publish packet
+  I2C_rx_commit(pk);
+  return RET_SUCCESS;
+}
+
+//copy a packet into the receive queue so it is parsed locally
+int BUS_cmd_loopback(unsigned char addr,const unsigned char *buff,unsigned short len){
+  BUS_IOVEC seg;
+  //packet is one part
+  seg.ptr=buff;
+  seg.len=len;
+  return BUS_cmd_loopbackv(addr,&seg,1);
+}
+
+//send a packet made of parts, parts must include header and CRC
+static int BUS_cmd_tx_seg(unsigned char addr,const BUS_IOVEC *seg,unsigned short nseg,unsigned short flags){
+  BUS_BCAST_FRAME *frame;
+  BUS_IOVEC one;
+  unsigned int e;
+  short ret;
   //check if a software transmission should be done
   if(!(flags&BUS_CMD_FL_NO_SW_TX) && (BUS_OA_check(addr)==ERR_BAD_ADDR && addr==BUS_ADDR_GC)){
-    for(i=0;;i++){
-      //disable interrupts
-      int en=ctl_global_interrupts_disable();
-      //check if buffer is in use
-      if(I2C_rx_buf[I2C_rx_in].stat==I2C_PACKET_STAT_EMPTY){
-        //check if sending to the general call address
-        if(addr==BUS_ADDR_GC){
-          //get thread address flags
-          addr_flags=BUS_thread_addr_flags;
-          //check if own address not set
-          if(addr_flags==0){
-            //default to ADDR0
-            //TODO: is this always correct
-            addr_flags=CMD_PARSE_ADDR0;
-          }
-          //set flags for general call address
-          I2C_rx_buf[I2C_rx_in].flags=BUS_FLAGS_SW_GC|addr_flags;
-        }else{
-          //set flags
-          I2C_rx_buf[I2C_rx_in].flags=BUS_addr_to_flags(addr);
-        }
-        //copy data into buffer
-        memcpy(I2C_rx_buf[I2C_rx_in].dat,buff,len);
-        //set length
-        I2C_rx_buf[I2C_rx_in].len=len;
-        //set buffer status
-        I2C_rx_buf[I2C_rx_in].stat=I2C_PACKET_STAT_COMPLETE;
-        //increment index
-        I2C_rx_in++;
-        //check for wraparound
-        if(I2C_rx_in>=BUS_I2C_PACKET_QUEUE_LEN){
-          I2C_rx_in=0;
-        }
-        //enable interrupts
-        if(en){
-          ctl_global_interrupts_enable();
-        }
-        //set flag for new packet
-        ctl_events_set_clear(&BUS_INT_events,BUS_INT_EV_I2C_CMD_RX,0);
-        //check for general call address
-        if(addr==BUS_ADDR_GC){
-          //exit loop and send normally
-          break;
-        }else{
-          //return here because transaction is complete
-          return RET_SUCCESS;
-        }
-      }else{
-        //re-enable interrupts
-        if(en){
-          ctl_global_interrupts_enable();
-        }
-        //check number of retries
-        if(i>4){
-          //too many retries, return error
-          return ERR_BUSY;
-        }else{
-          //wait for packet reception to finish
-          ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS_WITH_AUTO_CLEAR,&arcBus_stat.events,BUS_EV_I2C_RX_DONE,CTL_TIMEOUT_DELAY,50);
-        }
-      }
+    //copy packet into a frame that is shared with local delivery, this does not wait for the receive queue
+    //if no frame is free the packet is only sent on the bus
+    if((frame=BUS_bcast_post(BUS_loopback_flags(addr),seg,nseg))!=NULL){
+      //send from the shared frame
+      one.ptr=frame->pk.dat;
+      one.len=frame->pk.len;
+      ret=BUS_cmd_tx_seg(addr,&one,1,flags|BUS_CMD_FL_NO_SW_TX);
+      //done with frame
+      BUS_bcast_put(frame);
+      return ret;
     }
   }
+  //fail fast if the destination is down
+  if((ret=BUS_link_check(addr))!=RET_SUCCESS){
+    return ret;
+  }
+  //wait if the destination is busy
+  BUS_link_wait(addr);
   //wait for the bus to become free
   if(BUS_I2C_lock()){
     //I2C bus is in use
     return ERR_BUSY;
   }
+  //wait for queued packets to finish
+  if(BUS_tx_claim()){
+    //release I2C bus
+    BUS_I2C_release();
+    //I2C master is in use
+    return ERR_BUSY;
+  }
+  //save start time for link health
+  BUS_link_tx_begin();
   //Setup for I2C transaction  
   //set slave address
   UCB0I2CSA=addr;
   //set index
   arcBus_stat.i2c_stat.tx.idx=0;
+  //clear backoff counters
+  BUS_backoff_start();
   //set I2C master state
   arcBus_stat.i2c_stat.tx.stat=BUS_I2C_MASTER_PENDING;
-  //set length
-  arcBus_stat.i2c_stat.tx.len=len;
-  //set data
-  arcBus_stat.i2c_stat.tx.ptr=(unsigned char*)buff;
+  //set segments
+  arcBus_stat.i2c_stat.tx.iov=seg;
+  arcBus_stat.i2c_stat.tx.iovcnt=nseg;
+  arcBus_stat.i2c_stat.tx.seg=0;
+  arcBus_stat.i2c_stat.tx.base=0;
+  //set length of first segment
+  arcBus_stat.i2c_stat.tx.len=seg[0].len;
+  //set data of first segment
+  arcBus_stat.i2c_stat.tx.ptr=seg[0].ptr;
   //set to transmit mode
   UCB0CTLW0|=UCTR;
   //clear master I2C flags
@@ -466,37 +462,102 @@ int BUS_cmd_tx(unsigned char addr,void *buff,unsigned short len,unsigned short f
   }
 }
 
-//send/receive SPI data over the bus
-int BUS_SPI_txrx(unsigned char addr,void *tx,void *rx,unsigned short len){
-  unsigned char buf[10],*ptr;
-  unsigned int e;
-  short time;
-  int i,resp;
-  unsigned short crc;
+//send command
+int BUS_cmd_tx(unsigned char addr,void *buff,unsigned short len,unsigned short flags){
+  BUS_IOVEC seg;
+  short ret;
   //check address
-  if((resp=addr_chk(addr))!=RET_SUCCESS){
+  if((ret=addr_chk(addr))!=RET_SUCCESS){
     //return error if it occured
-    return resp;
+    return ret;
   }
-  //reject own address
-  if((resp=BUS_OA_check(addr))!=RET_SUCCESS){
-    //return error if it occured
-    return resp;
+  //check packet length
+  if(len>BUS_I2C_MAX_PACKET_LEN){
+    return ERR_PACKET_TOO_LONG;
   }
-  //reject General call address
-  if(addr==BUS_ADDR_GC){
-    return ERR_BAD_ADDR;
+  //add standard header length
+  len+=BUS_I2C_HDR_LEN;
+  //add NACK flag if requested
+  if(flags&BUS_CMD_FL_NACK){
+    //request NACK
+    ((unsigned char*)buff)[0]|=CMD_TX_NACK;
+  }else{
+    //clear NACK request
+    ((unsigned char*)buff)[0]&=~CMD_TX_NACK;
   }
   //calculate CRC
-  crc=crc16(tx,len);
-  //send CRC in Big endian order
-  ((unsigned char*)tx)[len]=crc>>8;
-  ((unsigned char*)tx)[len+1]=crc;
-  //setup SPI structure
-  arcBus_stat.spi_stat.len=len;
-  arcBus_stat.spi_stat.rx=rx;
-  arcBus_stat.spi_stat.tx=tx;
-  arcBus_stat.spi_stat.nack=0;
+  ((unsigned char*)buff)[len]=crc7(buff,len);
+  //add a byte for the CRC
+  len+=BUS_I2C_CRC_LEN;
+  //check for zero length
+  if(len==0){
+    return ERR_BAD_LEN;
+  }
+  //packet is one part
+  seg.ptr=buff;
+  seg.len=len;
+  //send packet
+  return BUS_cmd_tx_seg(addr,&seg,1,flags);
+}
+
+//send command with payload in parts
+int BUS_cmd_txv(unsigned char addr,unsigned char cmd,const BUS_IOVEC *iov,unsigned short iovcnt,unsigned short flags){
+  //header, payload parts and CRC
+  BUS_IOVEC seg[BUS_IOVEC_MAX+2];
+  unsigned char hdr[BUS_I2C_HDR_LEN],crc;
+  unsigned short len=0,i;
+  short ret;
+  //check address
+  if((ret=addr_chk(addr))!=RET_SUCCESS){
+    //return error if it occured
+    return ret;
+  }
+  //check number of parts
+  if(iovcnt>BUS_IOVEC_MAX){
+    return ERR_INVALID_ARGUMENT;
+  }
+  //setup header
+  BUS_cmd_init(hdr,cmd);
+  //add NACK flag if requested
+  if(flags&BUS_CMD_FL_NACK){
+    //request NACK
+    hdr[0]|=CMD_TX_NACK;
+  }else{
+    //clear NACK request
+    hdr[0]&=~CMD_TX_NACK;
+  }
+  //header is the first part
+  seg[0].ptr=hdr;
+  seg[0].len=BUS_I2C_HDR_LEN;
+  //start CRC with header
+  crc=crc7_update(0,hdr,BUS_I2C_HDR_LEN);
+  //add payload parts
+  for(i=0;i<iovcnt;i++){
+    seg[i+1]=iov[i];
+    //continue CRC
+    crc=crc7_update(crc,iov[i].ptr,iov[i].len);
+    //count length
+    len+=iov[i].len;
+  }
+  //check packet length
+  if(len>BUS_I2C_MAX_PACKET_LEN){
+    return ERR_PACKET_TOO_LONG;
+  }
+  //finish CRC
+  crc|=1;
+  //CRC is the last part
+  seg[iovcnt+1].ptr=&crc;
+  seg[iovcnt+1].len=BUS_I2C_CRC_LEN;
+  //send packet
+  return BUS_cmd_tx_seg(addr,seg,iovcnt+2,flags);
+}
+
+//run a SPI transfer of n bytes as slave, the transfer is started by sending the command in pk
+//if crc is not NULL it is updated with the received data during the transfer
+//returns RET_SUCCESS when the master sends a successful SPI complete command
+static int BUS_SPI_slave_xfer(unsigned char addr,const void *tx,void *rx,unsigned short n,unsigned char *pk,unsigned short pk_len,short time,SPI_CRC *crc){
+  unsigned int e;
+  int resp;
   //disable DMA
   DMA0CTL&=~DMAEN;
   DMA1CTL&=~DMAEN;
@@ -515,7 +576,7 @@ int BUS_SPI_txrx(unsigned char addr,void *tx,void *rx,unsigned short len){
     // Destination DMA address: rx buffer.
     *((unsigned int*)&DMA0DA) = (unsigned short)rx;
     // The size of the block to be transferred
-    DMA0SZ = len+BUS_SPI_CRC_LEN;
+    DMA0SZ = n;
     // Configure the DMA transfer, single byte transfer with source increment
     DMA0CTL =DMADT_0|DMASBDB|DMAEN|DMASRCINCR_3|DMADSTINCR_0;
   }
@@ -536,30 +597,24 @@ int BUS_SPI_txrx(unsigned char addr,void *tx,void *rx,unsigned short len){
     // Source DMA address: tx buffer
     *((unsigned int*)&DMA1SA) =((unsigned int)tx)+1;
     // The size of the block to be transferred
-    DMA1SZ = len+BUS_SPI_CRC_LEN-1;
+    DMA1SZ = n-1;
     // Configure the DMA transfer, single byte transfer with destination increment
     //enable interrupt to notify code when transfer is complete
     DMA1CTL=DMADT_0|DMASBDB|DMASRCINCR_3|DMADSTINCR_0|DMAEN;
     //start things off with an initial transfer
-    UCA0TXBUF=*((unsigned char*)tx);
+    UCA0TXBUF=*((const unsigned char*)tx);
   }else{
     //need to send something to receive something so setup TX for dummy bytes
     *((unsigned int*)&DMA1SA) = (unsigned int)(&UCA0TXBUF);
     // The size of the block to be transferred
-    DMA1SZ = len+BUS_SPI_CRC_LEN-1;
+    DMA1SZ = n-1;
     // Configure the DMA transfer, single byte transfer with no increment
     DMA1CTL=DMADT_0|DMASBDB|DMASRCINCR_0|DMADSTINCR_0|DMAEN;
     //start things off with an initial transfer
     UCA0TXBUF=BUS_SPI_DUMMY_DATA;
   }
   //send SPI setup command
-  ptr=BUS_cmd_init(buf,CMD_SPI_RDY);
-  //send MSB first
-  ptr[0]=len>>8;
-  //then send LSB
-  ptr[1]=len;
-  //send command
-  resp=BUS_cmd_tx(addr,buf,2,BUS_CMD_FL_NACK);
+  resp=BUS_cmd_tx(addr,pk,pk_len,BUS_CMD_FL_NACK);
   //check if sent correctly
   if(resp!=RET_SUCCESS){
     //disable DMA
@@ -572,13 +627,18 @@ int BUS_SPI_txrx(unsigned char addr,void *tx,void *rx,unsigned short len){
     //TODO: better error code here
     return resp;
   }
-  //calculate wait time based on packet length
-  time=len/10;
-  if(time<=BUS_SPI_MIN_TIMEOUT){
-    time=BUS_SPI_MIN_TIMEOUT;
+  //check for running CRC
+  if(crc==NULL){
+    //wait for SPI complete signal from master
+    e=ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS_WITH_AUTO_CLEAR,&arcBus_stat.events,BUS_EV_SPI_MASTER,CTL_TIMEOUT_DELAY,time);
+  }else{
+    do{
+      //wait one tick for SPI complete signal from master
+      e=ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS_WITH_AUTO_CLEAR,&arcBus_stat.events,BUS_EV_SPI_MASTER,CTL_TIMEOUT_DELAY,1);
+      //add data received so far
+      SPI_crc_chase(crc,n);
+    }while(!e && --time>0);
   }
-  //wait for SPI complete signal from master
-  e=ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS_WITH_AUTO_CLEAR,&arcBus_stat.events,BUS_EV_SPI_MASTER,CTL_TIMEOUT_DELAY,time);
   //disable DMA
   DMA0CTL&=~DMAEN;
   DMA1CTL&=~DMAEN; 
@@ -588,33 +648,20 @@ int BUS_SPI_txrx(unsigned char addr,void *tx,void *rx,unsigned short len){
   //Check if SPI complete event received
   if(e&BUS_EV_SPI_COMPLETE){
     //check for errors from the destination
-    if(arcBus_stat.spi_stat.nack!=0){
-      //error from the other system, return it
-      return arcBus_stat.spi_stat.nack;
-    }
-    //if RX is null then don't calculate CRC
-    if(rx!=NULL){
-        //check if DMA0 finished receiving 
-        if(!(DMA0CTL&DMAIFG)){
-          //Error : DMA timed out (CRC is probably bad)
-          return ERR_DMA_TIMEOUT;
-        }
-        //assemble CRC
-        crc=((unsigned char*)rx)[arcBus_stat.spi_stat.len+1];//LSB
-        crc|=(((unsigned short)((unsigned char*)rx)[arcBus_stat.spi_stat.len])<<8);//MSB
-        //check CRC
-        if(crc!=crc16(rx,arcBus_stat.spi_stat.len)){
-          //Bad CRC
-          return ERR_BAD_CRC;
-        }
-    }
-    //check if DMA1 finished transmitting
-    if(!(DMA1CTL&DMAIFG)){
-      //Error : DMA timed out (CRC is probably bad on the other end)
-      return ERR_DMA_TIMEOUT;
+    switch(arcBus_stat.spi_stat.nack){
+      case RET_SUCCESS:
+        //Success!!
+        return RET_SUCCESS;
+      case (unsigned char)ERR_BAD_CRC:
+        //the other system got bad data
+        return ERR_BAD_CRC;
+      case ERR_SPI_SINK_FAIL:
+        //data arrived but the stream sink on the other system did not take it
+        return ERR_CMD_NACK;
+      default:
+        //error from the other system, return it
+        return arcBus_stat.spi_stat.nack;
     }
-    //Success!!
-    return RET_SUCCESS;
   }else if(e&BUS_EV_SPI_NACK){
     char tmp=arcBus_stat.spi_stat.nack;
     //clear NACK reason
@@ -634,18 +681,181 @@ int BUS_SPI_txrx(unsigned char addr,void *tx,void *rx,unsigned short len){
         //the other MSP is busy
         return ERR_BUSY;
       break;
+      case ERR_SPI_NO_SINK:
+      case ERR_UNKNOWN_CMD:
+        //the other MSP can not take streamed data or does not know the command
+        return ERR_NOT_SUPPORTED;
+      break;
       default:
         return ERR_UNKNOWN;
     }
   }else{
     //timeout occurred, send SPI abort packet
-    ptr=BUS_cmd_init(buf,CMD_SPI_ABORT);
-    resp=BUS_cmd_tx(addr,buf,0,BUS_CMD_FL_NACK);
+    BUS_cmd_init(pk,CMD_SPI_ABORT);
+    resp=BUS_cmd_tx(addr,pk,0,BUS_CMD_FL_NACK);
     //Return error, timeout occurred
     return ERR_TIMEOUT;
   }
 }
 
+//receivers that rejected CMD_SPI_RDY_TYPE, they are sent CMD_SPI_RDY without the data type
+static unsigned char BUS_SPI_no_type[(CMD_ADDR_MASK+1)/8];
+
+//check that addr can be used for a SPI transfer and take the DMA channel used for the DMA9 workaround
+static int BUS_SPI_slave_claim(unsigned char addr){
+  int resp;
+  //check address
+  if((resp=addr_chk(addr))!=RET_SUCCESS){
+    //return error if it occured
+    return resp;
+  }
+  //reject own address
+  if((resp=BUS_OA_check(addr))!=RET_SUCCESS){
+    //return error if it occured
+    return resp;
+  }
+  //reject General call address
+  if(addr==BUS_ADDR_GC){
+    return ERR_BAD_ADDR;
+  }
+  //take DMA channel used for the DMA9 workaround
+  if(BUS_DMA_claim(BUS_DMA_CH2,BUS_DMA_OWNER_SPI)!=RET_SUCCESS){
+    return ERR_BUSY;
+  }
+  return RET_SUCCESS;
+}
+
+//send/receive SPI data over the bus
+int BUS_SPI_txrx(unsigned char addr,void *tx,void *rx,unsigned short len){
+  unsigned char buf[10],*ptr,type,typed;
+  short time;
+  int resp;
+  unsigned short crc;
+  SPI_CRC rx_crc;
+  //check address and take DMA channel
+  if((resp=BUS_SPI_slave_claim(addr))!=RET_SUCCESS){
+    return resp;
+  }
+  //first data byte is the data type, the receiver uses it to pick a destination
+  type=(len>0)?((unsigned char*)tx)[0]:0;
+  //only send the type if it is needed and the receiver has not rejected CMD_SPI_RDY_TYPE
+  typed=(type!=0 && !(BUS_SPI_no_type[addr>>3]&(1<<(addr&7))));
+  //calculate CRC
+  crc=crc16(tx,len);
+  //send CRC in Big endian order
+  ((unsigned char*)tx)[len]=crc>>8;
+  ((unsigned char*)tx)[len+1]=crc;
+  //setup SPI structure
+  arcBus_stat.spi_stat.len=len;
+  arcBus_stat.spi_stat.rx=rx;
+  arcBus_stat.spi_stat.tx=tx;
+  arcBus_stat.spi_stat.nack=0;
+  //send SPI setup command
+  ptr=BUS_cmd_init(buf,typed?CMD_SPI_RDY_TYPE:CMD_SPI_RDY);
+  //send MSB first
+  ptr[0]=len>>8;
+  //then send LSB
+  ptr[1]=len;
+  //data type, only sent with CMD_SPI_RDY_TYPE
+  ptr[2]=type;
+  //calculate wait time based on packet length
+  time=len/10;
+  if(time<=BUS_SPI_MIN_TIMEOUT){
+    time=BUS_SPI_MIN_TIMEOUT;
+  }
+  //CRC of received data is updated during the transfer
+  SPI_crc_start(&rx_crc,rx,len);
+  //run transfer
+  resp=BUS_SPI_slave_xfer(addr,tx,rx,len+BUS_SPI_CRC_LEN,buf,typed?3:2,time,(rx!=NULL)?&rx_crc:NULL);
+  //older receivers NACK CMD_SPI_RDY_TYPE as an unknown command so send CMD_SPI_RDY instead
+  if(resp==ERR_NOT_SUPPORTED && typed){
+    //don't send the type to this receiver again
+    BUS_SPI_no_type[addr>>3]|=1<<(addr&7);
+    //DMA channel was given back when the transfer stopped
+    if((resp=BUS_SPI_slave_claim(addr))!=RET_SUCCESS){
+      return resp;
+    }
+    //send SPI setup command without the data type
+    BUS_cmd_init(buf,CMD_SPI_RDY);
+    arcBus_stat.spi_stat.nack=0;
+    //start CRC again
+    SPI_crc_start(&rx_crc,rx,len);
+    //run transfer
+    resp=BUS_SPI_slave_xfer(addr,tx,rx,len+BUS_SPI_CRC_LEN,buf,2,time,(rx!=NULL)?&rx_crc:NULL);
+  }
+  //check for errors
+  if(resp!=RET_SUCCESS){
+    return resp;
+  }
+  //if RX is null then don't calculate CRC
+  if(rx!=NULL){
+      //check if DMA0 finished receiving 
+      if(!(DMA0CTL&DMAIFG)){
+        //Error : DMA timed out (CRC is probably bad)
+        return ERR_DMA_TIMEOUT;
+      }
+      //assemble CRC
+      crc=((unsigned char*)rx)[arcBus_stat.spi_stat.len+1];//LSB
+      crc|=(((unsigned short)((unsigned char*)rx)[arcBus_stat.spi_stat.len])<<8);//MSB
+      //check CRC, most of the data was added during the transfer
+      if(crc!=SPI_crc_finish(&rx_crc)){
+        //Bad CRC
+        return ERR_BAD_CRC;
+      }
+  }
+  //check if DMA1 finished transmitting
+  if(!(DMA1CTL&DMAIFG)){
+    //Error : DMA timed out (CRC is probably bad on the other end)
+    return ERR_DMA_TIMEOUT;
+  }
+  //Success!!
+  return RET_SUCCESS;
+}
+
+//stream len bytes to addr over SPI, the receiver passes the data to its SPI sink in segments
+int BUS_SPI_stream_tx(unsigned char addr,const void *dat,unsigned short len){
+  unsigned char buf[10],*ptr;
+  short time;
+  int resp;
+  unsigned short crc;
+  //check length
+  if(len==0){
+    return ERR_BAD_LEN;
+  }
+  //check address and take DMA channel
+  if((resp=BUS_SPI_slave_claim(addr))!=RET_SUCCESS){
+    return resp;
+  }
+  //calculate CRC, it is sent with the setup command so the data does not need space for it
+  crc=crc16(dat,len);
+  //setup SPI structure
+  arcBus_stat.spi_stat.len=len;
+  arcBus_stat.spi_stat.rx=NULL;
+  arcBus_stat.spi_stat.tx=(unsigned char*)dat;
+  arcBus_stat.spi_stat.nack=0;
+  //send stream setup command
+  ptr=BUS_cmd_init(buf,CMD_SPI_STREAM);
+  //send length MSB first
+  ptr[0]=len>>8;
+  ptr[1]=len;
+  //send CRC MSB first
+  ptr[2]=crc>>8;
+  ptr[3]=crc;
+  //the receiver can pause between segments so allow time for each segment
+  time=BUS_SPI_MIN_TIMEOUT+((len+BUS_SPI_STREAM_SEG-1)/BUS_SPI_STREAM_SEG)*BUS_SPI_STREAM_SEG_TIME;
+  //run transfer
+  if((resp=BUS_SPI_slave_xfer(addr,dat,NULL,len,buf,4,time,NULL))!=RET_SUCCESS){
+    return resp;
+  }
+  //check if DMA1 finished transmitting
+  if(!(DMA1CTL&DMAIFG)){
+    //Error : DMA timed out
+    return ERR_DMA_TIMEOUT;
+  }
+  //Success!!
+  return RET_SUCCESS;
+}
+
 //assert one or more interrupts on the bus
 void BUS_int_set(unsigned char set){
     //disable interrupts for the pins
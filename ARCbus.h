@@ -19,10 +19,12 @@ enum{BUS_PRI_EXTRA_LOW=20,BUS_PRI_LOW=50,BUS_PRI_NORMAL=80,BUS_PRI_HIGH=110,BUS_
 #define BUS_PRI_ARCBUS        (BUS_PRI_EXTRA_HIGH+20)
 //priority for arcbus helper task
 #define BUS_PRI_ARCBUS_HELPER (BUS_PRI_EXTRA_HIGH+18)
+//priority for tasks that run deferred command callbacks
+#define BUS_PRI_ARCBUS_WORKER (BUS_PRI_HIGH)
 
 
 //Flags for events handled by BUS functions (ex BUS_cmd_tx)
-enum{BUS_EV_CMD_NACK=(1<<0),BUS_EV_I2C_COMPLETE=(1<<1),BUS_EV_I2C_NACK=(1<<2),BUS_EV_SPI_COMPLETE=(1<<3),BUS_EV_I2C_ABORT=(1<<4),BUS_EV_SPI_NACK=(1<<5),BUS_EV_I2C_ERR_CCL=(1<<6),BUS_EV_I2C_MASTER_STARTED=(1<<7),BUS_EV_I2C_TX_SELF=1<<8,BUS_EV_I2C_RX_DONE=1<<9};
+enum{BUS_EV_CMD_NACK=(1<<0),BUS_EV_I2C_COMPLETE=(1<<1),BUS_EV_I2C_NACK=(1<<2),BUS_EV_SPI_COMPLETE=(1<<3),BUS_EV_I2C_ABORT=(1<<4),BUS_EV_SPI_NACK=(1<<5),BUS_EV_I2C_ERR_CCL=(1<<6),BUS_EV_I2C_MASTER_STARTED=(1<<7),BUS_EV_I2C_TX_SELF=1<<8,BUS_EV_I2C_RX_DONE=1<<9,BUS_EV_I2C_TX_IDLE=1<<10};
 //all events for SPI master
 #define BUS_EV_SPI_MASTER           (BUS_EV_SPI_COMPLETE|BUS_EV_SPI_NACK)
 //all events created by master transactions
@@ -54,7 +56,8 @@ enum{CMD_PING=7,CMD_NACK=51,CMD_SPI_COMPLETE,CMD_SPI_RDY,CMD_SUB_ON,CMD_SUB_OFF,
      CMD_SPI_CLEAR,CMD_EPS_STAT,CMD_LEDL_STAT,CMD_ACDS_STAT,CMD_COMM_STAT,CMD_IMG_STAT,CMD_ASYNC_SETUP,
      CMD_ASYNC_DAT,CMD_SPI_DATA_ACTION,CMD_ERR_REQ,CMD_IMG_READ_PIC,CMD_IMG_TAKE_TIMED_PIC,CMD_IMG_TAKE_PIC_NOW,
      CMD_GS_DATA,CMD_TEST_MODE,CMD_BEACON_ON_OFF,CMD_ACDS_CONFIG,CMD_IMG_CLEARPIC,CMD_LEDL_READ_BLOCK,
-     CMD_ACDS_READ_BLOCK,CMD_EPS_SEND,CMD_LEDL_BLOW_FUSE,CMD_SPI_ABORT,CMD_BEACON_TYPE,CMD_HW_RESET,CMD_RF_REQ};
+     CMD_ACDS_READ_BLOCK,CMD_EPS_SEND,CMD_LEDL_BLOW_FUSE,CMD_SPI_ABORT,CMD_BEACON_TYPE,CMD_HW_RESET,CMD_RF_REQ,
+     CMD_BATCH,CMD_FRAG,CMD_CREDIT,CMD_RPC_REQ,CMD_RPC_RESP,CMD_SPI_STREAM,CMD_SPI_RDY_TYPE};
 
 //bit to allow NACK to be sent
 #define CMD_TX_NACK                 (0x80)
@@ -78,10 +81,10 @@ enum{CMD_PING=7,CMD_NACK=51,CMD_SPI_COMPLETE,CMD_SPI_RDY,CMD_SUB_ON,CMD_SUB_OFF,
 #define BUS_VER_CLEAN               (0)         //all changes commited when library compiled
 
 //Return values from bus functions
-enum{RET_SUCCESS=0,ERR_BAD_LEN=-1,ERR_CMD_NACK=-2,ERR_I2C_NACK=-3,ERR_UNKNOWN=-4,ERR_BAD_ADDR=-5,ERR_BAD_CRC=-6,ERR_TIMEOUT=-7,ERR_BUSY=-8,ERR_INVALID_ARGUMENT=-9,ERR_PACKET_TOO_LONG=-10,ERR_I2C_ABORT=-11,ERR_TIME_INVALID=-12,ERR_TIME_TOO_OLD=-13,ERR_I2C_CLL=-14,ERR_I2C_START_TIMEOUT=-15,ERR_I2C_TX_SELF=-16,ERR_DMA_TIMEOUT=-17};
+enum{RET_SUCCESS=0,ERR_BAD_LEN=-1,ERR_CMD_NACK=-2,ERR_I2C_NACK=-3,ERR_UNKNOWN=-4,ERR_BAD_ADDR=-5,ERR_BAD_CRC=-6,ERR_TIMEOUT=-7,ERR_BUSY=-8,ERR_INVALID_ARGUMENT=-9,ERR_PACKET_TOO_LONG=-10,ERR_I2C_ABORT=-11,ERR_TIME_INVALID=-12,ERR_TIME_TOO_OLD=-13,ERR_I2C_CLL=-14,ERR_I2C_START_TIMEOUT=-15,ERR_I2C_TX_SELF=-16,ERR_DMA_TIMEOUT=-17,ERR_NOT_SUPPORTED=-18,ERR_NODE_DOWN=-19};
 
 //command response values these will be send as part of the NACK packet
-enum{ERR_PK_LEN=1,ERR_UNKNOWN_CMD=2,ERR_SPI_LEN=3,ERR_BAD_PK=4,ERR_SPI_BUSY=5,ERR_BUFFER_BUSY=6,ERR_ILLEAGLE_COMMAND=7,ERR_SPI_NOT_RUNNING=8,ERR_SPI_WRONG_ADDR=9,ERR_PK_BAD_PARM=10};
+enum{ERR_PK_LEN=1,ERR_UNKNOWN_CMD=2,ERR_SPI_LEN=3,ERR_BAD_PK=4,ERR_SPI_BUSY=5,ERR_BUFFER_BUSY=6,ERR_ILLEAGLE_COMMAND=7,ERR_SPI_NOT_RUNNING=8,ERR_SPI_WRONG_ADDR=9,ERR_PK_BAD_PARM=10,ERR_SPI_NO_SINK=11,ERR_SPI_SINK_FAIL=12};
 
 //table of board addresses
 //BUS_ADDR_GC is general call address which every board will acknowledge for receiving
@@ -96,6 +99,30 @@ enum{BUS_ADDR_LEDL=0x11,BUS_ADDR_ACDS=0x12,BUS_ADDR_COMM=0x13,BUS_ADDR_IMG=0x14,
 //flags for BUS_cmd_tx
 enum{BUS_CMD_FL_NACK=BIT1,BUS_CMD_FL_NO_SW_TX=BIT2};
 
+//CMD_BATCH records are a command byte and a length byte followed by the payload
+#define BUS_BATCH_REC_HDR_LEN       (2)
+//record length bits in the length byte
+#define BUS_BATCH_REC_LEN_MASK      (0x3F)
+//set in the length byte if a NACK should be sent for the record
+#define BUS_BATCH_REC_NACK          (0x80)
+
+//CMD_FRAG header is the message command, fragment index and message id
+#define BUS_FRAG_HDR_LEN            (3)
+//fragment index bits
+#define BUS_FRAG_IDX_MASK           (0x7F)
+//set in the fragment index byte for the last fragment
+#define BUS_FRAG_LAST               (0x80)
+//data bytes in each fragment
+#define BUS_FRAG_DATA_LEN           (BUS_I2C_MAX_PACKET_LEN-BUS_FRAG_HDR_LEN)
+//maximum length of a fragmented message
+#define BUS_FRAG_MAX_LEN            (8*BUS_FRAG_DATA_LEN)
+
+//CMD_RPC_REQ header is the command and sequence number
+//CMD_RPC_RESP header is the sequence number and status, status is zero or a NACK reason
+#define BUS_RPC_HDR_LEN             (2)
+//maximum length of an RPC reply
+#define BUS_RPC_MAX_REPLY           (BUS_I2C_MAX_PACKET_LEN-BUS_RPC_HDR_LEN)
+
 //Power states
 enum{SUB_PWR_OFF=0,SUB_PWR_ON};
 
@@ -127,7 +154,15 @@ enum{BUS_ALARM_0=0,BUS_ALARM_1,BUS_NUM_ALARMS};
 enum{BUS_BUILD_CDH,BUS_BUILD_SUBSYSTEM};
 
 //command parse flags
-enum{CMD_PARSE_ADDR0=(1<<0),CMD_PARSE_ADDR1=(1<<1),CMD_PARSE_ADDR2=(1<<2),CMD_PARSE_ADDR3=(1<<3),CMD_PARSE_GC_ADDR=(1<<6),BUS_FLAGS_SW_GC=(1<<7)};
+enum{CMD_PARSE_ADDR0=(1<<0),CMD_PARSE_ADDR1=(1<<1),CMD_PARSE_ADDR2=(1<<2),CMD_PARSE_ADDR3=(1<<3),CMD_PARSE_CMD_MASK=(1<<4),CMD_PARSE_DEFERRED=(1<<5),CMD_PARSE_GC_ADDR=(1<<6),BUS_FLAGS_SW_GC=(1<<7)};
+
+//length of command mask in bytes, one bit for each command
+#define CMD_PARSE_MASK_LEN          (256/8)
+
+//set a command in a command mask
+#define CMD_PARSE_MASK_SET(mask,cmd)    ((mask)[(cmd)>>3]|=(1<<((cmd)&0x07)))
+//check if a command is set in a command mask
+#define CMD_PARSE_MASK_TEST(mask,cmd)   ((mask)[(cmd)>>3]&(1<<((cmd)&0x07)))
 
 //return values for BUS_flags_to_addr
 enum{BUS_FLAGS_INVALID_ADDR=0xFF,BUS_FLAGS_ADDR_DISABLED=0xFE,BUS_FLAGS_ADDR_MASK=0x80};
@@ -138,6 +173,17 @@ typedef unsigned long ticker;
 //low power mode setting in low power main loop
 extern char BUS_lp_mode;
 
+//one part of a packet for BUS_cmd_txv
+typedef struct{
+  //data for this part
+  const void *ptr;
+  //number of bytes
+  unsigned short len;
+}BUS_IOVEC;
+
+//maximum number of parts for BUS_cmd_txv
+#define BUS_IOVEC_MAX               6
+
 //struct for I2C status
 typedef struct{
   struct {
@@ -145,9 +191,18 @@ typedef struct{
     short len,idx;
   }rx;
   struct {
+    //current segment
     const unsigned char *ptr;
     short len,idx;
     unsigned short stat;
+    //segment list, NULL if the packet is in one buffer
+    const BUS_IOVEC *iov;
+    //number of segments and current segment
+    unsigned char iovcnt,seg;
+    //bytes in segments before the current one
+    short base;
+    //arbitration losses and restarts for the current packet
+    unsigned char collisions,retries;
   }tx;
   unsigned short mode;
   CTL_MUTEX_t mutex;
@@ -179,11 +234,16 @@ typedef struct cp_cb{
   //function to call
   cmd_parse_Callback cb;
   //flags for addresses used
+  //if CMD_PARSE_DEFERRED is set the callback is run from a worker task instead of the ARCbus task
+  //deferred callbacks must be in the command table or set CMD_PARSE_CMD_MASK with a mask, otherwise they run on the ARCbus task
   unsigned char flags;
   //priority, determines sort order
   unsigned char priority;
   //next in the list
   struct cp_cb *next;
+  //commands that the callback handles, only used if CMD_PARSE_CMD_MASK is set in flags
+  //NULL means all commands
+  const unsigned char *cmd_mask;
 }CMD_PARSE_DAT;
 
 //version structure
@@ -197,6 +257,139 @@ typedef struct{
   char hash[];
 }BUS_VERSION;
 
+//I2C receive queue statistics
+typedef struct{
+  //packets waiting in the queue
+  unsigned short used;
+  //maximum number of packets that have been waiting in the queue
+  unsigned short hwm;
+  //number of packets refused because the queue was full
+  unsigned short full;
+  //number of times the bus task woke up to handle received packets
+  unsigned long wakeups;
+  //number of received packets handled
+  unsigned long packets;
+  //packets handled on the last wakeup
+  unsigned short batch_last;
+  //most packets handled on one wakeup
+  unsigned short batch_max;
+  //control command packets waiting
+  unsigned short ctl_used;
+  //maximum number of control command packets that have been waiting
+  unsigned short ctl_hwm;
+  //number of control command packets put in the bulk queue because the control lane was full
+  unsigned short ctl_full;
+  //general call packets sent by this board waiting to be parsed locally
+  unsigned short bcast_used;
+  //general call packets sent by this board that were not parsed locally because no shared frame was free
+  unsigned short bcast_drop;
+}BUS_RX_STATS;
+
+//SPI receive buffer pool statistics
+typedef struct{
+  //number of buffers in the pool
+  unsigned short size;
+  //buffers receiving data or waiting to be freed by the subsystem
+  unsigned short used;
+  //maximum number of buffers that have been in use
+  unsigned short hwm;
+  //number of SPI transfers refused because all buffers were in use
+  unsigned short exhausted;
+  //buffers waiting to be freed by the subsystem
+  unsigned short ready;
+}BUS_BUF_STATS;
+
+//I2C arbitration statistics
+typedef struct{
+  //total arbitration losses
+  unsigned long collisions;
+  //total times a packet was started again
+  unsigned long retries;
+  //most arbitration losses for one packet
+  unsigned char max_collisions;
+  //most restarts for one packet
+  unsigned char max_retries;
+}BUS_ARB_STATS;
+
+//link health for one destination
+typedef struct{
+  //destination address
+  unsigned char addr;
+  //nonzero if sends fail with ERR_NODE_DOWN
+  unsigned char down;
+  //consecutive failed sends
+  unsigned char fails;
+  //consecutive address NACKs
+  unsigned char nack;
+  //consecutive timeouts after the start condition was sent
+  unsigned char timeout;
+  //consecutive clock low timeouts
+  unsigned char cll;
+  //average time for a successful send in 32.768kHz timer counts
+  unsigned short latency;
+  //time of the last successful send
+  ticker last_ok;
+}BUS_LINK_STAT;
+
+//completion info for BUS_cmd_tx_async
+typedef struct{
+  //event set to notify when the packet is done, can be NULL
+  CTL_EVENT_SET_t *e;
+  //events to set
+  CTL_EVENT_SET_t event;
+  //function called from the I2C interrupt when the packet is done, can be NULL
+  void (*cb)(int result,void *arg);
+  //argument for callback
+  void *arg;
+  //result of the transmission, ERR_BUSY until the packet is done
+  volatile int result;
+}BUS_TX_DONE;
+
+//sink for data streamed with BUS_SPI_stream_tx
+typedef struct{
+  //called from the ARCbus helper task for each received segment, offset is the position of dat in the stream
+  //return RET_SUCCESS to keep going, otherwise the rest of the stream is received but not passed to the sink
+  int (*seg)(unsigned char addr,const unsigned char *dat,unsigned short len,unsigned short offset,void *arg);
+  //called when the stream ends, result is RET_SUCCESS, ERR_BAD_CRC, ERR_TIMEOUT or the error from seg, can be NULL
+  void (*done)(unsigned char addr,unsigned short len,int result,void *arg);
+  //argument for callbacks
+  void *arg;
+}BUS_SPI_SINK;
+
+//destination for SPI data of one type, the data is received directly into the destination buffer
+//the type is the first byte of the data sent with BUS_SPI_txrx
+typedef struct{
+  //called from the ARCbus task, return a buffer with room for len+2 bytes or NULL to use the SPI buffer pool
+  unsigned char *(*get)(unsigned char addr,unsigned char type,unsigned short len,void *arg);
+  //called from the ARCbus task when the transfer ends, result is RET_SUCCESS, ERR_BAD_CRC or ERR_TIMEOUT
+  //the buffer belongs to the destination again
+  void (*done)(unsigned char addr,unsigned char type,unsigned char *buf,unsigned short len,int result,void *arg);
+  //argument for callbacks
+  void *arg;
+}BUS_SPI_DEST;
+
+//request for BUS_call_start, must stay valid until BUS_call_wait returns
+typedef struct{
+  //destination address
+  unsigned char addr;
+  //command
+  unsigned char cmd;
+  //sequence number used to match the response
+  unsigned char seq;
+  //nonzero when the response has been received
+  volatile unsigned char done;
+  //zero or NACK reason from the destination
+  volatile unsigned char status;
+  //buffer for the reply
+  unsigned char *reply;
+  //size of the reply buffer
+  unsigned short size;
+  //number of reply bytes received
+  volatile unsigned short len;
+  //set when the response is received
+  CTL_EVENT_SET_t e;
+}BUS_RPC;
+
 //events for subsystems
 extern CTL_EVENT_SET_t SUB_events;
 
@@ -233,8 +426,41 @@ void mainLoop_testing(void (*cb)(void));
 
 //send packet over the bus
 int BUS_cmd_tx(unsigned char addr,void *buff,unsigned short len,unsigned short flags);
+//send a command with the payload in up to BUS_IOVEC_MAX parts, the header and CRC are added so the parts are not copied
+//the parts must not change until the function returns
+int BUS_cmd_txv(unsigned char addr,unsigned char cmd,const BUS_IOVEC *iov,unsigned short iovcnt,unsigned short flags);
+//queue packet to be sent over the bus and return without waiting, the packet is copied
+//done can be NULL, otherwise it must stay valid until the packet is done
+int BUS_cmd_tx_async(unsigned char addr,const void *buff,unsigned short len,unsigned short flags,BUS_TX_DONE *done);
+//add a command to a batch packet for addr, waiting batches are sent when full or after a short delay
+int BUS_cmd_tx_batch(unsigned char addr,unsigned char cmd,const void *dat,unsigned short len,unsigned short flags);
+//send all waiting batch packets now
+void BUS_batch_flush(void);
+//send cmd to addr as a request and wait for the reply, reply_len is the size of reply and is set to the reply length
+//returns ERR_CMD_NACK if the destination rejected the command, the reason is not returned
+int BUS_call(unsigned char addr,unsigned char cmd,const void *args,unsigned short len,void *reply,unsigned short *reply_len,CTL_TIME_t timeout);
+//send cmd to addr as a request and return without waiting, several requests can be waiting at the same time
+int BUS_call_start(BUS_RPC *rpc,unsigned char addr,unsigned char cmd,const void *args,unsigned short len,void *reply,unsigned short size);
+//wait for the reply to a request sent with BUS_call_start, t and timeout are passed to ctl_events_wait
+int BUS_call_wait(BUS_RPC *rpc,CTL_TIMEOUT_t t,CTL_TIME_t timeout);
+//send the reply for a request, only call from a command callback, if no reply is sent the result of the callback is sent
+int BUS_rpc_reply(const void *dat,unsigned short len);
+//send a command up to BUS_FRAG_MAX_LEN bytes long, longer commands are split into CMD_FRAG packets
+//the receiver passes the whole command to its callbacks
+int BUS_cmd_tx_frag(unsigned char addr,unsigned char cmd,const void *dat,unsigned short len,unsigned short flags);
 //Send data over SPI
 int BUS_SPI_txrx(unsigned char addr,void *tx,void *rx,unsigned short len);
+//stream len bytes to addr over SPI, the data is received in segments so it can be longer than the SPI buffer
+//returns ERR_NOT_SUPPORTED if the receiver has no sink or does not support streams
+//returns ERR_CMD_NACK if the receiver's sink failed part way through the stream
+int BUS_SPI_stream_tx(unsigned char addr,const void *dat,unsigned short len);
+//set the sink that is given data streamed to this board, NULL refuses streams
+//the sink must stay valid until it is changed
+int BUS_SPI_stream_sink(const BUS_SPI_SINK *sink);
+//register a destination for SPI data of type from addr, zero matches any type or address, NULL removes the destination
+//the most specific destination is used, the destination must stay valid until it is removed
+//the type is only known for senders that use CMD_SPI_RDY_TYPE, data from other senders has type zero
+int BUS_SPI_dest_register(unsigned char type,unsigned char addr,const BUS_SPI_DEST *dest);
 //Setup buffer for command 
 unsigned char *BUS_cmd_init(unsigned char *buf,unsigned char id);
 
@@ -250,9 +476,14 @@ void* BUS_get_buffer(CTL_TIMEOUT_t t, CTL_TIME_t timeout);
 //unlock buffer
 void BUS_free_buffer(void);
 //get buffer when it was locked by an ARCbus event
+//SPI data can be received into another buffer before this one is freed, this returns the oldest one
 void* BUS_get_buffer_from_event(void);
-//free buffer that was locked by an ARCbus event
+//get length of the data in the buffer returned by BUS_get_buffer_from_event
+unsigned short BUS_get_buffer_len_from_event(void);
+//free buffer that was locked by an ARCbus event, SUB_EV_SPI_DAT is set again if another buffer is waiting
 void BUS_free_buffer_from_event(void);
+//get SPI buffer pool statistics
+void BUS_get_buffer_stats(BUS_BUF_STATS *stats);
 //get the size of the buffer
 const unsigned int BUS_get_buffer_size(void);
 
@@ -323,6 +554,32 @@ int BUS_build(void);
 
 //register command parse callback
 void BUS_register_cmd_callback(CMD_PARSE_DAT *cb_dat);
+//register a callback for a single command, found with a table lookup instead of walking the callback list
+//the callback list is still searched if the callback returns ERR_UNKNOWN_CMD or for general call packets
+//passing NULL removes the callback, commands handled by the bus are never passed to callbacks
+//a callback structure should not also be registered with BUS_register_cmd_callback
+int BUS_register_cmd_handler(unsigned char cmd,CMD_PARSE_DAT *cb_dat);
+
+//get I2C receive queue statistics
+void BUS_get_rx_stats(BUS_RX_STATS *stats);
+
+//get I2C arbitration statistics
+void BUS_get_arb_stats(BUS_ARB_STATS *stats);
+
+//get link health for addr, returns ERR_INVALID_ARGUMENT if nothing has been sent to addr
+int BUS_link_stat(unsigned char addr,BUS_LINK_STAT *stat);
+//return nonzero if addr is down, sends to addr fail with ERR_NODE_DOWN except for a periodic probe
+int BUS_link_is_down(unsigned char addr);
+//send a CMD_PING to addr even if it is down, the node is up again if the ping is acknowledged
+int BUS_link_probe(unsigned char addr);
+
+//keep the packet passed to the current command callback after the callback returns
+//the data pointer stays valid until the returned token is passed to BUS_cmd_release
+//only call from a command callback, returns a token or a negative error
+//returns ERR_NOT_SUPPORTED for a message reassembled from CMD_FRAG fragments
+int BUS_cmd_hold(void);
+//release a packet held with BUS_cmd_hold, can be called from any task
+int BUS_cmd_release(int token);
 
 //enable extra I2C own address registers
 int BUS_I2C_aux_addr(unsigned char addr,unsigned char dest);
@@ -5,6 +5,7 @@
   #include <ctl.h>
  
   #include "ARCbus.h"
+  #include "ring.h"
   
   //define serial pins
   #define BUS_PIN_SDA       BIT1
@@ -33,7 +34,7 @@
       MAIN_LOOP_ERR_SPI_CLEAR_FAIL,MAIN_LOOP_ERR_MUTIPLE_CDH,MAIN_LOOP_ERR_CDH_NOT_FOUND,MAIN_LOOP_ERR_RX_BUF_STAT,MAIN_LOOP_ERR_I2C_RX_BUSY,
       MAIN_LOOP_ERR_I2C_ARB_LOST,MAIN_LOOP_CDH_SUB_STAT_REC,MAIN_LOOP_RESET_FAIL,MAIN_LOOP_ERR_SVML,MAIN_LOOP_ERR_SVMH,MAIN_LOOP_SPI_ABORT,
       MAIN_LOOP_ERR_SUBSYSTEM_VERSION_MISMATCH,MAIN_LOOP_ERR_NACK_BUSY,MAIN_LOOP_ERR_TX_NACK_FAIL,MAIN_LOOP_ERR_UNEXPECTED_NACK_EV,
-      MAIN_LOOP_ERR_I2C_RX_BUSY_CNT};
+      MAIN_LOOP_ERR_I2C_RX_BUSY_CNT,MAIN_LOOP_ERR_FRAG_DROP,MAIN_LOOP_ERR_RPC_RESP_FAIL};
       
   //error codes for startup code
   enum{STARTUP_ERR_RESET_UNKNOWN,STARTUP_ERR_MAIN_RETURN,STARTUP_ERR_WDT_RESET,STARTUP_ERR_WDT_PW_RESET,STARTUP_ERR_BOR,STARTUP_ERR_RESET_PIN,STARTUP_ERR_RESET_FLASH_KEYV,
@@ -54,7 +55,7 @@
   enum{ERR_REQ_ERR_SPI_SEND,ERR_REQ_ERR_BUFFER_BUSY,ERR_REQ_ERR_MUTEX_TIMEOUT};
 
   //error codes for I2C
-  enum{I2C_ERR_INVALID_FLAGS,I2C_ERR_TOO_MANY_ERRORS};
+  enum{I2C_ERR_INVALID_FLAGS,I2C_ERR_TOO_MANY_ERRORS,I2C_ERR_BATCH_SEND};
 
   //error codes for version comparison
   enum{VERSION_ERR_INVALID_MAJOR,VERSION_ERR_MAJOR_REV_NEWER,VERSION_ERR_MAJOR_REV_OLDER,VERSION_ERR_INVALID_MINOR,VERSION_ERR_MINOR_REV_NEWER,
@@ -78,24 +79,172 @@
 
   //all events for ARCBUS internal commands
   #define BUS_INT_EV_ALL    (BUS_INT_EV_I2C_CMD_RX|BUS_INT_EV_SPI_COMPLETE|BUS_INT_EV_BUFF_UNLOCK|BUS_INT_EV_RELEASE_MUTEX|BUS_INT_EV_I2C_RX_BUSY|BUS_INT_EV_I2C_ARB_LOST|BUS_INT_EV_SVML|BUS_INT_EV_SVMH)
+  //events that stop a burst of received packets, tasks are waiting on these
+  //error events are left for the end of the burst, receive busy and arbitration loss come with heavy traffic
+  #define BUS_INT_EV_URGENT (BUS_INT_EV_SPI_COMPLETE|BUS_INT_EV_BUFF_UNLOCK|BUS_INT_EV_RELEASE_MUTEX)
 
   //flags for bus helper events
-  enum{BUS_HELPER_EV_ASYNC_TIMEOUT=1<<0,BUS_HELPER_EV_SPI_COMPLETE_CMD=1<<1,BUS_HELPER_EV_SPI_CLEAR_CMD=1<<2,BUS_HELPER_EV_ASYNC_CLOSE=1<<3,BUS_HELPER_EV_ERR_REQ=1<<4,BUS_HELPER_EV_NACK=1<<5};
+  enum{BUS_HELPER_EV_ASYNC_TIMEOUT=1<<0,BUS_HELPER_EV_SPI_COMPLETE_CMD=1<<1,BUS_HELPER_EV_SPI_CLEAR_CMD=1<<2,BUS_HELPER_EV_ASYNC_CLOSE=1<<3,BUS_HELPER_EV_ERR_REQ=1<<4,BUS_HELPER_EV_NACK=1<<5,BUS_HELPER_EV_BATCH_FLUSH=1<<6,BUS_HELPER_EV_SPI_STREAM=1<<7,BUS_HELPER_EV_SPI_STREAM_TIMEOUT=1<<8};
   
-  //flags for I2C_PACKET structures
-  enum{I2C_PACKET_STAT_EMPTY,I2C_PACKET_STAT_IN_PROGRESS,I2C_PACKET_STAT_COMPLETE};
-  
-  //size of I2C packet queue
+  //size of I2C packet queue, must be a power of two
   #define BUS_I2C_PACKET_QUEUE_LEN      16
 
+  #if (BUS_I2C_PACKET_QUEUE_LEN&(BUS_I2C_PACKET_QUEUE_LEN-1))
+    #error BUS_I2C_PACKET_QUEUE_LEN must be a power of two
+  #endif
+
+  //size of the receive lane for bus control commands, must be a power of two
+  #define BUS_I2C_CTL_QUEUE_LEN         4
+
+  #if (BUS_I2C_CTL_QUEUE_LEN&(BUS_I2C_CTL_QUEUE_LEN-1))
+    #error BUS_I2C_CTL_QUEUE_LEN must be a power of two
+  #endif
+
+  //maximum number of receive slots that can be held by command callbacks
+  #define BUS_I2C_RX_HOLD_MAX           4
+
+  //number of frames shared between general call sends and local delivery, must be a power of two
+  #define BUS_BCAST_POOL_LEN            4
+
+  #if (BUS_BCAST_POOL_LEN&(BUS_BCAST_POOL_LEN-1))
+    #error BUS_BCAST_POOL_LEN must be a power of two
+  #endif
+
+  //maximum number of RPC requests waiting for a response
+  #define BUS_RPC_MAX                   8
+
+  //event for RPC response
+  enum{BUS_RPC_EV_DONE=1<<0};
+
+  //hold tokens for shared frames start after the receive queue tokens
+  #define BUS_BCAST_TOKEN_BASE          BUS_I2C_PACKET_QUEUE_LEN
+
+  #if (BUS_I2C_RX_HOLD_MAX>=BUS_I2C_PACKET_QUEUE_LEN)
+    #error BUS_I2C_RX_HOLD_MAX must be less than BUS_I2C_PACKET_QUEUE_LEN
+  #endif
+
+  //size of I2C transmit queue for BUS_cmd_tx_async, must be a power of two
+  #define BUS_TX_QUEUE_LEN              8
+
+  #if (BUS_TX_QUEUE_LEN&(BUS_TX_QUEUE_LEN-1))
+    #error BUS_TX_QUEUE_LEN must be a power of two
+  #endif
+
+  //time for a queued packet to start and complete in ticks
+  #define BUS_TX_ASYNC_TIMEOUT          100
+
+  //owners of the I2C master
+  enum{BUS_TX_OWNER_NONE=0,BUS_TX_OWNER_SYNC,BUS_TX_OWNER_ASYNC};
+
+  //define to send I2C master packets with DMA channel 2 instead of one interrupt per byte
+  //the interrupt is used for any packet where the channel is in use
+  //applications that use channel 2 must claim it with BUS_DMA_OWNER_USER before this is turned on
+  //#define BUS_I2C_TX_DMA
+
+  //shortest packet that is sent with DMA, shorter packets are sent from the interrupt
+  #define BUS_I2C_TX_DMA_MIN            4
+
+  #if (BUS_I2C_TX_DMA_MIN<2)
+    #error BUS_I2C_TX_DMA_MIN must be at least 2
+  #endif
+
+  //define to receive slave packets for own address 0 and general call with DMA channel 2
+  //other addresses and packets that start while the channel is in use are received from the interrupt
+  //applications that use channel 2 must claim it with BUS_DMA_OWNER_USER before this is turned on
+  //#define BUS_I2C_RX_DMA
+
+  //number of destinations that can have batch packets waiting
+  #define BUS_BATCH_DEST                4
+
+  //time to wait for more commands before a batch packet is sent in ticks
+  #define BUS_BATCH_WINDOW              5
+
+  //credit value for destinations that have not limited senders
+  #define BUS_LINK_CREDIT_UNKNOWN       0xFF
+
+  //longest time to wait for credits before sending anyway in ticks
+  #define BUS_LINK_CREDIT_WAIT          20
+
+  //free receive slots needed before senders are told to start again
+  #define BUS_LINK_XON_FREE             (BUS_I2C_PACKET_QUEUE_LEN/2)
+
+  //time the receive queue can stay full without a packet being handled before resetting in ticks
+  #define BUS_I2C_RX_STALL_TIME         2048
+
+  //events for credit updates
+  enum{BUS_LINK_EV_CREDIT=1<<0};
+
+  //number of destinations that link health is kept for
+  #define BUS_LINK_NODES                8
+
+  //consecutive failed sends before a destination is down
+  #define BUS_LINK_DOWN_FAILS           3
+
+  //time between sends that are let through to a down destination in ticks
+  #define BUS_LINK_PROBE_TIME           1024
+
+  //number of fragmented commands that can be reassembled at once
+  #define BUS_FRAG_BUFS                 2
+
+  //time allowed between fragments in ticks
+  #define BUS_FRAG_TIMEOUT              200
+
+  //number of worker tasks for deferred command callbacks
+  #define BUS_CMD_WORKERS               2
+
+  //number of deferred commands that can be waiting or running
+  #define BUS_CMD_WORKER_QUEUE_LEN      4
+
+  //maximum number of received packets handled before checking other bus events
+  //set to 1 to handle one packet per event
+  #define BUS_I2C_RX_BATCH_MAX          8
+
+  //define to store received packets packed into a byte arena instead of fixed size slots
+  //short packets then use only the bytes they need so more packets can be queued in the same RAM
+  //#define BUS_I2C_RX_ARENA
+
+  //size of I2C receive arena in bytes, must be a power of two
+  #define BUS_I2C_RX_ARENA_SIZE         512
+
+  #if (BUS_I2C_RX_ARENA_SIZE&(BUS_I2C_RX_ARENA_SIZE-1))
+    #error BUS_I2C_RX_ARENA_SIZE must be a power of two
+  #endif
+
   //time to wait to retry an I2C packet in 32.768 kHz clocks
   #define BUS_I2C_WAIT_TIME             25          // (about 0.7 ms or about the length of a 4 byte packet at 50kb/s)
 
+  //smallest random backoff window in 32.768 kHz clocks, must be a power of two
+  #define BUS_I2C_BACKOFF_SLOT          32
+
+  #if (BUS_I2C_BACKOFF_SLOT&(BUS_I2C_BACKOFF_SLOT-1))
+    #error BUS_I2C_BACKOFF_SLOT must be a power of two
+  #endif
+
+  //number of times the backoff window doubles, caps the wait at about 32 ms
+  #define BUS_I2C_BACKOFF_MAX_EXP       5
+
   //minimum timeout for SPI transaction
   #define  BUS_SPI_MIN_TIMEOUT    (20)
 
+  //number of SPI receive buffers, must be a power of two
+  //the first buffer is also used by BUS_get_buffer
+  #define BUS_SPI_POOL_LEN              2
+
+  #if (BUS_SPI_POOL_LEN&(BUS_SPI_POOL_LEN-1))
+    #error BUS_SPI_POOL_LEN must be a power of two
+  #endif
+
+  //bytes in each half of the SPI stream double buffer, two segments must fit in the SPI buffer
+  #define BUS_SPI_STREAM_SEG            512
+
+  //time allowed for each stream segment in ticks, the receiver can wait for its sink between segments
+  #define BUS_SPI_STREAM_SEG_TIME       50
+
+  //number of SPI destinations that can be registered
+  #define BUS_SPI_DESTS                 6
+
   //all helper task events
-  #define BUS_HELPER_EV_ALL (BUS_HELPER_EV_ASYNC_TIMEOUT|BUS_HELPER_EV_SPI_COMPLETE_CMD|BUS_HELPER_EV_SPI_CLEAR_CMD|BUS_HELPER_EV_ASYNC_CLOSE|BUS_HELPER_EV_ERR_REQ|BUS_HELPER_EV_NACK)
+  #define BUS_HELPER_EV_ALL (BUS_HELPER_EV_ASYNC_TIMEOUT|BUS_HELPER_EV_SPI_COMPLETE_CMD|BUS_HELPER_EV_SPI_CLEAR_CMD|BUS_HELPER_EV_ASYNC_CLOSE|BUS_HELPER_EV_ERR_REQ|BUS_HELPER_EV_BATCH_FLUSH|BUS_HELPER_EV_SPI_STREAM|BUS_HELPER_EV_SPI_STREAM_TIMEOUT)
   
   //task structure for idle task and ARC bus task
   extern CTL_TASK_t idle_task,ARC_bus_task;
@@ -111,12 +260,18 @@
   
   //structure for receiving I2C data
   typedef struct{
-    unsigned char stat;
     unsigned char len;
     unsigned char flags;
     unsigned char dat[BUS_I2C_HDR_LEN+BUS_I2C_MAX_PACKET_LEN+BUS_I2C_CRC_LEN];
   }I2C_PACKET;
 
+  //general call packet shared by the sender and local delivery
+  typedef struct{
+    I2C_PACKET pk;
+    //number of references, the frame is free when this is zero
+    volatile unsigned char ref;
+  }BUS_BCAST_FRAME;
+
   extern RESET_ERROR saved_error;
   
   //stack for ARC bus task
@@ -124,11 +279,161 @@
   
   extern BUS_STAT arcBus_stat;
   
+#ifdef BUS_I2C_RX_ARENA
+  //arena for ISR command receive
+  extern BUS_ARENA I2C_rx_arena;
+#else
   //buffer for ISR command receive
   extern I2C_PACKET I2C_rx_buf[BUS_I2C_PACKET_QUEUE_LEN];
-  //queue indexes
-  extern short I2C_rx_in,I2C_rx_out;
+  //ring indexes for the receive buffer
+  extern BUS_RING I2C_rx_ring;
+#endif
+
+  //initialize I2C receive queue to empty state
+  void I2C_rx_init(void);
+  //producer : get a packet to receive into, returns NULL if the queue is full
+  //only the I2C ISR or code running with interrupts disabled may call this
+  I2C_PACKET *I2C_rx_start(void);
+  //producer : publish the packet returned by I2C_rx_start, pk->len must be set
+  //bus control commands are copied into the control lane
+  void I2C_rx_commit(I2C_PACKET *pk);
+  //consumer : get the oldest received packet, returns NULL if the queue is empty
+  //only the ARCbus task may call this
+  I2C_PACKET *I2C_rx_peek(void);
+  //consumer : done with the packet returned by I2C_rx_peek
+  void I2C_rx_done(void);
+  //consumer : get the oldest control command packet, returns NULL if the control lane is empty
+  //control packets are never passed to callbacks so they can not be held
+  I2C_PACKET *I2C_rx_ctl_peek(void);
+  //consumer : done with the packet returned by I2C_rx_ctl_peek
+  void I2C_rx_ctl_done(void);
+  //consumer : record the number of packets handled on one wakeup
+  void I2C_rx_batch(unsigned short n);
+  //return the number of packets that can be received before the queue is full
+  unsigned short I2C_rx_free(void);
+
+  //initialize shared frame pool to empty state
+  void BUS_bcast_init(void);
+  //copy a general call packet into a shared frame and queue it to be parsed locally
+  //returns the frame with a reference for the caller or NULL if no frame is free, never waits
+  BUS_BCAST_FRAME *BUS_bcast_post(unsigned char flags,const BUS_IOVEC *seg,unsigned short nseg);
+  //release a reference to a shared frame
+  void BUS_bcast_put(BUS_BCAST_FRAME *frame);
+  //consumer : get the oldest general call packet sent by this board, returns NULL if there is none
+  //only the ARCbus task may call this
+  I2C_PACKET *BUS_bcast_peek(void);
+  //get the general call packet that is being parsed, returns NULL if a lane packet is not being parsed
+  I2C_PACKET *BUS_bcast_current(void);
+  //consumer : done with the packet returned by BUS_bcast_peek
+  void BUS_bcast_done(void);
+  //hold the shared frame that is being parsed, returns ERR_INVALID_ARGUMENT if the packet is not a shared frame
+  int BUS_bcast_hold(void);
+  //release a shared frame held with BUS_bcast_hold
+  int BUS_bcast_release(int token);
+  //copy shared frame counters into stats structure
+  void BUS_bcast_stats(BUS_RX_STATS *stats);
+
+  //initialize credits so no destination is limited
+  void BUS_link_init(void);
+  //wait for credits to send to addr, returns after BUS_LINK_CREDIT_WAIT if no credits are received
+  void BUS_link_wait(unsigned char addr);
+  //check if a packet can be sent to addr, returns ERR_NODE_DOWN if addr is down and it is not time to probe
+  int BUS_link_check(unsigned char addr);
+  //save start time of a packet, called with the I2C bus locked
+  void BUS_link_tx_begin(void);
+  //update credits and link health after a packet was sent to addr
+  void BUS_link_tx_result(unsigned char addr,int result);
+  //credits received from addr in a CMD_CREDIT packet
+  void BUS_link_credit_rx(unsigned char addr,unsigned char credits);
+  //receive queue was full, tell senders to stop
+  void BUS_link_rx_busy(void);
+  //check if senders can be told to start again, called after received packets are handled
+  void BUS_link_rx_check(void);
   
+  //queue a NACK packet, the packet is sent from the I2C interrupt so the caller does not wait
+  void BUS_send_nack(unsigned char addr,unsigned char cmd,unsigned char reason);
+
+  //RPC request that a task is handling
+  typedef struct{
+    //address to send the response to
+    unsigned char addr;
+    //sequence number of the request
+    unsigned char seq;
+    //state of the request
+    unsigned char state;
+  }BUS_RPC_CTX;
+
+  //RPC request states
+  enum{BUS_RPC_CTX_NONE=0,BUS_RPC_CTX_OPEN,BUS_RPC_CTX_DONE};
+
+  //start receiving a stream as SPI master, returns zero or a NACK reason
+  int BUS_SPI_stream_start(unsigned char addr,const unsigned char *ptr);
+  //stream segment received, called from the DMA interrupt, returns zero if no stream is running
+  int BUS_SPI_stream_dma(void);
+  //stop a stream because the sender aborted
+  int BUS_SPI_stream_abort(unsigned char addr);
+  //pass received segments to the sink, called from the helper task
+  void BUS_SPI_stream_consume(void);
+  //return nonzero if a stream is being received
+  int BUS_SPI_stream_busy(void);
+  //stop a stream if the sender did not finish a segment in time, called from the helper task
+  void BUS_SPI_stream_timeout(void);
+  //time left for the stream segment being received in ticks
+  extern volatile unsigned short BUS_SPI_stream_timer;
+
+  //get the registered destination buffer for a transfer, NULL if the pool is used
+  unsigned char *BUS_SPI_dest_get(unsigned char addr,unsigned char type,unsigned short len);
+  //end the transfer into the destination buffer
+  void BUS_SPI_dest_done(int result);
+
+  //initialize pending RPC request table
+  void BUS_rpc_init(void);
+  //handle a CMD_RPC_RESP packet, returns zero or a NACK reason
+  int BUS_rpc_resp_rx(unsigned char addr,const unsigned char *dat,unsigned short len);
+  //start handling a request in this task
+  void BUS_rpc_begin(unsigned char addr,unsigned char seq);
+  //pass the request this task is handling to another task
+  void BUS_rpc_take(BUS_RPC_CTX *ctx);
+  //continue handling a request passed with BUS_rpc_take
+  void BUS_rpc_resume(const BUS_RPC_CTX *ctx);
+  //done handling a request, sends the status if no reply was sent
+  void BUS_rpc_end(int resp);
+
+  //pass a command to the subsystem callbacks, returns zero on success or a NACK reason
+  int cmd_parse_dispatch(unsigned char addr,unsigned char cmd,unsigned char *ptr,unsigned short len,unsigned char flags,unsigned char nack);
+
+  //setup queues and start worker tasks for deferred command callbacks
+  void cmd_worker_init(void);
+  //pass a command to a worker task, returns ERR_BUSY if the queue is full
+  int cmd_worker_post(CMD_PARSE_DAT *parse,unsigned char addr,unsigned char cmd,unsigned char *dat,unsigned short len,unsigned char flags,unsigned char nack);
+
+  //buffer for reassembling fragmented commands
+  typedef struct{
+    //sender address, zero if free
+    unsigned char addr;
+    //command
+    unsigned char cmd;
+    //message id
+    unsigned char id;
+    //next fragment index
+    unsigned char next;
+    //bytes received
+    unsigned short len;
+    //time last fragment was received
+    CTL_TIME_t time;
+    //message data
+    unsigned char dat[BUS_FRAG_MAX_LEN];
+  }BUS_FRAG_BUF;
+
+  //initialize reassembly buffers
+  void BUS_frag_init(void);
+  //add a fragment to the reassembly buffer for addr, returns the buffer when the message is complete
+  BUS_FRAG_BUF *BUS_frag_rx(unsigned char addr,const unsigned char *ptr,unsigned short len,int *resp);
+  //done with a complete message
+  void BUS_frag_free(BUS_FRAG_BUF *buf);
+  //nonzero while a reassembled message is parsed, the message is not in a packet that can be held
+  extern unsigned char BUS_cmd_no_hold;
+
   //power status
   extern unsigned short powerState;
   
@@ -141,6 +446,14 @@
 
   //setup stuff for buffer usage
   void BUS_init_buffer(void);
+  //get a buffer to receive SPI data into, returns the buffer index or -1 if all buffers are in use
+  int BUS_buf_rx_get(void);
+  //return pointer to a pool buffer
+  unsigned char *BUS_buf_ptr(int idx);
+  //free a buffer returned by BUS_buf_rx_get
+  void BUS_buf_rx_free(int idx);
+  //give a buffer with received data to the subsystem
+  void BUS_buf_rx_ready(int idx,unsigned short len);
   
   //address for async communications
   extern unsigned char async_addr;
@@ -153,7 +466,65 @@
   //Open asynchronous when asked to by a board
   void async_open_remote(unsigned char addr);
   
+  //time to wait for the I2C bus in ticks
+  #define BUS_I2C_LOCK_TIMEOUT          100
+
+  //event for a task waiting for the I2C bus
+  enum{BUS_ARB_EV_GRANT=1<<0};
+
+  //seed random backoff from the node address
+  void BUS_backoff_init(unsigned char addr);
+  //new packet is starting, clear counters for the packet
+  void BUS_backoff_start(void);
+  //arbitration was lost, returns the time to wait before trying again in 32.768 kHz clocks
+  unsigned short BUS_backoff_collision(void);
+  //packet is being tried again, returns the time to wait before the next try in 32.768 kHz clocks
+  unsigned short BUS_backoff_retry(void);
+
+  //set the I2C bus to free
+  void BUS_arb_init(void);
+  //wait for the I2C bus, returns RET_SUCCESS or ERR_BUSY if the bus was not free within timeout ticks
+  //the bus is given to the highest priority waiting task, tasks with the same priority get it in order
+  //the task that has the bus runs at the priority of the highest waiting task
+  int BUS_arb_lock(CTL_TIME_t timeout);
+  //release the I2C bus and give it to the next waiting task
   void BUS_I2C_release(void);
+  //check I2C address
+  int addr_chk(unsigned char addr);
+  //copy a packet into the receive queue so it is parsed locally, interrupts must be disabled
+  int BUS_cmd_loopback(unsigned char addr,const unsigned char *buff,unsigned short len);
+  //copy a packet in parts into the receive queue so it is parsed locally, interrupts must be disabled
+  int BUS_cmd_loopbackv(unsigned char addr,const BUS_IOVEC *seg,unsigned short nseg);
+
+  //initialize transmit queue to empty state
+  void BUS_tx_init(void);
+  //initialize batch buffers
+  void BUS_batch_init(void);
+  //time until batches are sent in ticks
+  extern volatile unsigned short BUS_batch_timer;
+  //handle master stop condition, returns nonzero if the packet was queued by BUS_cmd_tx_async
+  int BUS_tx_async_stop(unsigned short end_e);
+  //check for transmit timeout, called from tick ISR
+  void BUS_tx_async_tick(void);
+  //take the I2C master for BUS_cmd_tx, waits for the queued packet in progress to finish
+  int BUS_tx_claim(void);
+  //give back the I2C master after BUS_cmd_tx and start any queued packets
+  void BUS_tx_release(void);
+
+  //set all DMA channels to free
+  void BUS_DMA_init(void);
+  //start DMA for the rest of the master packet, called from I2C ISR, returns nonzero if DMA is used
+  int BUS_I2C_tx_dma_start(void);
+  //stop DMA transmit and hand the rest of the packet back to the I2C interrupt
+  void BUS_I2C_tx_dma_stop(void);
+  //DMA transmit is finished, called from DMA ISR, returns nonzero if DMA channel 2 was used for I2C
+  int BUS_I2C_tx_dma_done(void);
+  //start DMA receive into the current packet, called from I2C ISR on start, returns nonzero if DMA is used
+  int BUS_I2C_rx_dma_start(void);
+  //stop DMA receive, set the receive index and hand the rest of the packet back to the I2C interrupt
+  void BUS_I2C_rx_dma_stop(void);
+  //DMA receive buffer is full, called from DMA ISR, returns nonzero if DMA channel 2 was used for I2C
+  int BUS_I2C_rx_dma_done(void);
   
 
   void BUS_pin_disable(void);
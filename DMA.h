@@ -10,4 +10,16 @@ enum{DMA_EV_SD_SPI=1<<0,DMA_EV_USER=1<<1};
 //variable for DMA events
 extern CTL_EVENT_SET_t DMA_events;
 
+//DMA channels
+enum{BUS_DMA_CH0=0,BUS_DMA_CH1,BUS_DMA_CH2,BUS_DMA_NUM_CH};
+
+//DMA channel owners
+enum{BUS_DMA_OWNER_NONE=0,BUS_DMA_OWNER_SPI,BUS_DMA_OWNER_I2C,BUS_DMA_OWNER_USER,BUS_DMA_OWNER_I2C_RX};
+
+//take a DMA channel, returns RET_SUCCESS or ERR_BUSY if the channel is in use even by owner
+//a channel used for I2C is taken back from the I2C and the packet finishes from the interrupt
+int BUS_DMA_claim(int chan,unsigned char owner);
+//give back a DMA channel, the channel is disabled if owner has it
+void BUS_DMA_release(int chan,unsigned char owner);
+
 #endif
@@ -76,6 +76,12 @@ const char *err_decode_arcbus(char buf[150], unsigned short source,int err, unsi
           return "ARCbus Main Loop : Unpected Tx NACK event";
         case MAIN_LOOP_ERR_I2C_RX_BUSY_CNT:
           return "ARCbus Main Loop : Maximum Rx Buffer Busy count reached";
+        case MAIN_LOOP_ERR_FRAG_DROP:
+          sprintf(buf,"ARCbus Main Loop : Incomplete fragmented command %s (%i) from 0x%02X dropped",BUS_cmdtostr(argument&0xFF),argument&0xFF,argument>>8);
+          return buf;
+        case MAIN_LOOP_ERR_RPC_RESP_FAIL:
+          sprintf(buf,"ARCbus Main Loop : Failed to queue RPC response to 0x%02X for sequence %i",argument>>8,argument&0xFF);
+          return buf;
       }
     break; 
     case BUS_ERR_SRC_STARTUP:
@@ -189,6 +195,9 @@ const char *err_decode_arcbus(char buf[150], unsigned short source,int err, unsi
         case I2C_ERR_TOO_MANY_ERRORS:
             sprintf(buf,"I2C : too many errors : %s (%i)",BUS_error_str(argument),argument);
         return buf;
+        case I2C_ERR_BATCH_SEND:
+            sprintf(buf,"I2C : failed to queue batch packet : %s (%i)",BUS_error_str(argument),argument);
+        return buf;
       }
     break;
     case BUS_ERR_SRC_VERSION:
@@ -8,14 +8,48 @@
 
 #include "ARCbus_internal.h"
 
-//buffer for ISR command receive
-I2C_PACKET I2C_rx_buf[BUS_I2C_PACKET_QUEUE_LEN];
-//queue indexes
-short I2C_rx_in,I2C_rx_out;
+//packet that is currently being received
+static I2C_PACKET *rx_pk;
 
 //DMA events
 CTL_EVENT_SET_t DMA_events;
 
+//go back to the start of the master packet
+static void BUS_I2C_tx_rewind(void){
+  //check for segments
+  if(arcBus_stat.i2c_stat.tx.iov!=NULL){
+    //use first segment
+    arcBus_stat.i2c_stat.tx.seg=0;
+    arcBus_stat.i2c_stat.tx.ptr=arcBus_stat.i2c_stat.tx.iov[0].ptr;
+    arcBus_stat.i2c_stat.tx.len=arcBus_stat.i2c_stat.tx.iov[0].len;
+  }
+  //set index
+  arcBus_stat.i2c_stat.tx.base=0;
+  arcBus_stat.i2c_stat.tx.idx=0;
+}
+
+//move to the next segment that has data, returns zero if there are no more bytes
+static int BUS_I2C_tx_next(void){
+  //packet in one buffer has no more segments
+  if(arcBus_stat.i2c_stat.tx.iov==NULL){
+    return 0;
+  }
+  while(arcBus_stat.i2c_stat.tx.seg+1<arcBus_stat.i2c_stat.tx.iovcnt){
+    //count bytes sent
+    arcBus_stat.i2c_stat.tx.base+=arcBus_stat.i2c_stat.tx.len;
+    //next segment
+    arcBus_stat.i2c_stat.tx.seg++;
+    arcBus_stat.i2c_stat.tx.ptr=arcBus_stat.i2c_stat.tx.iov[arcBus_stat.i2c_stat.tx.seg].ptr;
+    arcBus_stat.i2c_stat.tx.len=arcBus_stat.i2c_stat.tx.iov[arcBus_stat.i2c_stat.tx.seg].len;
+    arcBus_stat.i2c_stat.tx.idx=0;
+    //check for data
+    if(arcBus_stat.i2c_stat.tx.len>0){
+      return 1;
+    }
+  }
+  return 0;
+}
+
 //=======================================================================================
 //                      [Interrupt Service Routines]
 //=======================================================================================
@@ -24,14 +58,16 @@ void bus_I2C_isr(void) __ctl_interrupt[USCI_B0_VECTOR]{
   static unsigned short end_e=0;
   switch(UCB0IV){
     case USCI_I2C_UCALIFG:    //Arbitration lost
+      //stop DMA transmit
+      BUS_I2C_tx_dma_stop();
       //Check if packet was in progress
       if(arcBus_stat.i2c_stat.tx.stat==BUS_I2C_MASTER_IN_PROGRESS){
-        //set index
-        arcBus_stat.i2c_stat.tx.idx=0;
+        //go back to the start of the packet
+        BUS_I2C_tx_rewind();
         //set I2C master state
         arcBus_stat.i2c_stat.tx.stat=BUS_I2C_MASTER_PENDING;
-        //set timer to attempt to send later
-        TA1CCR1=readTA1()+BUS_I2C_WAIT_TIME;
+        //set timer to attempt to send later, random delay so masters don't collide again
+        TA1CCR1=readTA1()+BUS_backoff_collision();
         //setup TA1CCR1 interrupt
         TA1CCTL1=CCIE;
       }
@@ -40,22 +76,19 @@ void bus_I2C_isr(void) __ctl_interrupt[USCI_B0_VECTOR]{
       //check if running
       if(arcBus_stat.i2c_stat.mode!=BUS_I2C_IDLE){
         //set status to idle
+        //a packet in progress is not published so the slot is reused
         arcBus_stat.i2c_stat.mode=BUS_I2C_IDLE;
       }
-      //reset rx buffer status if in progress
-      if(I2C_rx_buf[I2C_rx_in].stat==I2C_PACKET_STAT_IN_PROGRESS){
-        //reset packet flags
-        I2C_rx_buf[I2C_rx_in].stat=I2C_PACKET_STAT_EMPTY;
-        //decrement packet index
-      }
     break;
     case USCI_I2C_UCNACKIFG:    //NACK interrupt  
       //Acknowledge expected but not received  
+      //stop DMA transmit, this updates the index
+      BUS_I2C_tx_dma_stop();
       //generate stop condition
       UCB0CTL1|=UCTXSTP; 
       //check if we have written more than a byte to the TX buffer
       //one byte is always written after the start condition is sent
-      if(arcBus_stat.i2c_stat.tx.idx>1){
+      if(arcBus_stat.i2c_stat.tx.base+arcBus_stat.i2c_stat.tx.idx>1){
           //check if end_e is set
           if(end_e==0){
             //set ABORT as the end event
@@ -77,8 +110,17 @@ void bus_I2C_isr(void) __ctl_interrupt[USCI_B0_VECTOR]{
       //check status
       //This is to fix the issue where the start condition happens before the stop can be processed
       if(arcBus_stat.i2c_stat.mode==BUS_I2C_RX){
-        //set flag to notify 
-        ctl_events_set_clear(&BUS_INT_events,BUS_INT_EV_I2C_CMD_RX,0);
+        //stop DMA receive, this sets the index
+        BUS_I2C_rx_dma_stop();
+        //check that the packet can hold a header and CRC, shorter packets are dropped
+        if(arcBus_stat.i2c_stat.rx.idx>=BUS_I2C_HDR_LEN+BUS_I2C_CRC_LEN){
+          //set packet length
+          rx_pk->len=arcBus_stat.i2c_stat.rx.idx;
+          //publish packet
+          I2C_rx_commit(rx_pk);
+          //set flag to notify 
+          ctl_events_set_clear(&BUS_INT_events,BUS_INT_EV_I2C_CMD_RX,0);
+        }
         //set state to idle
         arcBus_stat.i2c_stat.mode=BUS_I2C_IDLE;
       }
@@ -89,33 +131,39 @@ void bus_I2C_isr(void) __ctl_interrupt[USCI_B0_VECTOR]{
         //An I2C slave should always be the receiver
         arcBus_stat.i2c_stat.tx.ptr=NULL;
         arcBus_stat.i2c_stat.tx.len=-1;
+        arcBus_stat.i2c_stat.tx.iov=NULL;
         //set mode to Tx
         arcBus_stat.i2c_stat.mode=BUS_I2C_TX;
         //send first byte to save time
         UCB0TXBUF=BUS_I2C_DUMMY_DATA;
       }else{
+        //get a free packet
+        rx_pk=I2C_rx_start();
         //check buffer status
-        if(I2C_rx_buf[I2C_rx_in].stat!=I2C_PACKET_STAT_EMPTY){
-          //buffer is in-use transmit NACK
+        if(rx_pk==NULL){
+          //queue is full transmit NACK
           UCB0CTL1|=UCTXNACK;
           //set flag to indicate an error
           ctl_events_set_clear(&BUS_INT_events,BUS_INT_EV_I2C_RX_BUSY,0);
         }else{
           //setup receive status
-          arcBus_stat.i2c_stat.rx.ptr=I2C_rx_buf[I2C_rx_in].dat;
-          arcBus_stat.i2c_stat.rx.len=sizeof(I2C_rx_buf[0].dat);
+          arcBus_stat.i2c_stat.rx.ptr=rx_pk->dat;
+          arcBus_stat.i2c_stat.rx.len=sizeof(rx_pk->dat);
           arcBus_stat.i2c_stat.rx.idx=0;
           //set mode to Rx
           arcBus_stat.i2c_stat.mode=BUS_I2C_RX;
-          //set buffer status
-          I2C_rx_buf[I2C_rx_in].stat=I2C_PACKET_STAT_IN_PROGRESS;
           //check if this is a general call packet
           if(UCB0STATW&UCGC){
             //set that general call address was received 
-            I2C_rx_buf[I2C_rx_in].flags=CMD_PARSE_GC_ADDR;
+            rx_pk->flags=CMD_PARSE_GC_ADDR;
           }else{
             //received address is not known yet
-            I2C_rx_buf[I2C_rx_in].flags=0;
+            rx_pk->flags=0;
+          }
+          //try to receive the packet with DMA
+          if(BUS_I2C_rx_dma_start() && rx_pk->flags==0){
+            //DMA is only used for address 0
+            rx_pk->flags=CMD_PARSE_ADDR0;
           }
         }
       }
@@ -123,8 +171,13 @@ void bus_I2C_isr(void) __ctl_interrupt[USCI_B0_VECTOR]{
     case USCI_I2C_UCSTPIFG:    //Stop condition received
       //check if we are master
       if(UCB0CTLW0&UCMST){
-        //set saved event and clear TX self event
-        ctl_events_set_clear(&arcBus_stat.events,end_e,0);
+        //make sure DMA transmit is stopped
+        BUS_I2C_tx_dma_stop();
+        //check for a queued packet, the next queued packet is started here
+        if(!BUS_tx_async_stop(end_e)){
+          //set saved event and clear TX self event
+          ctl_events_set_clear(&arcBus_stat.events,end_e,0);
+        }
         //clear saved event
         end_e=0;
         //set state to idle
@@ -134,27 +187,28 @@ void bus_I2C_isr(void) __ctl_interrupt[USCI_B0_VECTOR]{
         UCB0IFG&=~UCSTTIFG;
         //check if transaction was a command
         if(arcBus_stat.i2c_stat.mode==BUS_I2C_RX){
-          //set packet length
-          I2C_rx_buf[I2C_rx_in].len=arcBus_stat.i2c_stat.rx.idx;
+          //stop DMA receive, this sets the index
+          BUS_I2C_rx_dma_stop();
+          //check that the packet can hold a header and CRC, shorter packets are dropped
+          if(arcBus_stat.i2c_stat.rx.idx>=BUS_I2C_HDR_LEN+BUS_I2C_CRC_LEN){
+            //set packet length
+            rx_pk->len=arcBus_stat.i2c_stat.rx.idx;
+            //publish packet
+            I2C_rx_commit(rx_pk);
+            //set flag to notify 
+            ctl_events_set_clear(&BUS_INT_events,BUS_INT_EV_I2C_CMD_RX,0);
+          }
           //zero rx index
           arcBus_stat.i2c_stat.rx.idx=0;
-          //set buffer status to complete
-          I2C_rx_buf[I2C_rx_in].stat=I2C_PACKET_STAT_COMPLETE;
-          //increment index
-          I2C_rx_in++;
-          //check for wraparound
-          if(I2C_rx_in>=BUS_I2C_PACKET_QUEUE_LEN){
-            I2C_rx_in=0;
-          }
-          //set flag to notify 
-          ctl_events_set_clear(&BUS_INT_events,BUS_INT_EV_I2C_CMD_RX,0);
           //set event to notify software transmitters
           ctl_events_set_clear(&arcBus_stat.events,BUS_EV_I2C_RX_DONE,0);
         }
         //set state to idle
         arcBus_stat.i2c_stat.mode=BUS_I2C_IDLE;
-        //check master status to see if a command is pending
-        if(arcBus_stat.i2c_stat.tx.stat==BUS_I2C_MASTER_PENDING){          
+        //check master status to see if a command is pending, packets that lost arbitration wait for the timer
+        if(arcBus_stat.i2c_stat.tx.stat==BUS_I2C_MASTER_PENDING && !(TA1CCTL1&CCIE)){          
+          //count retry
+          BUS_backoff_retry();
           //transmision interrupted, start again
           //set to transmit mode
           UCB0CTLW0|=UCTR;
@@ -178,18 +232,18 @@ void bus_I2C_isr(void) __ctl_interrupt[USCI_B0_VECTOR]{
         end_e=BUS_EV_I2C_TX_SELF;
         break;
       }  
-      //check buffer size
-      if(arcBus_stat.i2c_stat.rx.idx>=sizeof(I2C_rx_buf[0].dat)){
+      //check buffer size, no packet is in progress if the queue was full
+      if(arcBus_stat.i2c_stat.mode!=BUS_I2C_RX || arcBus_stat.i2c_stat.rx.idx>=arcBus_stat.i2c_stat.rx.len){
         //receive buffer is full, send NACK
         UCB0CTL1|=UCTXNACK;
-      }else{
-        //receive data
-        arcBus_stat.i2c_stat.rx.ptr[arcBus_stat.i2c_stat.rx.idx++]=UCB0RXBUF;
+        break;
       }
+      //receive data
+      arcBus_stat.i2c_stat.rx.ptr[arcBus_stat.i2c_stat.rx.idx++]=UCB0RXBUF;
       //check if flags have been set
-      if(I2C_rx_buf[I2C_rx_in].flags==0){
+      if(rx_pk->flags==0){
         //set flag for addr3
-        I2C_rx_buf[I2C_rx_in].flags=CMD_PARSE_ADDR3;
+        rx_pk->flags=CMD_PARSE_ADDR3;
       }
     break;
     case USCI_I2C_UCTXIFG3:    //Slave 3 TXIFG
@@ -205,18 +259,18 @@ void bus_I2C_isr(void) __ctl_interrupt[USCI_B0_VECTOR]{
         end_e=BUS_EV_I2C_TX_SELF;
         break;
       }  
-      //check buffer size
-      if(arcBus_stat.i2c_stat.rx.idx>=sizeof(I2C_rx_buf[0].dat)){
+      //check buffer size, no packet is in progress if the queue was full
+      if(arcBus_stat.i2c_stat.mode!=BUS_I2C_RX || arcBus_stat.i2c_stat.rx.idx>=arcBus_stat.i2c_stat.rx.len){
         //receive buffer is full, send NACK
         UCB0CTL1|=UCTXNACK;
-      }else{
-        //receive data
-        arcBus_stat.i2c_stat.rx.ptr[arcBus_stat.i2c_stat.rx.idx++]=UCB0RXBUF;
+        break;
       }
+      //receive data
+      arcBus_stat.i2c_stat.rx.ptr[arcBus_stat.i2c_stat.rx.idx++]=UCB0RXBUF;
       //check if flags have been set
-      if(I2C_rx_buf[I2C_rx_in].flags==0){
+      if(rx_pk->flags==0){
         //set flag for addr2
-        I2C_rx_buf[I2C_rx_in].flags=CMD_PARSE_ADDR2;
+        rx_pk->flags=CMD_PARSE_ADDR2;
       }
     break;
     case USCI_I2C_UCTXIFG2:    //Slave 2 TXIFG
@@ -232,18 +286,18 @@ void bus_I2C_isr(void) __ctl_interrupt[USCI_B0_VECTOR]{
         end_e=BUS_EV_I2C_TX_SELF;
         break;
       }  
-      //check buffer size
-      if(arcBus_stat.i2c_stat.rx.idx>=sizeof(I2C_rx_buf[0].dat)){
+      //check buffer size, no packet is in progress if the queue was full
+      if(arcBus_stat.i2c_stat.mode!=BUS_I2C_RX || arcBus_stat.i2c_stat.rx.idx>=arcBus_stat.i2c_stat.rx.len){
         //receive buffer is full, send NACK
         UCB0CTL1|=UCTXNACK;
-      }else{
-        //receive data
-        arcBus_stat.i2c_stat.rx.ptr[arcBus_stat.i2c_stat.rx.idx++]=UCB0RXBUF;
+        break;
       }
+      //receive data
+      arcBus_stat.i2c_stat.rx.ptr[arcBus_stat.i2c_stat.rx.idx++]=UCB0RXBUF;
       //check if flags have been set
-      if(I2C_rx_buf[I2C_rx_in].flags==0){
+      if(rx_pk->flags==0){
         //set flag for addr1
-        I2C_rx_buf[I2C_rx_in].flags=CMD_PARSE_ADDR1;
+        rx_pk->flags=CMD_PARSE_ADDR1;
       }
     break;
     case USCI_I2C_UCTXIFG1:    //Slave 1 TXIFG
@@ -257,18 +311,18 @@ void bus_I2C_isr(void) __ctl_interrupt[USCI_B0_VECTOR]{
         end_e=BUS_EV_I2C_TX_SELF;
         break;
       }  
-      //check buffer size
-      if(arcBus_stat.i2c_stat.rx.idx>=sizeof(I2C_rx_buf[0].dat)){
+      //check buffer size, no packet is in progress if the queue was full
+      if(arcBus_stat.i2c_stat.mode!=BUS_I2C_RX || arcBus_stat.i2c_stat.rx.idx>=arcBus_stat.i2c_stat.rx.len){
         //receive buffer is full, send NACK
         UCB0CTL1|=UCTXNACK;
-      }else{
-        //receive data
-        arcBus_stat.i2c_stat.rx.ptr[arcBus_stat.i2c_stat.rx.idx++]=UCB0RXBUF;
+        break;
       }
+      //receive data
+      arcBus_stat.i2c_stat.rx.ptr[arcBus_stat.i2c_stat.rx.idx++]=UCB0RXBUF;
       //check if flags have been set
-      if(I2C_rx_buf[I2C_rx_in].flags==0){
+      if(rx_pk->flags==0){
         //set flag for addr0
-        I2C_rx_buf[I2C_rx_in].flags=CMD_PARSE_ADDR0;
+        rx_pk->flags=CMD_PARSE_ADDR0;
       }
     break;
     case USCI_I2C_UCTXIFG0:    //Data transmit in master mode and Slave 0 TXIFG
@@ -281,8 +335,12 @@ void bus_I2C_isr(void) __ctl_interrupt[USCI_B0_VECTOR]{
         //set flag to notify 
         ctl_events_set_clear(&arcBus_stat.events,BUS_EV_I2C_MASTER_STARTED,0);
       }
-      //check if there are more bytes
-      if(arcBus_stat.i2c_stat.tx.len>arcBus_stat.i2c_stat.tx.idx){
+      //check if there are more bytes in this segment or another segment
+      if(arcBus_stat.i2c_stat.tx.len>arcBus_stat.i2c_stat.tx.idx || BUS_I2C_tx_next()){
+        //in master mode try to send the rest of the packet with DMA
+        if(UCB0CTLW0&UCMST && BUS_I2C_tx_dma_start()){
+          break;
+        }
         //transmit data
         UCB0TXBUF=arcBus_stat.i2c_stat.tx.ptr[arcBus_stat.i2c_stat.tx.idx++];
       }else{//nothing left to send
@@ -304,6 +362,8 @@ void bus_I2C_isr(void) __ctl_interrupt[USCI_B0_VECTOR]{
     case USCI_I2C_UCCLTOIFG:    //Cock low timeout
       //check if master or slave
       if(UCB0CTLW0&UCMST){
+        //stop DMA transmit
+        BUS_I2C_tx_dma_stop();
         //master mode, generate stop condition
         UCB0CTL1|=UCTXSTP;
         //set end event
@@ -373,12 +433,20 @@ void bus_int(void) __ctl_interrupt[PORT2_VECTOR]{
 void DMA_int(void) __ctl_interrupt[DMA_VECTOR]{
   switch(DMAIV){
     case DMAIV_DMA0IFG:
+      //check if the channel is receiving a stream segment
+      if(BUS_SPI_stream_dma()){
+        break;
+      }
       ctl_events_set_clear(&BUS_INT_events,BUS_INT_EV_SPI_COMPLETE,0);
     break;
     case DMAIV_DMA1IFG:
       ctl_events_set_clear(&DMA_events,DMA_EV_SD_SPI,0);
     break;
     case DMAIV_DMA2IFG:
+      //check if the channel was sending an I2C packet
+      if(BUS_I2C_tx_dma_done() || BUS_I2C_rx_dma_done()){
+        break;
+      }
       ctl_events_set_clear(&DMA_events,DMA_EV_USER,0);
     break;
   }
@@ -400,6 +468,22 @@ void task_tick(void) __ctl_interrupt[TIMER1_A0_VECTOR]{
       ctl_events_set_clear(&BUS_helper_events,BUS_HELPER_EV_ASYNC_TIMEOUT,0);
     }
   }
+  //check batch timer
+  if(BUS_batch_timer){
+    BUS_batch_timer--;
+    if(!BUS_batch_timer){
+      ctl_events_set_clear(&BUS_helper_events,BUS_HELPER_EV_BATCH_FLUSH,0);
+    }
+  }
+  //check stream segment timer
+  if(BUS_SPI_stream_timer){
+    BUS_SPI_stream_timer--;
+    if(!BUS_SPI_stream_timer){
+      ctl_events_set_clear(&BUS_helper_events,BUS_HELPER_EV_SPI_STREAM_TIMEOUT,0);
+    }
+  }
+  //check for queued packet timeout
+  BUS_tx_async_tick();
   BUS_timer_timeout_check();
 }
 
@@ -419,7 +503,7 @@ void bus_resend(void) __ctl_interrupt[TIMER1_A1_VECTOR]{
         //generate start condition
         UCB0CTL1|=UCTXSTT;
         //set next timeout
-        TA1CCR1+=BUS_I2C_WAIT_TIME;
+        TA1CCR1+=BUS_backoff_retry();
       }else{
         //disable interrupts
         TA1CCTL1&=~CCIE;
@@ -0,0 +1,163 @@
+#include <ctl.h>
+#include <msp430.h>
+#include "ARCbus.h"
+
+#include "ARCbus_internal.h"
+
+//task waiting for the I2C bus, lives on the stack of the waiting task
+typedef struct BUS_ARB_WAIT{
+  //waiting task
+  CTL_TASK_t *task;
+  //priority of the task when it started waiting
+  unsigned char pri;
+  //set when the bus is given to the task
+  volatile unsigned char granted;
+  //event set used to wake the task
+  CTL_EVENT_SET_t e;
+  //next waiting task
+  struct BUS_ARB_WAIT *next;
+}BUS_ARB_WAIT;
+
+//waiting tasks, highest priority first and in arrival order for the same priority
+static BUS_ARB_WAIT *BUS_arb_head;
+//task that has the bus, NULL if the bus is free
+static CTL_TASK_t *BUS_arb_owner;
+//priority of the owner before it was raised
+static unsigned char BUS_arb_owner_pri;
+//number of times the owner has locked the bus
+static unsigned char BUS_arb_nest;
+
+//set the bus to free
+void BUS_arb_init(void){
+  BUS_arb_head=NULL;
+  BUS_arb_owner=NULL;
+  BUS_arb_nest=0;
+}
+
+//wait for the I2C bus, returns RET_SUCCESS or ERR_BUSY if the bus was not free within timeout ticks
+int BUS_arb_lock(CTL_TIME_t timeout){
+  BUS_ARB_WAIT w,**pp;
+  CTL_TIME_t deadline;
+  CTL_TASK_t *boost=NULL;
+  int en;
+  //get deadline so waking up early does not restart the timeout
+  deadline=ctl_get_current_time()+timeout;
+  //disable interrupts while the bus state is changed
+  en=ctl_global_interrupts_disable();
+  //check if the bus is free
+  if(BUS_arb_owner==NULL){
+    //take the bus
+    BUS_arb_owner=ctl_task_executing;
+    BUS_arb_owner_pri=ctl_task_executing->priority;
+    BUS_arb_nest=1;
+    //enable interrupts
+    if(en){
+      ctl_global_interrupts_enable();
+    }
+    return RET_SUCCESS;
+  }
+  //check if this task already has the bus
+  if(BUS_arb_owner==ctl_task_executing){
+    BUS_arb_nest++;
+    //enable interrupts
+    if(en){
+      ctl_global_interrupts_enable();
+    }
+    return RET_SUCCESS;
+  }
+  //setup wait entry
+  w.task=ctl_task_executing;
+  w.pri=ctl_task_executing->priority;
+  w.granted=0;
+  ctl_events_init(&w.e,0);
+  //find place in list, after all tasks with the same or higher priority
+  for(pp=&BUS_arb_head;*pp!=NULL && (*pp)->pri>=w.pri;pp=&(*pp)->next);
+  //add to list
+  w.next=*pp;
+  *pp=&w;
+  //check if the owner needs to run at this priority so it can give up the bus
+  if(w.pri>BUS_arb_owner->priority){
+    boost=BUS_arb_owner;
+  }
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  //raise owner priority
+  if(boost!=NULL){
+    ctl_task_set_priority(boost,w.pri);
+  }
+  //wait for the bus
+  ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS,&w.e,BUS_ARB_EV_GRANT,CTL_TIMEOUT_ABSOLUTE,deadline);
+  //disable interrupts, the bus can be given after the timeout
+  en=ctl_global_interrupts_disable();
+  //check if the bus was given to this task
+  if(!w.granted){
+    //remove from list
+    for(pp=&BUS_arb_head;*pp!=NULL;pp=&(*pp)->next){
+      if(*pp==&w){
+        *pp=w.next;
+        break;
+      }
+    }
+  }
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  return w.granted?RET_SUCCESS:ERR_BUSY;
+}
+
+//release the I2C bus and give it to the highest priority waiting task
+void BUS_I2C_release(void){
+  CTL_TASK_t *old,*boost=NULL;
+  unsigned char old_pri,boost_pri=0;
+  BUS_ARB_WAIT *w;
+  int en;
+  //disable interrupts while the bus state is changed
+  en=ctl_global_interrupts_disable();
+  //check if the bus is locked
+  if(BUS_arb_owner==NULL || --BUS_arb_nest!=0){
+    //enable interrupts
+    if(en){
+      ctl_global_interrupts_enable();
+    }
+    return;
+  }
+  //save owner so the priority can be put back
+  old=BUS_arb_owner;
+  old_pri=BUS_arb_owner_pri;
+  //get first waiting task
+  w=BUS_arb_head;
+  if(w!=NULL){
+    //remove from list
+    BUS_arb_head=w->next;
+    //give bus to task
+    BUS_arb_owner=w->task;
+    BUS_arb_owner_pri=w->pri;
+    BUS_arb_nest=1;
+    w->granted=1;
+    //check if the next waiting task has a higher priority than the new owner
+    if(BUS_arb_head!=NULL && BUS_arb_head->pri>w->pri){
+      boost=w->task;
+      boost_pri=BUS_arb_head->pri;
+    }
+    //wake task
+    ctl_events_set_clear(&w->e,BUS_ARB_EV_GRANT,0);
+  }else{
+    //bus is free
+    BUS_arb_owner=NULL;
+  }
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  //raise new owner priority
+  if(boost!=NULL){
+    ctl_task_set_priority(boost,boost_pri);
+  }
+  //put old owner priority back if it was raised
+  if(old->priority!=old_pri){
+    ctl_task_set_priority(old,old_pri);
+  }
+}
@@ -0,0 +1,95 @@
+#include <ctl.h>
+#include <msp430.h>
+#include "ARCbus.h"
+
+#include "ARCbus_internal.h"
+
+//random state for backoff jitter, never zero
+static unsigned short BUS_backoff_lfsr;
+
+//arbitration statistics, only written from the I2C and timer ISRs
+static BUS_ARB_STATS BUS_arb_stat;
+
+//seed random jitter from the node address so nodes do not pick the same delays
+void BUS_backoff_init(unsigned char addr){
+  //spread address into both bytes
+  BUS_backoff_lfsr=(((unsigned short)addr)<<8)^addr^0xACE1;
+  //LFSR gets stuck at zero
+  if(BUS_backoff_lfsr==0){
+    BUS_backoff_lfsr=0xACE1;
+  }
+}
+
+//get next random value
+static unsigned short BUS_backoff_rand(void){
+  //16 bit Galois LFSR, taps 16 14 13 11
+  if(BUS_backoff_lfsr&1){
+    BUS_backoff_lfsr=(BUS_backoff_lfsr>>1)^0xB400;
+  }else{
+    BUS_backoff_lfsr>>=1;
+  }
+  return BUS_backoff_lfsr;
+}
+
+//get the time to wait before the next try in 32.768 kHz clocks
+static unsigned short BUS_backoff_delay(void){
+  unsigned short exp=arcBus_stat.i2c_stat.tx.collisions;
+  //first collision uses the smallest window
+  if(exp){
+    exp--;
+  }
+  //cap window
+  if(exp>BUS_I2C_BACKOFF_MAX_EXP){
+    exp=BUS_I2C_BACKOFF_MAX_EXP;
+  }
+  //wait at least the base time plus a random part of the window
+  return BUS_I2C_WAIT_TIME+(BUS_backoff_rand()&((BUS_I2C_BACKOFF_SLOT<<exp)-1));
+}
+
+//new packet is starting, clear counters for the packet
+void BUS_backoff_start(void){
+  arcBus_stat.i2c_stat.tx.collisions=0;
+  arcBus_stat.i2c_stat.tx.retries=0;
+}
+
+//arbitration was lost, returns the time to wait before trying again
+unsigned short BUS_backoff_collision(void){
+  //count collision for the packet
+  if(arcBus_stat.i2c_stat.tx.collisions<0xFF){
+    arcBus_stat.i2c_stat.tx.collisions++;
+  }
+  //count total collisions
+  BUS_arb_stat.collisions++;
+  //save most collisions for one packet
+  if(arcBus_stat.i2c_stat.tx.collisions>BUS_arb_stat.max_collisions){
+    BUS_arb_stat.max_collisions=arcBus_stat.i2c_stat.tx.collisions;
+  }
+  return BUS_backoff_delay();
+}
+
+//packet is being tried again, returns the time to wait before the next try
+unsigned short BUS_backoff_retry(void){
+  //count retry for the packet
+  if(arcBus_stat.i2c_stat.tx.retries<0xFF){
+    arcBus_stat.i2c_stat.tx.retries++;
+  }
+  //count total retries
+  BUS_arb_stat.retries++;
+  //save most retries for one packet
+  if(arcBus_stat.i2c_stat.tx.retries>BUS_arb_stat.max_retries){
+    BUS_arb_stat.max_retries=arcBus_stat.i2c_stat.tx.retries;
+  }
+  return BUS_backoff_delay();
+}
+
+//get arbitration statistics
+void BUS_get_arb_stats(BUS_ARB_STATS *stats){
+  int en;
+  //disable interrupts so counters are consistent
+  en=ctl_global_interrupts_disable();
+  *stats=BUS_arb_stat;
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+}
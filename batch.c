@@ -0,0 +1,159 @@
+#include <ctl.h>
+#include <msp430.h>
+#include <string.h>
+#include "ARCbus.h"
+
+#include "ARCbus_internal.h"
+
+//commands waiting to be sent to one destination
+typedef struct{
+  //destination address, zero if the slot is free
+  unsigned char addr;
+  //number of records
+  unsigned char num;
+  //length of records
+  unsigned char len;
+  //send packet with NACK flag
+  unsigned char nack;
+  //packet data, header followed by records
+  unsigned char dat[BUS_I2C_HDR_LEN+BUS_I2C_MAX_PACKET_LEN+BUS_I2C_CRC_LEN];
+}BUS_BATCH;
+
+//batches for each destination
+static BUS_BATCH BUS_batch_buf[BUS_BATCH_DEST];
+//mutex for batch buffers
+static CTL_MUTEX_t BUS_batch_mutex;
+//time until batches are sent in ticks, decremented in tick ISR
+volatile unsigned short BUS_batch_timer=0;
+
+//initialize batch buffers
+void BUS_batch_init(void){
+  int i;
+  ctl_mutex_init(&BUS_batch_mutex);
+  //free all batches
+  for(i=0;i<BUS_BATCH_DEST;i++){
+    BUS_batch_buf[i].addr=0;
+  }
+  //stop timer
+  BUS_batch_timer=0;
+}
+
+//send batch and free it, mutex must be locked
+//always called from a task so it can wait for the bus if the transmit queue is full
+static void BUS_batch_send(BUS_BATCH *batch){
+  int resp;
+  unsigned char len;
+  //check for a single record
+  if(batch->num==1){
+    //send record as a normal command
+    batch->dat[1]=batch->dat[BUS_I2C_HDR_LEN];
+    //get record length
+    len=batch->dat[BUS_I2C_HDR_LEN+1]&BUS_BATCH_REC_LEN_MASK;
+    //move payload after header
+    memmove(batch->dat+BUS_I2C_HDR_LEN,batch->dat+BUS_I2C_HDR_LEN+BUS_BATCH_REC_HDR_LEN,len);
+  }else{
+    //send all records
+    len=batch->len;
+  }
+  //queue packet, the packet is copied so the batch can be reused
+  resp=BUS_cmd_tx_async(batch->addr,batch->dat,len,batch->nack?BUS_CMD_FL_NACK:0,NULL);
+  //check if the transmit queue is full
+  if(resp==ERR_BUSY){
+    //callers were told the commands would be sent so send the packet now
+    resp=BUS_cmd_tx(batch->addr,batch->dat,len,batch->nack?BUS_CMD_FL_NACK:0);
+  }
+  //check for error
+  if(resp!=RET_SUCCESS){
+    report_error(ERR_LEV_ERROR,BUS_ERR_SRC_I2C,I2C_ERR_BATCH_SEND,resp);
+  }
+  //free batch
+  batch->addr=0;
+}
+
+//add a command to the batch for addr
+int BUS_cmd_tx_batch(unsigned char addr,unsigned char cmd,const void *dat,unsigned short len,unsigned short flags){
+  BUS_BATCH *batch=NULL,*free=NULL;
+  int i,resp;
+  //check address
+  if((resp=addr_chk(addr))!=RET_SUCCESS || addr==0){
+    //return error if it occured
+    return ERR_BAD_ADDR;
+  }
+  //check record length
+  if(len+BUS_BATCH_REC_HDR_LEN>BUS_I2C_MAX_PACKET_LEN){
+    return ERR_PACKET_TOO_LONG;
+  }
+  //lock batches
+  if(!ctl_mutex_lock(&BUS_batch_mutex,CTL_TIMEOUT_DELAY,10)){
+    return ERR_BUSY;
+  }
+  //find batch for addr
+  for(i=0;i<BUS_BATCH_DEST;i++){
+    if(BUS_batch_buf[i].addr==addr){
+      batch=&BUS_batch_buf[i];
+      break;
+    }else if(free==NULL && BUS_batch_buf[i].addr==0){
+      free=&BUS_batch_buf[i];
+    }
+  }
+  //check if record fits in existing batch
+  if(batch!=NULL && batch->len+BUS_BATCH_REC_HDR_LEN+len>BUS_I2C_MAX_PACKET_LEN){
+    //batch is full, send it
+    BUS_batch_send(batch);
+    //start a new batch in the same slot
+    free=batch;
+    batch=NULL;
+  }
+  //check if a new batch is needed
+  if(batch==NULL){
+    //check if there is a free slot
+    if(free==NULL){
+      //send the first batch to make room
+      free=&BUS_batch_buf[0];
+      BUS_batch_send(free);
+    }
+    batch=free;
+    //setup batch
+    batch->addr=addr;
+    batch->num=0;
+    batch->len=0;
+    batch->nack=0;
+    BUS_cmd_init(batch->dat,CMD_BATCH);
+  }
+  //add record header
+  batch->dat[BUS_I2C_HDR_LEN+batch->len]=cmd;
+  batch->dat[BUS_I2C_HDR_LEN+batch->len+1]=len|((flags&BUS_CMD_FL_NACK)?BUS_BATCH_REC_NACK:0);
+  //copy payload
+  memcpy(batch->dat+BUS_I2C_HDR_LEN+batch->len+BUS_BATCH_REC_HDR_LEN,dat,len);
+  //update batch
+  batch->len+=BUS_BATCH_REC_HDR_LEN+len;
+  batch->num++;
+  //request NACK for packet if any record requests NACK
+  if(flags&BUS_CMD_FL_NACK){
+    batch->nack=1;
+  }
+  //start timer if not running
+  if(!BUS_batch_timer){
+    BUS_batch_timer=BUS_BATCH_WINDOW;
+  }
+  //unlock batches
+  ctl_mutex_unlock(&BUS_batch_mutex);
+  return RET_SUCCESS;
+}
+
+//send all waiting batches
+void BUS_batch_flush(void){
+  int i;
+  //lock batches
+  ctl_mutex_lock_uc(&BUS_batch_mutex);
+  //stop timer
+  BUS_batch_timer=0;
+  //send batches
+  for(i=0;i<BUS_BATCH_DEST;i++){
+    if(BUS_batch_buf[i].addr!=0){
+      BUS_batch_send(&BUS_batch_buf[i]);
+    }
+  }
+  //unlock batches
+  ctl_mutex_unlock(&BUS_batch_mutex);
+}
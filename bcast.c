@@ -0,0 +1,171 @@
+#include <ctl.h>
+#include <msp430.h>
+#include <string.h>
+#include "ARCbus.h"
+
+#include "ARCbus_internal.h"
+
+//frames shared between a general call send and local delivery
+static BUS_BCAST_FRAME BUS_bcast_pool[BUS_BCAST_POOL_LEN];
+//frame indexes waiting to be parsed by the ARCbus task
+static unsigned char BUS_bcast_lane[BUS_BCAST_POOL_LEN];
+//ring indexes for the lane
+//senders are the producer and are serialized by disabling interrupts, the ARCbus task is the consumer
+static BUS_RING BUS_bcast_ring;
+//frame that is being parsed by the ARCbus task, NULL if the packet is not from the lane
+static BUS_BCAST_FRAME *BUS_bcast_cur;
+//number of broadcasts that were not delivered locally because no frame was free
+static unsigned short BUS_bcast_drop;
+
+//initialize frame pool and lane to empty state
+void BUS_bcast_init(void){
+  int i;
+  BUS_ring_init(&BUS_bcast_ring,BUS_BCAST_POOL_LEN);
+  //free all frames
+  for(i=0;i<BUS_BCAST_POOL_LEN;i++){
+    BUS_bcast_pool[i].ref=0;
+  }
+  BUS_bcast_cur=NULL;
+  BUS_bcast_drop=0;
+}
+
+//release a reference to a frame, frame is free when the last reference is released
+void BUS_bcast_put(BUS_BCAST_FRAME *frame){
+  int en;
+  //disable interrupts so the count is updated atomically
+  en=ctl_global_interrupts_disable();
+  //release reference
+  if(frame->ref){
+    frame->ref--;
+  }
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+}
+
+//copy a general call packet into a shared frame and give a reference to the ARCbus task
+//returns the frame with a reference for the caller or NULL if no frame is free, never waits
+BUS_BCAST_FRAME *BUS_bcast_post(unsigned char flags,const BUS_IOVEC *seg,unsigned short nseg){
+  BUS_BCAST_FRAME *frame=NULL;
+  unsigned short len,i;
+  short idx;
+  int en;
+  //disable interrupts so only one sender uses the pool at a time
+  en=ctl_global_interrupts_disable();
+  //find a free frame
+  for(i=0;i<BUS_BCAST_POOL_LEN;i++){
+    if(!BUS_bcast_pool[i].ref){
+      frame=&BUS_bcast_pool[i];
+      //one reference for the sender and one for the ARCbus task
+      frame->ref=2;
+      break;
+    }
+  }
+  //check for free frame
+  if(frame==NULL){
+    //count lost local delivery
+    BUS_bcast_drop++;
+  }
+  //enable interrupts, the frame is not visible until it is published
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  //check for free frame
+  if(frame==NULL){
+    return NULL;
+  }
+  //set flags for general call address
+  frame->pk.flags=flags;
+  //copy parts into frame, this is the only copy of the packet
+  for(i=0,len=0;i<nseg;i++){
+    memcpy(&frame->pk.dat[len],seg[i].ptr,seg[i].len);
+    len+=seg[i].len;
+  }
+  //set length
+  frame->pk.len=len;
+  //disable interrupts so only one sender publishes at a time
+  en=ctl_global_interrupts_disable();
+  //get lane slot, there is always room because the lane is as long as the pool
+  idx=BUS_ring_prod_slot(&BUS_bcast_ring);
+  //save frame index
+  BUS_bcast_lane[idx]=frame-BUS_bcast_pool;
+  //publish frame
+  BUS_ring_publish(&BUS_bcast_ring);
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  //tell the ARCbus task there is a packet
+  ctl_events_set_clear(&BUS_INT_events,BUS_INT_EV_I2C_CMD_RX,0);
+  return frame;
+}
+
+//get the oldest general call packet sent by this board, returns NULL if the lane is empty
+I2C_PACKET *BUS_bcast_peek(void){
+  short idx;
+  //get oldest slot
+  idx=BUS_ring_cons_slot(&BUS_bcast_ring);
+  //check if lane is empty
+  if(idx<0){
+    BUS_bcast_cur=NULL;
+    return NULL;
+  }
+  //remember frame so it can be held
+  BUS_bcast_cur=&BUS_bcast_pool[BUS_bcast_lane[idx]];
+  return &BUS_bcast_cur->pk;
+}
+
+//get the general call packet that is being parsed without changing the lane, returns NULL if none
+I2C_PACKET *BUS_bcast_current(void){
+  return (BUS_bcast_cur!=NULL)?&BUS_bcast_cur->pk:NULL;
+}
+
+//done with the packet returned by BUS_bcast_peek
+void BUS_bcast_done(void){
+  //release ARCbus task reference
+  BUS_bcast_put(BUS_bcast_cur);
+  BUS_bcast_cur=NULL;
+  //free lane slot
+  BUS_ring_consume(&BUS_bcast_ring);
+}
+
+//hold the frame that is being parsed, returns ERR_INVALID_ARGUMENT if the packet is not from the lane
+int BUS_bcast_hold(void){
+  int en;
+  //check for a frame
+  if(BUS_bcast_cur==NULL){
+    return ERR_INVALID_ARGUMENT;
+  }
+  //disable interrupts so the count is updated atomically
+  en=ctl_global_interrupts_disable();
+  //add reference
+  BUS_bcast_cur->ref++;
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  //token is after the receive queue tokens
+  return BUS_BCAST_TOKEN_BASE+(BUS_bcast_cur-BUS_bcast_pool);
+}
+
+//release a frame held with BUS_bcast_hold
+int BUS_bcast_release(int token){
+  //check token range
+  if(token<BUS_BCAST_TOKEN_BASE || token>=BUS_BCAST_TOKEN_BASE+BUS_BCAST_POOL_LEN){
+    return ERR_INVALID_ARGUMENT;
+  }
+  //check that the frame is in use
+  if(!BUS_bcast_pool[token-BUS_BCAST_TOKEN_BASE].ref){
+    return ERR_INVALID_ARGUMENT;
+  }
+  //release reference
+  BUS_bcast_put(&BUS_bcast_pool[token-BUS_BCAST_TOKEN_BASE]);
+  return RET_SUCCESS;
+}
+
+//copy lane counters into stats structure
+void BUS_bcast_stats(BUS_RX_STATS *stats){
+  stats->bcast_used=BUS_ring_used(&BUS_bcast_ring);
+  stats->bcast_drop=BUS_bcast_drop;
+}
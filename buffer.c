@@ -4,30 +4,56 @@
 
 #include "ARCbus_internal.h"
 
-//mutex for buffer locking
+//mutex for buffer locking, only used for the first buffer
 CTL_MUTEX_t buffer_mutex;
 
-//buffer for SPI transactions
-//static unsigned char Buffer[4096+2];
-//static unsigned char Buffer[2048+2];
-static unsigned char Buffer[1024+4];
+//buffers for SPI transactions
+//the first buffer is also the buffer returned by BUS_get_buffer, the others are only used to receive SPI data
+//static unsigned char Buffer[BUS_SPI_POOL_LEN][4096+2];
+//static unsigned char Buffer[BUS_SPI_POOL_LEN][2048+2];
+static unsigned char Buffer[BUS_SPI_POOL_LEN][1024+4];
+
+//nonzero if a receive buffer is in use, the first buffer uses the mutex instead
+static unsigned char BUS_buf_used[BUS_SPI_POOL_LEN];
+//length of received data in each buffer
+static unsigned short BUS_buf_len[BUS_SPI_POOL_LEN];
+//buffers that have been given to the subsystem, oldest first
+static unsigned char BUS_buf_ready[BUS_SPI_POOL_LEN];
+//ring indexes for ready buffers
+//the ARCbus task is the producer and the task that frees the buffer is the consumer
+static BUS_RING BUS_buf_ring;
+//pool counters
+static struct{
+  unsigned short used;
+  unsigned short hwm;
+  unsigned short exhausted;
+}BUS_buf_stat;
 
 //setup stuff for buffer usage
 void BUS_init_buffer(void){
+  int i;
   //initialize mutex
   ctl_mutex_init(&buffer_mutex);
+  //all buffers are free
+  for(i=0;i<BUS_SPI_POOL_LEN;i++){
+    BUS_buf_used[i]=0;
+  }
+  BUS_ring_init(&BUS_buf_ring,BUS_SPI_POOL_LEN);
+  BUS_buf_stat.used=0;
+  BUS_buf_stat.hwm=0;
+  BUS_buf_stat.exhausted=0;
 }
 
 //return buffer size
 const unsigned int BUS_get_buffer_size(void){
-  return sizeof(Buffer);
+  return sizeof(Buffer[0]);
 }
 
 //lock buffer and return pointer to buffer
 void* BUS_get_buffer(CTL_TIMEOUT_t t, CTL_TIME_t timeout){
   if(ctl_mutex_lock(&buffer_mutex,t,timeout)){
     //lock aquired, return buffer
-    return Buffer;
+    return Buffer[0];
   }else{
     //lock not aquired return NULL
     return NULL;
@@ -39,21 +65,128 @@ void BUS_free_buffer(void){
   ctl_mutex_unlock(&buffer_mutex);
 }
 
-//get buffer if it was locked by ARCbus
-void* BUS_get_buffer_from_event(void){
-  //TODO: error chekcing
-  return Buffer;
+//get a buffer to receive SPI data into, returns the buffer index or -1 if all buffers are in use
+//called from the ARCbus task, the first buffer is only used if the others are busy
+int BUS_buf_rx_get(void){
+  int i,idx=-1,en;
+  //disable interrupts so a buffer is not freed while searching
+  en=ctl_global_interrupts_disable();
+  //look for a free receive only buffer
+  for(i=1;i<BUS_SPI_POOL_LEN;i++){
+    if(!BUS_buf_used[i]){
+      BUS_buf_used[i]=1;
+      idx=i;
+      break;
+    }
+  }
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  //try the shared buffer
+  if(idx<0 && ctl_mutex_lock(&buffer_mutex,CTL_TIMEOUT_NOW,0)){
+    BUS_buf_used[0]=1;
+    idx=0;
+  }
+  //check for free buffer
+  if(idx<0){
+    //count exhaustion
+    BUS_buf_stat.exhausted++;
+    return -1;
+  }
+  //count buffers in use
+  BUS_buf_stat.used++;
+  if(BUS_buf_stat.used>BUS_buf_stat.hwm){
+    BUS_buf_stat.hwm=BUS_buf_stat.used;
+  }
+  return idx;
 }
 
-//free buffer if it was locket by ARCbus
-void BUS_free_buffer_from_event(void){
-  //bus internal events
-  extern CTL_EVENT_SET_t BUS_INT_events;
-  //set event to realese buffer
-  ctl_events_set_clear(&BUS_INT_events,BUS_INT_EV_BUFF_UNLOCK,0);
+//return pointer to a pool buffer
+unsigned char *BUS_buf_ptr(int idx){
+  return Buffer[idx];
 }
 
+//free a buffer returned by BUS_buf_rx_get, can be called from any task
+void BUS_buf_rx_free(int idx){
+  int en;
+  //disable interrupts so the counters are updated together
+  en=ctl_global_interrupts_disable();
+  BUS_buf_used[idx]=0;
+  BUS_buf_stat.used--;
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  //check for the shared buffer
+  if(idx==0){
+    //the mutex is owned by the ARCbus task so it must be unlocked there
+    if(ctl_task_executing==&ARC_bus_task){
+      BUS_free_buffer();
+    }else{
+      //set event to release buffer
+      ctl_events_set_clear(&BUS_INT_events,BUS_INT_EV_BUFF_UNLOCK,0);
+    }
+  }
+}
 
+//give a buffer with len bytes of received data to the subsystem, called from the ARCbus task
+void BUS_buf_rx_ready(int idx,unsigned short len){
+  short slot;
+  //save length
+  BUS_buf_len[idx]=len;
+  //get ready slot, there is always space because there is a slot for each buffer
+  slot=BUS_ring_prod_slot(&BUS_buf_ring);
+  BUS_buf_ready[slot]=idx;
+  BUS_ring_publish(&BUS_buf_ring);
+  //tell subsystem, SPI data received
+  ctl_events_set_clear(&SUB_events,SUB_EV_SPI_DAT,0);
+}
 
+//get buffer if it was locked by ARCbus
+//with more than one buffer this is the oldest buffer that has not been freed
+void* BUS_get_buffer_from_event(void){
+  short slot;
+  //get oldest ready buffer
+  if((slot=BUS_ring_cons_slot(&BUS_buf_ring))<0){
+    return NULL;
+  }
+  return Buffer[BUS_buf_ready[slot]];
+}
+
+//get length of the data in the buffer returned by BUS_get_buffer_from_event
+unsigned short BUS_get_buffer_len_from_event(void){
+  short slot;
+  //get oldest ready buffer
+  if((slot=BUS_ring_cons_slot(&BUS_buf_ring))<0){
+    return 0;
+  }
+  return BUS_buf_len[BUS_buf_ready[slot]];
+}
 
+//free buffer if it was locket by ARCbus
+void BUS_free_buffer_from_event(void){
+  short slot;
+  //get oldest ready buffer
+  if((slot=BUS_ring_cons_slot(&BUS_buf_ring))<0){
+    return;
+  }
+  //free buffer
+  BUS_buf_rx_free(BUS_buf_ready[slot]);
+  //remove from ready list
+  BUS_ring_consume(&BUS_buf_ring);
+  //check for more received data
+  if(BUS_ring_cons_slot(&BUS_buf_ring)>=0){
+    //tell subsystem there is another buffer
+    ctl_events_set_clear(&SUB_events,SUB_EV_SPI_DAT,0);
+  }
+}
 
+//get SPI buffer pool statistics
+void BUS_get_buffer_stats(BUS_BUF_STATS *stats){
+  stats->size=BUS_SPI_POOL_LEN;
+  stats->used=BUS_buf_stat.used;
+  stats->hwm=BUS_buf_stat.hwm;
+  stats->exhausted=BUS_buf_stat.exhausted;
+  stats->ready=BUS_ring_used(&BUS_buf_ring);
+}
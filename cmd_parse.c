@@ -0,0 +1,115 @@
+#include <stddef.h>
+#include "ARCbus.h"
+#include "ARCbus_internal.h"
+
+//command callback registration and dispatch
+//this file only uses the worker queue from the rest of the library so it can be built on the host
+
+//pointer to linked list of command parse functions
+//nodes in the list are sorted by priority
+//this node is the first in the list (or NULL for an empty list)
+//the last node in the list has next set to NULL
+CMD_PARSE_DAT *cmd_parse_list=NULL;
+
+//table of callbacks indexed by command
+//commands found here are handled without walking cmd_parse_list
+static CMD_PARSE_DAT *cmd_parse_table[256];
+
+//register callback for a single command
+int BUS_register_cmd_handler(unsigned char cmd,CMD_PARSE_DAT *cb_dat){
+  //check if command already has a different callback
+  if(cb_dat!=NULL && cmd_parse_table[cmd]!=NULL && cmd_parse_table[cmd]!=cb_dat){
+    return ERR_BUSY;
+  }
+  //set callback, NULL removes the callback
+  cmd_parse_table[cmd]=cb_dat;
+  return RET_SUCCESS;
+}
+
+//register callback
+//insert the callback structure in the linked list based on priority
+void BUS_register_cmd_callback(CMD_PARSE_DAT *cb_dat){
+  //get a pointer to the current list head
+  CMD_PARSE_DAT **head=&cmd_parse_list;
+  //find insertion point.
+  //This should be where *head points to a node with greater priority (or the beginning)
+  //and *head->next points to a node with lower priority (or the end)
+  while(*head!=NULL && (*head)->priority>cb_dat->priority){
+    //move head to the next element in the list
+    head= &(*head)->next;
+  }
+  //link to lower priority callbacks
+  cb_dat->next=*head;
+  //link in this callback
+  *head=cb_dat;
+}
+
+//call a command callback or pass it to a worker task if it is deferred
+//only callbacks that say which commands they handle are deferred, either from the table or with a command mask
+//posting is the same as handling the command so other callbacks would never see commands the callback does not know
+static int cmd_parse_cb(CMD_PARSE_DAT *parse_ptr,unsigned char addr,unsigned char cmd,unsigned char *ptr,unsigned short len,unsigned char flags,unsigned char nack){
+  //check for deferred callback that handles this command, the mask was checked by the caller
+  if(parse_ptr->flags&CMD_PARSE_DEFERRED && (cmd_parse_table[cmd]==parse_ptr || (parse_ptr->flags&CMD_PARSE_CMD_MASK && parse_ptr->cmd_mask!=NULL))){
+    //worker task runs callback and sends NACK
+    return cmd_worker_post(parse_ptr,addr,cmd,ptr,len,flags,nack);
+  }
+  //run callback now
+  return parse_ptr->cb(addr,cmd,ptr,len,flags);
+}
+
+//call a command callback if it handles the packet, returns the new response
+static int cmd_parse_call(CMD_PARSE_DAT *parse_ptr,unsigned char addr,unsigned char cmd,unsigned char *ptr,unsigned short len,unsigned char flags,unsigned char nack,int resp){
+  //check if the callback handles this command
+  //the mask is only read when the flag is set so callers built without the mask field still work
+  if(parse_ptr->flags&CMD_PARSE_CMD_MASK && parse_ptr->cmd_mask!=NULL && !CMD_PARSE_MASK_TEST(parse_ptr->cmd_mask,cmd)){
+    //skip this callback
+    return resp;
+  }
+  //check for general call command
+  if((BUS_FLAGS_SW_GC|CMD_PARSE_GC_ADDR)&flags){
+    //check for the sender of a software GC
+    if((BUS_FLAGS_SW_GC&flags) && parse_ptr->flags&(flags&(~BUS_FLAGS_SW_GC))){
+      //this callback handles the software GC address that sent the packet, skip this callback
+    }else{
+      //check if this callback handles GC addresses
+      if(CMD_PARSE_GC_ADDR&parse_ptr->flags){
+        int tmp_resp;
+        //check for subsystem command
+        tmp_resp=cmd_parse_cb(parse_ptr,addr,cmd,ptr,len,flags,nack);
+        //overwrite resp if resp is not success
+        if(resp!=RET_SUCCESS){
+          resp=tmp_resp;
+        }
+      }
+    }
+  }else{//not a general call command, find the right callback
+    //check if flags match
+    if(parse_ptr->flags&flags){
+      //check for subsystem command
+      resp=cmd_parse_cb(parse_ptr,addr,cmd,ptr,len,flags,nack);
+    }
+  }
+  return resp;
+}
+
+//pass a command to the subsystem callbacks, returns zero on success or a NACK reason
+//the per-command table is checked first then the callback list is searched
+//general call packets are given to every callback in the list
+int cmd_parse_dispatch(unsigned char addr,unsigned char cmd,unsigned char *ptr,unsigned short len,unsigned char flags,unsigned char nack){
+  CMD_PARSE_DAT *parse_ptr;
+  //set response to unknown command
+  int resp=ERR_UNKNOWN_CMD;
+  //check for a callback registered for this command
+  if((parse_ptr=cmd_parse_table[cmd])!=NULL){
+    resp=cmd_parse_call(parse_ptr,addr,cmd,ptr,len,flags,nack,resp);
+  }
+  //get callback structure list
+  parse_ptr=cmd_parse_list;
+  //loop through list and check for commands
+  while(parse_ptr!=NULL && ((BUS_FLAGS_SW_GC|CMD_PARSE_GC_ADDR)&flags || resp==ERR_UNKNOWN_CMD)){
+    resp=cmd_parse_call(parse_ptr,addr,cmd,ptr,len,flags,nack,resp);
+    //get next callback structure
+    parse_ptr=parse_ptr->next;
+  }
+  return resp;
+}
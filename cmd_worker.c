@@ -0,0 +1,138 @@
+#include <ctl.h>
+#include <msp430.h>
+#include <string.h>
+#include "ARCbus.h"
+
+#include "ARCbus_internal.h"
+
+//command passed to a worker task
+typedef struct{
+  //callback to run
+  CMD_PARSE_DAT *parse;
+  //sender address
+  unsigned char addr;
+  //command type
+  unsigned char cmd;
+  //packet flags
+  unsigned char flags;
+  //send NACK on error
+  unsigned char nack;
+  //payload length
+  unsigned short len;
+  //token for held receive slot or negative if the payload was copied
+  int token;
+  //payload pointer, points into receive slot or buf
+  unsigned char *dat;
+  //payload copy used when the receive slot can not be held
+  //reassembled commands are never in a receive slot so this must hold the longest fragmented command
+  unsigned char buf[BUS_FRAG_MAX_LEN];
+  //RPC request the command is part of
+  BUS_RPC_CTX rpc;
+}CMD_WORKER_JOB;
+
+//storage for commands
+static CMD_WORKER_JOB cmd_worker_jobs[BUS_CMD_WORKER_QUEUE_LEN];
+
+//queue of commands waiting for a worker
+static CTL_MESSAGE_QUEUE_t cmd_worker_queue;
+static void *cmd_worker_queue_buf[BUS_CMD_WORKER_QUEUE_LEN];
+
+//queue of free command structures
+static CTL_MESSAGE_QUEUE_t cmd_worker_free;
+static void *cmd_worker_free_buf[BUS_CMD_WORKER_QUEUE_LEN];
+
+//worker tasks
+static CTL_TASK_t cmd_worker_tasks[BUS_CMD_WORKERS];
+//stacks for worker tasks
+static unsigned cmd_worker_stack[BUS_CMD_WORKERS][200];
+
+//worker task, run deferred command callbacks
+static void cmd_worker(void *p) __toplevel{
+  CMD_WORKER_JOB *job;
+  int resp;
+  for(;;){
+    //wait for a command
+    ctl_message_queue_receive(&cmd_worker_queue,(void**)&job,CTL_TIMEOUT_NONE,0);
+    //callback can reply to the request
+    BUS_rpc_resume(&job->rpc);
+    //run callback
+    resp=job->parse->cb(job->addr,job->cmd,job->dat,job->len,job->flags);
+    //send status if the callback did not reply
+    BUS_rpc_end(resp);
+    //release receive slot
+    if(job->token>=0){
+      BUS_cmd_release(job->token);
+    }
+    //check if command was recognized
+    if(resp!=0){
+      report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_BAD_CMD,(((unsigned short)resp)<<8)|((unsigned short)job->cmd));
+      //check packet to see if NACK should be sent
+      if(job->nack){
+        //send NACK
+        BUS_send_nack(job->addr,job->cmd,resp);
+      }
+    }
+    //done with command structure
+    ctl_message_queue_post_nb(&cmd_worker_free,job);
+  }
+}
+
+//setup queues and start worker tasks
+void cmd_worker_init(void){
+  int i;
+  //initialize queues
+  ctl_message_queue_init(&cmd_worker_queue,cmd_worker_queue_buf,BUS_CMD_WORKER_QUEUE_LEN);
+  ctl_message_queue_init(&cmd_worker_free,cmd_worker_free_buf,BUS_CMD_WORKER_QUEUE_LEN);
+  //all command structures are free
+  for(i=0;i<BUS_CMD_WORKER_QUEUE_LEN;i++){
+    ctl_message_queue_post_nb(&cmd_worker_free,&cmd_worker_jobs[i]);
+  }
+  //start worker tasks
+  for(i=0;i<BUS_CMD_WORKERS;i++){
+    ctl_task_run(&cmd_worker_tasks[i],BUS_PRI_ARCBUS_WORKER,cmd_worker,NULL,"ARC_Bus_worker",sizeof(cmd_worker_stack[i])/sizeof(cmd_worker_stack[i][0])-2,cmd_worker_stack[i]+1,0);
+  }
+}
+
+//pass a command to a worker task, called from the ARCbus task
+int cmd_worker_post(CMD_PARSE_DAT *parse,unsigned char addr,unsigned char cmd,unsigned char *dat,unsigned short len,unsigned char flags,unsigned char nack){
+  CMD_WORKER_JOB *job;
+  I2C_PACKET *pk;
+  //get a free command structure
+  if(!ctl_message_queue_receive_nb(&cmd_worker_free,(void**)&job)){
+    //all workers are busy and the queue is full
+    return ERR_BUSY;
+  }
+  //save command info
+  job->parse=parse;
+  job->addr=addr;
+  job->cmd=cmd;
+  job->flags=flags;
+  job->nack=nack;
+  job->len=len;
+  //get packet being parsed, general call packets sent by this board are parsed before the receive queue
+  //reassembled commands are not in the packet
+  if((pk=BUS_bcast_current())==NULL){
+    pk=I2C_rx_peek();
+  }
+  //try to keep the receive slot so the payload does not need to be copied
+  if(pk!=NULL && dat>=pk->dat && dat+len<=pk->dat+sizeof(pk->dat) && (job->token=BUS_cmd_hold())>=0){
+    //use payload in receive slot
+    job->dat=dat;
+  }else if(len<=sizeof(job->buf)){
+    //no receive slot
+    job->token=-1;
+    //copy payload
+    memcpy(job->buf,dat,len);
+    job->dat=job->buf;
+  }else{
+    //payload is too long to copy, give back command structure
+    ctl_message_queue_post_nb(&cmd_worker_free,job);
+    //don't run the callback on the ARCbus task, the sender can try again
+    return ERR_BUSY;
+  }
+  //worker sends the response if the command is an RPC request
+  BUS_rpc_take(&job->rpc);
+  //queue command, there is always space because the number of structures is the same as the queue length
+  ctl_message_queue_post_nb(&cmd_worker_queue,job);
+  return RET_SUCCESS;
+}
@@ -1,5 +1,7 @@
-#include <msp430.h>
-#include <ctl.h>
+#ifdef __MSP430__
+  #include <msp430.h>
+  #include <ctl.h>
+#endif
 
 
 //Table used to compute 7-bit CRC
@@ -23,8 +25,8 @@ static const unsigned char crc7_table[256] = {
     0x1c, 0x0e, 0x38, 0x2a, 0x54, 0x46, 0x70, 0x62, 0x8c, 0x9e, 0xa8, 0xba, 0xc4, 0xd6, 0xe0, 0xf2
 };
 
-unsigned char crc7(const unsigned char *data,unsigned short len){
-    unsigned char crc=0;
+//continue a 7-bit CRC over more data, start with crc set to zero
+unsigned char crc7_update(unsigned char crc,const unsigned char *data,unsigned short len){
     unsigned int tbl_idx;
     unsigned short i;
     for(i=0;i<len;i++){
@@ -32,27 +34,94 @@ unsigned char crc7(const unsigned char *data,unsigned short len){
         crc = (crc7_table[tbl_idx] ^ (crc << (8 - 1))) & (0x7f << 1);
         data++;
     }
+    //return running CRC, the lsb is not set
+    return crc;
+}
+
+unsigned char crc7(const unsigned char *data,unsigned short len){
     //return 7-bit CRC in msb's and 1 in lsb (for SD card communication)
-    return crc|1;
+    return crc7_update(0,data,len)|1;
 
 }
 
+//max bytes given to the CRC module each time the mutex is taken
+#define CRC16_HW_CHUNK    64
+
+//continue a crc16 over more data in software, can be used from anywhere
+static unsigned short crc16_sw(unsigned short crc,const unsigned char *data,unsigned short len){
+    unsigned short x;
+    while(len--){
+      //CRC-CCITT one byte at a time without a table
+      x=((crc>>8)^*data++)&0xFF;
+      x^=x>>4;
+      crc=(crc<<8)^(x<<12)^(x<<5)^x;
+    }
+    return crc;
+}
+
+#ifdef __MSP430__
+
 CTL_MUTEX_t crc_mutex;
 
-//use CRC module for crc16
-unsigned short crc16(const unsigned char *data,unsigned short len){
-    unsigned short crc=0;
-    unsigned short i;
-    unsigned int tbl_idx;
-    //lock the CRC module
-    ctl_mutex_lock_uc(&crc_mutex);
-    //init CRC module with initial value
-    CRCINIRES=0;
-    for(i=0;i<len;i++){
+//feed data to the CRC module a word at a time, module must be locked
+static unsigned short crc16_hw(unsigned short crc,const unsigned char *data,unsigned short len){
+    //init CRC module with running value
+    CRCINIRES=crc;
+    //word writes need an even address
+    if((((unsigned short)data)&1) && len){
       CRCDIRB_L=*data++;
+      len--;
+    }
+    //two bytes at a time, the low byte is first in memory and is processed first
+    for(;len>=2;len-=2){
+      CRCDIRB=*(const unsigned short*)data;
+      data+=2;
+    }
+    //odd byte at the end
+    if(len){
+      CRCDIRB_L=*data;
+    }
+    return CRCINIRES;
+}
+
+//continue a crc16 over more data, start with crc16_init() and finish with crc16_final()
+//uses the CRC module when it is free, otherwise and in interrupts the CRC is done in software
+unsigned short crc16_update(unsigned short crc,const unsigned char *data,unsigned short len){
+    unsigned short n;
+    //the mutex can not be used in interrupts
+    if(ctl_interrupt_count){
+      return crc16_sw(crc,data,len);
+    }
+    while(len){
+      //limit time the module is held so other users are not blocked for the whole buffer
+      n=(len>CRC16_HW_CHUNK)?CRC16_HW_CHUNK:len;
+      //try to lock the CRC module
+      if(ctl_mutex_lock(&crc_mutex,CTL_TIMEOUT_NOW,0)){
+        crc=crc16_hw(crc,data,n);
+        //unlock the CRC module
+        ctl_mutex_unlock(&crc_mutex);
+      }else{
+        //module in use, don't wait for it
+        crc=crc16_sw(crc,data,n);
+      }
+      data+=n;
+      len-=n;
     }
-    crc=CRCINIRES;
-    //lock the CRC module
-    ctl_mutex_unlock(&crc_mutex);
     return crc;
 }
+
+#else
+
+//continue a crc16 over more data, start with crc16_init() and finish with crc16_final()
+//no CRC module so always use software
+unsigned short crc16_update(unsigned short crc,const unsigned char *data,unsigned short len){
+    return crc16_sw(crc,data,len);
+}
+
+#endif
+
+//use CRC module for crc16
+unsigned short crc16(const unsigned char *data,unsigned short len){
+    //start with zero
+    return crc16_update(0,data,len);
+}
@@ -2,6 +2,15 @@
 #define __CRC_H
 
 unsigned char crc7(const void *dat,unsigned short len);
+//continue a crc7 over more data, start with crc set to zero and set the lsb of the result when done
+unsigned char crc7_update(unsigned char crc,const void *dat,unsigned short len);
 unsigned short crc16(const void *dat,unsigned short len);
+//continue a crc16 over more data, start with crc16_init() and pass the result to crc16_final() when done
+//safe to call from interrupts, the CRC module is only used when it is free
+unsigned short crc16_update(unsigned short crc,const void *dat,unsigned short len);
+//start value for crc16_update
+#define crc16_init()        (0)
+//finish a crc16 from crc16_update, there is no final XOR so the running value is the CRC
+#define crc16_final(crc)    (crc)
 
 #endif
@@ -0,0 +1,266 @@
+#include <ctl.h>
+#include <msp430.h>
+#include "ARCbus.h"
+#include "DMA.h"
+
+#include "ARCbus_internal.h"
+
+//current owner of each DMA channel
+static volatile unsigned char BUS_DMA_owner[BUS_DMA_NUM_CH];
+
+//set all DMA channels to free
+void BUS_DMA_init(void){
+  int i;
+  for(i=0;i<BUS_DMA_NUM_CH;i++){
+    BUS_DMA_owner[i]=BUS_DMA_OWNER_NONE;
+  }
+}
+
+//take a DMA channel
+int BUS_DMA_claim(int chan,unsigned char owner){
+  int en,resp=RET_SUCCESS;
+  //check arguments
+  if(chan<0 || chan>=BUS_DMA_NUM_CH || owner==BUS_DMA_OWNER_NONE){
+    return ERR_INVALID_ARGUMENT;
+  }
+  //disable interrupts so the I2C interrupt can not take the channel
+  en=ctl_global_interrupts_disable();
+  //check if the channel is free, a second claim by the same owner is refused
+  //so the SPI master, SPI stream and SPI slave paths exclude each other
+  if(BUS_DMA_owner[chan]==BUS_DMA_OWNER_NONE){
+    //take channel
+    BUS_DMA_owner[chan]=owner;
+  }else if(BUS_DMA_owner[chan]==BUS_DMA_OWNER_I2C || BUS_DMA_owner[chan]==BUS_DMA_OWNER_I2C_RX){
+    //I2C can finish from the interrupt so take the channel from it
+    BUS_I2C_tx_dma_stop();
+    BUS_I2C_rx_dma_stop();
+    //take channel
+    BUS_DMA_owner[chan]=owner;
+  }else{
+    //channel is in use
+    resp=ERR_BUSY;
+  }
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  return resp;
+}
+
+//give back a DMA channel
+void BUS_DMA_release(int chan,unsigned char owner){
+  int en;
+  //check channel
+  if(chan<0 || chan>=BUS_DMA_NUM_CH){
+    return;
+  }
+  //disable interrupts so the check and update happen together
+  en=ctl_global_interrupts_disable();
+  //check that the channel belongs to owner
+  if(BUS_DMA_owner[chan]==owner){
+    //disable channel
+    switch(chan){
+      case BUS_DMA_CH0:
+        DMA0CTL&=~(DMAEN|DMAIE);
+      break;
+      case BUS_DMA_CH1:
+        DMA1CTL&=~(DMAEN|DMAIE);
+      break;
+      case BUS_DMA_CH2:
+        DMA2CTL&=~(DMAEN|DMAIE);
+      break;
+    }
+    //free channel
+    BUS_DMA_owner[chan]=BUS_DMA_OWNER_NONE;
+  }
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+}
+
+#ifdef BUS_I2C_TX_DMA
+
+//start DMA for the rest of the master packet, called from I2C ISR
+int BUS_I2C_tx_dma_start(void){
+  unsigned short left=arcBus_stat.i2c_stat.tx.len-arcBus_stat.i2c_stat.tx.idx;
+  //short packets are sent faster from the interrupt
+  if(left<BUS_I2C_TX_DMA_MIN){
+    return 0;
+  }
+  //check if channel is free, interrupts are disabled in the ISR
+  if(BUS_DMA_owner[BUS_DMA_CH2]!=BUS_DMA_OWNER_NONE){
+    return 0;
+  }
+  //take channel
+  BUS_DMA_owner[BUS_DMA_CH2]=BUS_DMA_OWNER_I2C;
+  //trigger on I2C transmit flag
+  DMACTL1=DMA2TSEL__USCIB0TX;
+  // Source DMA address: byte after the one sent by the interrupt
+  *((unsigned int*)&DMA2SA)=(unsigned int)(&arcBus_stat.i2c_stat.tx.ptr[arcBus_stat.i2c_stat.tx.idx+1]);
+  // Destination DMA address: the transmit buffer.
+  *((unsigned int*)&DMA2DA)=(unsigned int)(&UCB0TXBUF);
+  // The size of the block to be transferred
+  DMA2SZ=left-1;
+  // Configure the DMA transfer, single byte transfer with source increment
+  //enable interrupt so the stop condition can be sent when the transfer is complete
+  DMA2CTL=DMAIE|DMADT_0|DMASBDB|DMASRCINCR_3|DMADSTINCR_0|DMAEN;
+  //transmit interrupt is not needed while the DMA is sending
+  UCB0IE&=~UCTXIE0;
+  //send first byte, the next transmit flag triggers the DMA
+  UCB0TXBUF=arcBus_stat.i2c_stat.tx.ptr[arcBus_stat.i2c_stat.tx.idx++];
+  return 1;
+}
+
+//stop DMA transmit and hand the rest of the packet back to the I2C interrupt, interrupts must be disabled
+void BUS_I2C_tx_dma_stop(void){
+  //check if DMA is sending
+  if(BUS_DMA_owner[BUS_DMA_CH2]!=BUS_DMA_OWNER_I2C){
+    return;
+  }
+  //stop DMA
+  DMA2CTL&=~DMAEN;
+  //check if transfer finished
+  if(DMA2CTL&DMAIFG){
+    //all bytes written
+    arcBus_stat.i2c_stat.tx.idx=arcBus_stat.i2c_stat.tx.len;
+  }else{
+    //size counts down with each byte
+    arcBus_stat.i2c_stat.tx.idx=arcBus_stat.i2c_stat.tx.len-DMA2SZ;
+  }
+  //clear DMA interrupt
+  DMA2CTL&=~(DMAIE|DMAIFG);
+  //free channel
+  BUS_DMA_owner[BUS_DMA_CH2]=BUS_DMA_OWNER_NONE;
+  //interrupt sends any bytes that are left
+  UCB0IE|=UCTXIE0;
+}
+
+//DMA transmit is finished, called from DMA ISR
+int BUS_I2C_tx_dma_done(void){
+  //check if channel was used for I2C
+  if(BUS_DMA_owner[BUS_DMA_CH2]!=BUS_DMA_OWNER_I2C){
+    return 0;
+  }
+  //all bytes written
+  arcBus_stat.i2c_stat.tx.idx=arcBus_stat.i2c_stat.tx.len;
+  //disable channel
+  DMA2CTL&=~(DMAEN|DMAIE);
+  //free channel
+  BUS_DMA_owner[BUS_DMA_CH2]=BUS_DMA_OWNER_NONE;
+  //the next transmit interrupt generates the stop condition
+  UCB0IE|=UCTXIE0;
+  return 1;
+}
+
+#else
+
+//DMA is not used for I2C
+int BUS_I2C_tx_dma_start(void){
+  return 0;
+}
+
+//nothing to stop
+void BUS_I2C_tx_dma_stop(void){
+}
+
+//DMA channel 2 is never used for I2C
+int BUS_I2C_tx_dma_done(void){
+  return 0;
+}
+
+#endif
+
+#ifdef BUS_I2C_RX_DMA
+
+//start DMA receive into the current packet, called from I2C ISR on start condition
+int BUS_I2C_rx_dma_start(void){
+  //DMA is triggered by the flag for own address 0 which is also used for general call
+  if((UCB0ADDRX&0x3FF)!=(UCB0I2COA0&0x3FF) && !(UCB0STATW&UCGC)){
+    return 0;
+  }
+  //check if channel is free, interrupts are disabled in the ISR
+  if(BUS_DMA_owner[BUS_DMA_CH2]!=BUS_DMA_OWNER_NONE){
+    return 0;
+  }
+  //take channel
+  BUS_DMA_owner[BUS_DMA_CH2]=BUS_DMA_OWNER_I2C_RX;
+  //trigger on I2C receive flag
+  DMACTL1=DMA2TSEL__USCIB0RX;
+  // Source DMA address: receive register.
+  *((unsigned int*)&DMA2SA)=(unsigned int)(&UCB0RXBUF);
+  // Destination DMA address: packet being received
+  *((unsigned int*)&DMA2DA)=(unsigned int)arcBus_stat.i2c_stat.rx.ptr;
+  // The size of the block to be transferred
+  DMA2SZ=arcBus_stat.i2c_stat.rx.len;
+  // Configure the DMA transfer, single byte transfer with destination increment
+  //enable interrupt so extra bytes can be NACKed when the packet is full
+  DMA2CTL=DMAIE|DMADT_0|DMASBDB|DMASRCINCR_0|DMADSTINCR_3|DMAEN;
+  //receive interrupt is not needed while the DMA is receiving
+  UCB0IE&=~UCRXIE0;
+  //check if the first byte arrived before the DMA was enabled
+  if(UCB0IFG&UCRXIFG0){
+    //the trigger was missed so start the first transfer
+    DMA2CTL|=DMAREQ;
+  }
+  return 1;
+}
+
+//stop DMA receive and hand the rest of the packet back to the I2C interrupt, interrupts must be disabled
+void BUS_I2C_rx_dma_stop(void){
+  //check if DMA is receiving
+  if(BUS_DMA_owner[BUS_DMA_CH2]!=BUS_DMA_OWNER_I2C_RX){
+    return;
+  }
+  //stop DMA
+  DMA2CTL&=~DMAEN;
+  //check if transfer finished
+  if(DMA2CTL&DMAIFG){
+    //packet is full
+    arcBus_stat.i2c_stat.rx.idx=arcBus_stat.i2c_stat.rx.len;
+  }else{
+    //size counts down with each byte
+    arcBus_stat.i2c_stat.rx.idx=arcBus_stat.i2c_stat.rx.len-DMA2SZ;
+  }
+  //clear DMA interrupt
+  DMA2CTL&=~(DMAIE|DMAIFG);
+  //free channel
+  BUS_DMA_owner[BUS_DMA_CH2]=BUS_DMA_OWNER_NONE;
+  //interrupt receives any bytes that are left
+  UCB0IE|=UCRXIE0;
+}
+
+//DMA receive buffer is full, called from DMA ISR
+int BUS_I2C_rx_dma_done(void){
+  //check if channel was used for I2C
+  if(BUS_DMA_owner[BUS_DMA_CH2]!=BUS_DMA_OWNER_I2C_RX){
+    return 0;
+  }
+  //packet is full
+  arcBus_stat.i2c_stat.rx.idx=arcBus_stat.i2c_stat.rx.len;
+  //disable channel
+  DMA2CTL&=~(DMAEN|DMAIE);
+  //free channel
+  BUS_DMA_owner[BUS_DMA_CH2]=BUS_DMA_OWNER_NONE;
+  //the interrupt NACKs any more bytes
+  UCB0IE|=UCRXIE0;
+  return 1;
+}
+
+#else
+
+//DMA is not used for I2C receive
+int BUS_I2C_rx_dma_start(void){
+  return 0;
+}
+
+//nothing to stop
+void BUS_I2C_rx_dma_stop(void){
+}
+
+//DMA channel 2 is never used for I2C receive
+int BUS_I2C_rx_dma_done(void){
+  return 0;
+}
+
+#endif
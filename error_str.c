@@ -41,6 +41,10 @@ const char *BUS_error_str(int error){
       return "ERROR TX to self";
     case ERR_DMA_TIMEOUT:
       return "ERROR DMA timeout";
+    case ERR_NOT_SUPPORTED:
+      return "ERROR not supported";
+    case ERR_NODE_DOWN:
+      return "ERROR node down";
     //Error was not found
     default:
       return "UNKNOWN ERROR";
@@ -119,6 +123,20 @@ const char* BUS_cmdtostr(unsigned char cmd){
       return "CMD_HW_RESET";
     case CMD_RF_REQ:
       return "CMD_RF_REQ";
+    case CMD_BATCH:
+      return "CMD_BATCH";
+    case CMD_FRAG:
+      return "CMD_FRAG";
+    case CMD_CREDIT:
+      return "CMD_CREDIT";
+    case CMD_RPC_REQ:
+      return "CMD_RPC_REQ";
+    case CMD_RPC_RESP:
+      return "CMD_RPC_RESP";
+    case CMD_SPI_STREAM:
+      return "CMD_SPI_STREAM";
+    case CMD_SPI_RDY_TYPE:
+      return "CMD_SPI_RDY_TYPE";
     default:
       return "Unknown";
   }
@@ -148,6 +166,10 @@ const char* BUS_cmd_resptostr(unsigned char resp){
       return "Error SPI wrong address";
     case ERR_PK_BAD_PARM:
       return "Error Bad parameter";
+    case ERR_SPI_NO_SINK:
+      return "Error SPI no stream sink";
+    case ERR_SPI_SINK_FAIL:
+      return "Error SPI stream sink failed";
     default:
       return "Unknown";
   }
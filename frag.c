@@ -0,0 +1,173 @@
+#include <ctl.h>
+#include <msp430.h>
+#include <string.h>
+#include "ARCbus.h"
+
+#include "ARCbus_internal.h"
+
+//reassembly buffers, only used by the ARCbus task
+static BUS_FRAG_BUF BUS_frag_buf[BUS_FRAG_BUFS];
+
+//id for the next fragmented message
+static unsigned char BUS_frag_id=0;
+
+//initialize reassembly buffers
+void BUS_frag_init(void){
+  int i;
+  //free all buffers
+  for(i=0;i<BUS_FRAG_BUFS;i++){
+    BUS_frag_buf[i].addr=0;
+  }
+}
+
+//drop a partly received message
+static void BUS_frag_drop(BUS_FRAG_BUF *buf){
+  //report error
+  report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_FRAG_DROP,(((unsigned short)buf->addr)<<8)|buf->cmd);
+  //free buffer
+  buf->addr=0;
+}
+
+//add a fragment to the reassembly buffer for addr
+//returns the buffer when the message is complete, otherwise returns NULL
+//resp is set to a NACK reason if the fragment could not be used
+BUS_FRAG_BUF *BUS_frag_rx(unsigned char addr,const unsigned char *ptr,unsigned short len,int *resp){
+  BUS_FRAG_BUF *buf=NULL,*free=NULL;
+  unsigned char idx;
+  CTL_TIME_t now;
+  int i;
+  //check length
+  if(len<BUS_FRAG_HDR_LEN){
+    *resp=ERR_PK_LEN;
+    return NULL;
+  }
+  //get fragment index
+  idx=ptr[1]&BUS_FRAG_IDX_MASK;
+  //get current time
+  now=ctl_get_current_time();
+  //find buffer for sender
+  for(i=0;i<BUS_FRAG_BUFS;i++){
+    //check for stale messages
+    if(BUS_frag_buf[i].addr!=0 && (now-BUS_frag_buf[i].time)>BUS_FRAG_TIMEOUT){
+      //message did not complete in time
+      BUS_frag_drop(&BUS_frag_buf[i]);
+    }
+    if(BUS_frag_buf[i].addr==addr){
+      buf=&BUS_frag_buf[i];
+    }else if(free==NULL && BUS_frag_buf[i].addr==0){
+      free=&BUS_frag_buf[i];
+    }
+  }
+  //check for first fragment
+  if(idx==0){
+    //check for a partly received message from this sender
+    if(buf!=NULL){
+      //new message replaces the old one
+      BUS_frag_drop(buf);
+    }else{
+      //use a free buffer
+      buf=free;
+    }
+    //check if a buffer was found
+    if(buf==NULL){
+      *resp=ERR_BUFFER_BUSY;
+      return NULL;
+    }
+    //setup buffer
+    buf->addr=addr;
+    buf->cmd=ptr[0];
+    buf->id=ptr[2];
+    buf->next=0;
+    buf->len=0;
+  }else if(buf==NULL || buf->id!=ptr[2] || buf->cmd!=ptr[0] || buf->next!=idx){
+    //fragment is missing or out of order
+    if(buf!=NULL){
+      BUS_frag_drop(buf);
+    }
+    *resp=ERR_BAD_PK;
+    return NULL;
+  }
+  //check that the fragment fits
+  if(buf->len+len-BUS_FRAG_HDR_LEN>BUS_FRAG_MAX_LEN){
+    BUS_frag_drop(buf);
+    *resp=ERR_PK_LEN;
+    return NULL;
+  }
+  //copy fragment
+  memcpy(buf->dat+buf->len,ptr+BUS_FRAG_HDR_LEN,len-BUS_FRAG_HDR_LEN);
+  buf->len+=len-BUS_FRAG_HDR_LEN;
+  //next fragment
+  buf->next++;
+  //save time
+  buf->time=now;
+  //fragment accepted
+  *resp=RET_SUCCESS;
+  //check for last fragment
+  if(ptr[1]&BUS_FRAG_LAST){
+    //message is complete
+    return buf;
+  }
+  return NULL;
+}
+
+//done with a complete message
+void BUS_frag_free(BUS_FRAG_BUF *buf){
+  buf->addr=0;
+}
+
+//send a command that can be longer than one packet
+int BUS_cmd_tx_frag(unsigned char addr,unsigned char cmd,const void *dat,unsigned short len,unsigned short flags){
+  unsigned char buf[BUS_I2C_HDR_LEN+BUS_I2C_MAX_PACKET_LEN+BUS_I2C_CRC_LEN],*ptr;
+  unsigned short size;
+  unsigned char idx,id;
+  int resp,en;
+  //check message length
+  if(len>BUS_FRAG_MAX_LEN){
+    return ERR_PACKET_TOO_LONG;
+  }
+  //check if the message fits in one packet
+  if(len<=BUS_I2C_MAX_PACKET_LEN){
+    //setup command
+    ptr=BUS_cmd_init(buf,cmd);
+    //copy payload
+    memcpy(ptr,dat,len);
+    //send packet
+    return BUS_cmd_tx(addr,buf,len,flags);
+  }
+  //hold the bus for the whole message, the receiver only keeps one message per sender
+  //so fragments from two tasks to the same address must not be mixed
+  if(BUS_arb_lock(BUS_I2C_LOCK_TIMEOUT)!=RET_SUCCESS){
+    return ERR_BUSY;
+  }
+  //get message id
+  en=ctl_global_interrupts_disable();
+  id=BUS_frag_id++;
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  //send fragments
+  for(idx=0,resp=RET_SUCCESS;len>0;idx++){
+    //get fragment size
+    size=(len>BUS_FRAG_DATA_LEN)?BUS_FRAG_DATA_LEN:len;
+    //setup command
+    ptr=BUS_cmd_init(buf,CMD_FRAG);
+    //message command
+    ptr[0]=cmd;
+    //fragment index
+    ptr[1]=idx|((size==len)?BUS_FRAG_LAST:0);
+    //message id
+    ptr[2]=id;
+    //copy fragment data
+    memcpy(ptr+BUS_FRAG_HDR_LEN,dat,size);
+    //send packet, the bus lock nests
+    if((resp=BUS_cmd_tx(addr,buf,size+BUS_FRAG_HDR_LEN,flags))!=RET_SUCCESS){
+      break;
+    }
+    //next fragment
+    dat=((const unsigned char*)dat)+size;
+    len-=size;
+  }
+  //let other tasks use the bus
+  BUS_I2C_release();
+  return resp;
+}
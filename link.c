@@ -0,0 +1,313 @@
+#include <ctl.h>
+#include <msp430.h>
+#include "ARCbus.h"
+
+#include "ARCbus_internal.h"
+
+//credits for each destination, BUS_LINK_CREDIT_UNKNOWN if the destination has not asked senders to slow down
+static volatile unsigned char BUS_link_credits[CMD_ADDR_MASK+1];
+//events for credit updates
+static CTL_EVENT_SET_t BUS_link_events;
+//set when senders have been told to stop sending to this board
+static unsigned char BUS_link_xoff;
+
+//link health for a destination
+typedef struct{
+  //health that is given to the user, address is zero if unused
+  BUS_LINK_STAT stat;
+  //time the last packet was let through while down
+  CTL_TIME_t probe;
+}BUS_LINK_NODE;
+
+//link health table
+static BUS_LINK_NODE BUS_link_nodes[BUS_LINK_NODES];
+//timer value when the current packet started
+static unsigned short BUS_link_start;
+
+//initialize credits so no destination is limited
+void BUS_link_init(void){
+  int i;
+  for(i=0;i<=CMD_ADDR_MASK;i++){
+    BUS_link_credits[i]=BUS_LINK_CREDIT_UNKNOWN;
+  }
+  ctl_events_init(&BUS_link_events,0);
+  BUS_link_xoff=0;
+  //clear health table
+  for(i=0;i<BUS_LINK_NODES;i++){
+    BUS_link_nodes[i].stat.addr=0;
+  }
+}
+
+//find the health entry for addr, returns NULL if there is none
+static BUS_LINK_NODE *BUS_link_find(unsigned char addr){
+  int i;
+  for(i=0;i<BUS_LINK_NODES;i++){
+    if(BUS_link_nodes[i].stat.addr==addr){
+      return &BUS_link_nodes[i];
+    }
+  }
+  return NULL;
+}
+
+//get the health entry for addr, a new entry replaces the one with the oldest success
+static BUS_LINK_NODE *BUS_link_node(unsigned char addr){
+  BUS_LINK_NODE *node,*old=NULL;
+  int i;
+  //check for existing entry
+  if((node=BUS_link_find(addr))!=NULL){
+    return node;
+  }
+  for(i=0;i<BUS_LINK_NODES;i++){
+    node=&BUS_link_nodes[i];
+    //use free entry
+    if(node->stat.addr==0){
+      old=node;
+      break;
+    }
+    //find oldest entry
+    if(old==NULL || node->stat.last_ok<old->stat.last_ok){
+      old=node;
+    }
+  }
+  //setup entry
+  old->stat.addr=addr;
+  old->stat.down=0;
+  old->stat.fails=0;
+  old->stat.nack=0;
+  old->stat.timeout=0;
+  old->stat.cll=0;
+  old->stat.latency=0;
+  old->stat.last_ok=0;
+  old->probe=0;
+  return old;
+}
+
+//check if a packet can be sent to addr
+int BUS_link_check(unsigned char addr){
+  BUS_LINK_NODE *node;
+  CTL_TIME_t now;
+  //look for entry
+  node=BUS_link_find(addr);
+  //check if node is down
+  if(node==NULL || !node->stat.down){
+    return RET_SUCCESS;
+  }
+  now=ctl_get_current_time();
+  //let a packet through every so often to see if the node is back
+  if((now-node->probe)<BUS_LINK_PROBE_TIME){
+    return ERR_NODE_DOWN;
+  }
+  //save probe time
+  node->probe=now;
+  return RET_SUCCESS;
+}
+
+//save start time of a packet
+void BUS_link_tx_begin(void){
+  BUS_link_start=readTA1();
+}
+
+//update link health after a packet was sent to addr
+static void BUS_link_health(unsigned char addr,int result){
+  BUS_LINK_NODE *node;
+  unsigned short time;
+  switch(result){
+    case RET_SUCCESS:
+      //get send time
+      time=readTA1()-BUS_link_start;
+      node=BUS_link_node(addr);
+      //node is up
+      node->stat.down=0;
+      //clear consecutive errors
+      node->stat.fails=0;
+      node->stat.nack=0;
+      node->stat.timeout=0;
+      node->stat.cll=0;
+      //save time
+      node->stat.last_ok=get_ticker_time();
+      //update average send time
+      if(node->stat.latency==0){
+        node->stat.latency=time;
+      }else{
+        node->stat.latency=node->stat.latency-(node->stat.latency>>3)+(time>>3);
+      }
+    return;
+    case ERR_I2C_NACK:
+      node=BUS_link_node(addr);
+      node->stat.nack++;
+    break;
+    case ERR_TIMEOUT:
+      node=BUS_link_node(addr);
+      node->stat.timeout++;
+    break;
+    case ERR_I2C_CLL:
+      node=BUS_link_node(addr);
+      node->stat.cll++;
+    break;
+    default:
+      //other errors do not mean the node is gone
+      //a start timeout means the bus was busy so it is not counted against the destination
+    return;
+  }
+  //count failure
+  if(node->stat.fails<0xFF){
+    node->stat.fails++;
+  }
+  //check if node is down
+  if(!node->stat.down && node->stat.fails>=BUS_LINK_DOWN_FAILS){
+    node->stat.down=1;
+    //start probe time
+    node->probe=ctl_get_current_time();
+  }
+}
+
+//wait for credits to send to addr
+void BUS_link_wait(unsigned char addr){
+  CTL_TIME_t start,t;
+  //general call packets are not limited
+  if(addr==BUS_ADDR_GC){
+    return;
+  }
+  //get starting time
+  start=ctl_get_current_time();
+  for(;;){
+    //clear event before checking so an update is not missed
+    ctl_events_set_clear(&BUS_link_events,0,BUS_LINK_EV_CREDIT);
+    //check for credits
+    if(BUS_link_credits[addr]!=0){
+      return;
+    }
+    //get time waited
+    t=ctl_get_current_time()-start;
+    //check for timeout
+    if(t>=BUS_LINK_CREDIT_WAIT){
+      //no update received, it may have been lost so send anyway
+      BUS_link_credits[addr]=BUS_LINK_CREDIT_UNKNOWN;
+      return;
+    }
+    //wait for credit update
+    ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS,&BUS_link_events,BUS_LINK_EV_CREDIT,CTL_TIMEOUT_DELAY,BUS_LINK_CREDIT_WAIT-t);
+  }
+}
+
+//update credits and link health after a packet was sent to addr
+void BUS_link_tx_result(unsigned char addr,int result){
+  unsigned char c;
+  //general call packets are not limited
+  if(addr==BUS_ADDR_GC){
+    return;
+  }
+  //update link health
+  BUS_link_health(addr,result);
+  //a NACK does not limit sends, a missing node would block every sender for BUS_LINK_CREDIT_WAIT
+  //a full destination sends zero credits itself
+  if(result==RET_SUCCESS){
+    c=BUS_link_credits[addr];
+    //use a credit if the destination gave a limit
+    if(c!=BUS_LINK_CREDIT_UNKNOWN && c!=0){
+      BUS_link_credits[addr]=c-1;
+    }
+  }
+}
+
+//credits received from addr
+void BUS_link_credit_rx(unsigned char addr,unsigned char credits){
+  //unknown value means no limit so don't allow it to be sent
+  if(credits>=BUS_LINK_CREDIT_UNKNOWN){
+    credits=BUS_LINK_CREDIT_UNKNOWN-1;
+  }
+  //save credits
+  BUS_link_credits[addr&CMD_ADDR_MASK]=credits;
+  //wake up waiting senders
+  if(credits){
+    ctl_events_set_clear(&BUS_link_events,BUS_LINK_EV_CREDIT,0);
+  }
+}
+
+//tell all boards how many packets can be sent to this board
+static int BUS_link_send_credit(unsigned char credits){
+  unsigned char buf[BUS_I2C_HDR_LEN+1+BUS_I2C_CRC_LEN],*ptr;
+  //setup packet
+  ptr=BUS_cmd_init(buf,CMD_CREDIT);
+  //set credits
+  ptr[0]=credits;
+  //queue packet, this board does not need the packet
+  return BUS_cmd_tx_async(BUS_ADDR_GC,buf,1,BUS_CMD_FL_NO_SW_TX,NULL);
+}
+
+//receive queue was full, tell senders to stop
+void BUS_link_rx_busy(void){
+  //check if senders have already been told
+  if(BUS_link_xoff){
+    return;
+  }
+  //send zero credits
+  if(BUS_link_send_credit(0)==RET_SUCCESS){
+    BUS_link_xoff=1;
+  }
+}
+
+//check if senders can be told to start again, called after received packets are handled
+void BUS_link_rx_check(void){
+  unsigned short free;
+  //check if senders were told to stop
+  if(!BUS_link_xoff){
+    return;
+  }
+  //get free space in receive queue
+  free=I2C_rx_free();
+  //wait until there is enough space
+  if(free<BUS_LINK_XON_FREE){
+    return;
+  }
+  //limit to the largest credit value
+  if(free>=BUS_LINK_CREDIT_UNKNOWN){
+    free=BUS_LINK_CREDIT_UNKNOWN-1;
+  }
+  //send credits
+  if(BUS_link_send_credit(free)==RET_SUCCESS){
+    BUS_link_xoff=0;
+  }
+}
+
+//get link health for addr
+int BUS_link_stat(unsigned char addr,BUS_LINK_STAT *stat){
+  BUS_LINK_NODE *node;
+  int en;
+  //look for entry
+  if(addr==BUS_ADDR_GC || (node=BUS_link_find(addr))==NULL){
+    return ERR_INVALID_ARGUMENT;
+  }
+  //disable interrupts so the entry is not changed while it is copied
+  en=ctl_global_interrupts_disable();
+  *stat=node->stat;
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  return RET_SUCCESS;
+}
+
+//return nonzero if addr is down
+int BUS_link_is_down(unsigned char addr){
+  BUS_LINK_NODE *node;
+  //look for entry
+  node=BUS_link_find(addr);
+  //nodes that have not been sent to are not down
+  return node!=NULL && node->stat.down;
+}
+
+//send a CMD_PING to addr even if it is down
+int BUS_link_probe(unsigned char addr){
+  unsigned char buf[BUS_I2C_HDR_LEN+BUS_I2C_CRC_LEN];
+  BUS_LINK_NODE *node;
+  //check for entry
+  if((node=BUS_link_find(addr))!=NULL){
+    //let the next packet through
+    node->probe=ctl_get_current_time()-BUS_LINK_PROBE_TIME;
+  }
+  //setup packet
+  BUS_cmd_init(buf,CMD_PING);
+  //send packet
+  return BUS_cmd_tx(addr,buf,0,0);
+}
@@ -6,6 +6,7 @@
 #include "ARCbus.h"
 #include "crc.h"
 #include "spi.h"
+#include "DMA.h"
 #include <Error.h>
 #include "ARCbus_internal.h"
 
@@ -31,8 +32,17 @@ CTL_EVENT_SET_t SUB_events;
 //address of SPI slave during transaction
 static unsigned char SPI_addr=0;
 
+//buffer for SPI transaction
+static unsigned char *SPI_buf=NULL;
+//pool index of SPI_buf
+static int SPI_buf_idx;
+//CRC of the data SPI_buf is receiving
+static SPI_CRC SPI_crc;
+
 //keep track of how many times the bus is busy
 static int i2c_buf_busy_cnt;
+//time of the first RX busy error since a packet was handled
+static CTL_TIME_t i2c_buf_busy_time;
 
 static void ARC_bus_helper(void *p);
 
@@ -44,41 +54,26 @@ static struct{
     unsigned char dest;
 }err_req;
 
-//struct for NACK info
-//This is used to setup a NACK packet in the bus task and have it sent by the bus helper task
-//no mutex is used but address is used to indicate busy status. This only works if no other threads use this structure
-static struct{
-  unsigned char addr;
-  unsigned char dat[BUS_I2C_HDR_LEN+2+BUS_I2C_CRC_LEN];
-}nack_info;
+//queue a NACK packet, the packet is sent from the I2C interrupt so the caller does not wait
+void BUS_send_nack(unsigned char addr,unsigned char cmd,unsigned char reason){
+  unsigned char dat[BUS_I2C_HDR_LEN+2+BUS_I2C_CRC_LEN],*ptr;
+  //setup command
+  ptr=BUS_cmd_init(dat,CMD_NACK);
+  //sent command
+  *ptr++=cmd;
+  //send NACK reason
+  *ptr++=reason;
+  //queue packet
+  if(BUS_cmd_tx_async(addr,dat,2,0,NULL)!=RET_SUCCESS){
+    //can't send nack, report error
+    report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_NACK_BUSY,(((unsigned short)addr)<<8)|reason);
+  }
+}
 
 
 //power state of subsystem
 unsigned short powerState=SUB_PWR_OFF;
 
-//pointer to linked list of command parse functions
-//nodes in the list are sorted by priority
-//this node is the first in the list (or NULL for an empty list)
-//the last node in the list has next set to NULL
-CMD_PARSE_DAT *cmd_parse_list=NULL;
-
-//register callback
-//insert the callback structure in the linked list based on priority
-void BUS_register_cmd_callback(CMD_PARSE_DAT *cb_dat){
-  //get a pointer to the current list head
-  CMD_PARSE_DAT **head=&cmd_parse_list;
-  //find insertion point.
-  //This should be where *head points to a node with greater priority (or the beginning)
-  //and *head->next points to a node with lower priority (or the end)
-  while(*head!=NULL && (*head)->priority>cb_dat->priority){
-    //move head to the next element in the list
-    head= &(*head)->next;
-  }
-  //link to lower priority callbacks
-  cb_dat->next=*head;
-  //link in this callback
-  *head=cb_dat;
-}
 #define BUS_VERSION_LEN         (sizeof(BUS_VERSION)+BUS_VERSION_HASH_LEN)
 #define BUS_VERSION_MINOR_DIG   (4)     //maximum digits in minor version
 #define BUS_VERSION_HASH_LEN    (13)    //maximum length of hash that is sent
@@ -163,42 +158,549 @@ char BUS_version_cmp(const BUS_VERSION* other,unsigned char len){
   return BUS_VER_SAME;
 }
 
-//ARC bus Task, do ARC bus stuff
-static void ARC_bus_run(void *p) __toplevel{
-  unsigned int e;
-  unsigned char len;
-  unsigned char addr,cmd,flags;
-  int resp;
-  unsigned char pk[40];
-  unsigned char *ptr;
-  unsigned short crc;
-  unsigned char *SPI_buf=NULL;
+//report errors for a command and send a NACK if requested
+static void ARC_bus_cmd_resp(unsigned char addr,unsigned char cmd,int resp,unsigned char nack){
+  //check if command was recognized
+  if(resp!=0){
+    report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_BAD_CMD,(((unsigned short)resp)<<8)|((unsigned short)cmd));
+    //check packet to see if NACK should be sent
+    if(nack){
+      //send NACK
+      BUS_send_nack(addr,cmd,resp);
+    }
+  }
+}
+
+//handle a command, returns zero on success or a NACK reason
+//nested is set for records from a batch packet, a fragmented command or an RPC request
+static int ARC_bus_cmd(unsigned char addr,unsigned char cmd,unsigned char *ptr,unsigned short len,unsigned char flags,unsigned char nack,unsigned char nested){
+  int resp=0,rec_resp;
+  unsigned short rec_len;
+  BUS_FRAG_BUF *frag;
   ticker nt,ot;
-  int snd,i;
-  unsigned char parse_mask;
   #ifdef CDH_LIB
   //temporary array for bus version comparison, needed for alignment reasons
   unsigned short tmp[(BUS_VERSION_LEN+1)/sizeof(unsigned short)];
   #endif
-  CMD_PARSE_DAT *parse_ptr;
+    //handle command based on command type
+    switch(cmd){
+      case CMD_SUB_ON:            
+          //check for proper length
+          if(len!=0){
+            resp=ERR_PK_LEN;
+          }
+          //set new power status
+          powerState=SUB_PWR_ON;
+          //inform subsystem
+          ctl_events_set_clear(&SUB_events,SUB_EV_PWR_ON,0);
+      break;
+      case CMD_SUB_OFF:
+        //check to make sure that the command is directed to this subsystem
+        if(len==1 && BUS_OA_check(ptr[0])==RET_SUCCESS){
+          //set new power status
+          powerState=SUB_PWR_OFF;
+          //inform subsystem
+          ctl_events_set_clear(&SUB_events,SUB_EV_PWR_OFF,0);
+        }else{
+          //error with command
+          resp=ERR_BAD_PK;
+        }
+      break;
+      case CMD_SUB_STAT:
+        //check for proper length
+        if(len!=4){
+          resp=ERR_PK_LEN;
+        }                
+        #ifndef CDH_LIB //only update time on subsystem boards
+            //assemble time from packet
+            nt=ptr[3];
+            nt|=((ticker)ptr[2])<<8;
+            nt|=((ticker)ptr[1])<<16;
+            nt|=((ticker)ptr[0])<<24;
+            //update time
+            ot=setget_ticker_time(nt);
+            //tell subsystem to send status
+            ctl_events_set_clear(&SUB_events,SUB_EV_SEND_STAT,0);
+            //trigger any alarms that were skipped
+            BUS_alarm_ticker_update(nt,ot);
+        #else
+            //if CMD_SUB_STAT is recived by CDH, report an error
+            report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_CDH_SUB_STAT_REC,addr);
+            resp=ERR_ILLEAGLE_COMMAND;
+        #endif
+      break;
+      case CMD_RESET:          
+        //check for proper length
+        if(len!=0){
+          resp=ERR_PK_LEN;
+        }
+        //reset msp430
+        reset(ERR_LEV_INFO,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_RESET,0);
+        //code should never get here, report error
+        report_error(ERR_LEV_CRITICAL,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_RESET_FAIL,0);
+        break;
+      case CMD_SPI_RDY:
+      case CMD_SPI_RDY_TYPE:
+        //check length, CMD_SPI_RDY_TYPE also has the data type
+        if(len!=((cmd==CMD_SPI_RDY_TYPE)?3:2)){
+          resp=ERR_PK_LEN;
+          break;
+        }
+        //assemble length
+        arcBus_stat.spi_stat.len=ptr[1];//LSB
+        arcBus_stat.spi_stat.len|=(((unsigned short)ptr[0])<<8);//MSB
+        //check if already transmitting, the complete command for the last transfer has not been sent,
+        //a stream is being received or BUS_SPI_txrx is running
+        if(SPI_buf!=NULL || SPI_addr || BUS_SPI_stream_busy() || arcBus_stat.spi_stat.mode!=BUS_SPI_IDLE){
+          resp=ERR_SPI_BUSY;
+          break;
+        }
+        //take DMA channel used for the DMA9 workaround
+        if(BUS_DMA_claim(BUS_DMA_CH2,BUS_DMA_OWNER_SPI)!=RET_SUCCESS){
+          resp=ERR_SPI_BUSY;
+          break;
+        }
+        //try a registered destination for the data type
+        if((SPI_buf=BUS_SPI_dest_get(addr,(cmd==CMD_SPI_RDY_TYPE)?ptr[2]:0,arcBus_stat.spi_stat.len))!=NULL){
+          //no pool buffer used
+          SPI_buf_idx=-1;
+        }else{
+          //check length account for 16bit CRC
+          if(arcBus_stat.spi_stat.len+BUS_SPI_CRC_LEN>BUS_get_buffer_size()){
+            //give back DMA channel
+            BUS_DMA_release(BUS_DMA_CH2,BUS_DMA_OWNER_SPI);
+            //length is too long
+            //cause NACK to be sent
+            resp=ERR_SPI_LEN;
+            break;
+          }
+          //get a buffer from the pool
+          SPI_buf_idx=BUS_buf_rx_get();
+          //check if all buffers are in use
+          if(SPI_buf_idx<0){
+            //give back DMA channel
+            BUS_DMA_release(BUS_DMA_CH2,BUS_DMA_OWNER_SPI);
+            //buffer locked, set event
+            ctl_events_set_clear(&SUB_events,SUB_EV_SPI_ERR_BUSY,0);
+            //set response
+            resp=ERR_BUFFER_BUSY;
+            //stop SPI setup
+            break;
+          }
+          SPI_buf=BUS_buf_ptr(SPI_buf_idx);
+        }
+        //disable DMA
+        DMA0CTL&=~DMAEN;
+        DMA1CTL&=~DMAEN;
+        DMA2CTL&=~DMAEN;
+        //CRC is updated while the data is received
+        SPI_crc_start(&SPI_crc,SPI_buf,arcBus_stat.spi_stat.len);
+        //save address of SPI slave
+        SPI_addr=addr;
+        //setup SPI structure
+        arcBus_stat.spi_stat.rx=SPI_buf;
+        arcBus_stat.spi_stat.tx=NULL;
+        //Setup SPI bus to exchange data as master
+        SPI_master_setup();
+        //============[setup DMA for transfer]============
+        //setup source trigger
+        DMACTL0 &=~(DMA0TSEL_31|DMA1TSEL_31);
+        DMACTL0 |= (DMA0TSEL__USCIA0RX|DMA1TSEL__USCIA0TX);
+        DMACTL1 = DMA2TSEL__USCIA0RX;
+        //DMA9 workaround, use a dummy channel with lower priority and the same trigger
+        //setup dummy channel: read and write from unused space in the SPI registers
+        *((unsigned int*)&DMA2SA) = EUSCI_A0_BASE + 0x02;
+        *((unsigned int*)&DMA2DA) = EUSCI_A0_BASE + 0x04;
+        // only one byte
+        DMA2SZ = 1;
+        // Configure the DMA transfer, repeated byte transfer with no increment
+        DMA2CTL = DMADT_4|DMASBDB|DMAEN|DMASRCINCR_0|DMADSTINCR_0;
+
+        // Source DMA address: receive register.
+        *((unsigned int*)&DMA0SA) = (unsigned short)(&UCA0RXBUF);
+        // Destination DMA address: rx buffer.
+        *((unsigned int*)&DMA0DA) = (unsigned short)SPI_buf;
+        // The size of the block to be transferred
+        DMA0SZ = arcBus_stat.spi_stat.len+BUS_SPI_CRC_LEN;
+        // Configure the DMA transfer, single byte transfer with destination increment
+        DMA0CTL = DMAIE|DMADT_0|DMASBDB|DMAEN|DMASRCINCR_0|DMADSTINCR_3;
+
+        // Source DMA address: SPI transmit buffer, constant data will be sent
+        *((unsigned int*)&DMA1SA) = (unsigned int)(&UCA0TXBUF);
+        // Destination DMA address: the transmit buffer.
+        *((unsigned int*)&DMA1DA) = (unsigned int)(&UCA0TXBUF);
+        // The size of the block to be transferred
+        DMA1SZ = arcBus_stat.spi_stat.len+BUS_SPI_CRC_LEN-1;
+        // Configure the DMA transfer, single byte transfer with no increment
+        DMA1CTL=DMADT_0|DMASBDB|DMAEN|DMASRCINCR_0|DMADSTINCR_0;
+        //write the Tx buffer to start transfer
+        UCA0TXBUF=BUS_SPI_DUMMY_DATA;
+      break;
+      
+      case CMD_SPI_STREAM:
+        //check length
+        if(len!=4){
+          resp=ERR_PK_LEN;
+          break;
+        }
+        //check if already transmitting or the complete command for the last transfer has not been sent
+        if(SPI_buf!=NULL || SPI_addr){
+          resp=ERR_SPI_BUSY;
+          break;
+        }
+        //start receiving segments
+        resp=BUS_SPI_stream_start(addr,ptr);
+      break;
+      
+      case CMD_SPI_ABORT:
+        //check length
+        if(len!=0){
+          resp=ERR_PK_LEN;
+          break;
+        }
+        //check for a stream from the sender
+        if(BUS_SPI_stream_abort(addr)==RET_SUCCESS){
+          //retport error
+          report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_SPI_ABORT,addr);
+          break;
+        }
+        //check SPI mode
+        if(arcBus_stat.spi_stat.mode!=BUS_SPI_MASTER){
+          resp=ERR_SPI_NOT_RUNNING;
+          break;
+        }
+        //check SPI address
+        if(SPI_addr!=addr){
+          resp=ERR_SPI_WRONG_ADDR;
+          break;
+        }
+        //disable DMA
+        DMA0CTL&=~DMAEN;
+        DMA1CTL&=~DMAEN;
+        DMA2CTL&=~DMAEN;
+        //turn off SPI
+        SPI_deactivate();              
+        //clear buffer pointer
+        SPI_buf=NULL;
+        //check for a registered destination
+        if(SPI_buf_idx<0){
+          //give buffer back to the destination
+          BUS_SPI_dest_done(ERR_TIMEOUT);
+        }else{
+          //free buffer
+          BUS_buf_rx_free(SPI_buf_idx);
+        }
+        //clear address
+        SPI_addr=0;
+        //retport error
+        report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_SPI_ABORT,addr);
+      break;
+
+      case CMD_SPI_COMPLETE:
+        //check length
+        if(len!=1){
+          resp=ERR_PK_LEN;
+          break;
+        }
+#ifndef CDH_LIB
+        //check if a SPI transaction was in progress
+        if(arcBus_stat.spi_stat.mode!=BUS_SPI_SLAVE){
+#else
+        //check if a SPI transaction was in progress
+        if(arcBus_stat.spi_stat.mode!=BUS_SPI_MASTER && arcBus_stat.spi_stat.mode!=BUS_SPI_SLAVE){
+#endif
+          //SPI is in the wrong state so send busy error
+          resp=ERR_SPI_NOT_RUNNING;
+          //send NACK
+          break;
+        }
+
+        //check that the command came from the correct subsystem
+        if(arcBus_stat.spi_stat.mode==BUS_SPI_MASTER && SPI_addr!=addr){
+            //wrong address sent for complete command
+            resp=ERR_SPI_WRONG_ADDR;
+            //send NACK
+            break;
+        }
+        //disable DMA
+        DMA0CTL&=~DMAEN;
+        DMA1CTL&=~DMAEN;
+        DMA2CTL&=~DMAEN;
+        //turn off SPI
+        SPI_deactivate();
+        //SPI transfer is done, see if there was an error
+        arcBus_stat.spi_stat.nack=ptr[0];
+        //notify CDH board
+#ifndef CDH_LIB
+        ctl_events_set_clear(&BUS_helper_events,BUS_HELPER_EV_SPI_CLEAR_CMD,0);
+#endif
+        //notify calling task
+        ctl_events_set_clear(&arcBus_stat.events,BUS_EV_SPI_COMPLETE,0);
+      break;
+      case CMD_ASYNC_SETUP:
+        //check length
+        if(len!=1){
+          resp=ERR_PK_LEN;
+          break;
+        }
+        switch(ptr[0]){
+          case ASYNC_OPEN:
+            //open remote connection
+            async_open_remote(addr);
+          break;
+          case ASYNC_CLOSE:
+            //check if sending address corosponds to async address
+            if(async_addr!=addr){
+              //report error
+              report_error(ERR_LEV_ERROR,BUS_ERR_SRC_ASYNC,ASYNC_ERR_CLOSE_WRONG_ADDR,(((unsigned short)addr)<<8)|async_addr);
+              break;
+            }
+            //tell helper thread to close connection
+            ctl_events_set_clear(&BUS_helper_events,BUS_HELPER_EV_ASYNC_CLOSE,0);
+          break;
+        }
+      break;
+      case CMD_ASYNC_DAT:
+        //post bytes to queue
+        ctl_byte_queue_post_multi_nb(&async_rxQ,len,ptr);
+      break;
+      case CMD_NACK:
+        //TODO: handle this better somehow?
+        //check length
+        if(len!=2){
+          resp=ERR_PK_LEN;
+          break;
+        }
+        //set event 
+        ctl_events_set_clear(&arcBus_stat.events,BUS_EV_CMD_NACK,0);
+        //report error
+        report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_NACK_REC,(((unsigned short)ptr[0])<<8)|((unsigned short)ptr[1]));
+        //check which packet was nacked
+        switch(ptr[0]){
+            case CMD_SPI_RDY:
+            case CMD_SPI_RDY_TYPE:
+            case CMD_SPI_STREAM:
+              //set SPI nack reason
+              arcBus_stat.spi_stat.nack=ptr[1];
+              //send event to spi code
+              ctl_events_set_clear(&arcBus_stat.events,BUS_EV_SPI_NACK,0);
+            break;
+        }
+      break;
+      case CMD_ERR_REQ:
+        if(len<1){
+          resp=ERR_PK_LEN;
+          break;
+        }
+        if(!ctl_mutex_lock(&err_req.mutex,CTL_TIMEOUT_NOW,0)){
+          resp=ERR_BUSY;
+          break;
+        }
+        //request type
+        err_req.type=ptr[0];
+        //address to send data to
+        err_req.dest=addr;
+        switch(ptr[0]){
+          case ERR_REQ_REPLAY:
+              err_req.size=(((unsigned short)ptr[1])<<8)|((unsigned short)ptr[2]);
+              err_req.level=ptr[3];
+          break;
+          default:
+              resp=ERR_INVALID_ARGUMENT;
+          break;
+        }
+        //check if the packet was parsed
+        if(!resp){
+          //send event to process request
+          ctl_events_set_clear(&BUS_helper_events,BUS_HELPER_EV_ERR_REQ,0);
+        }
+      ctl_mutex_unlock(&err_req.mutex);
+      break;
+      case CMD_PING:
+          //this is a dummy command that does nothing
+      break;
+      case CMD_CREDIT:
+        //check length
+        if(len!=1){
+          resp=ERR_PK_LEN;
+          break;
+        }
+        //save credits for sender
+        BUS_link_credit_rx(addr,ptr[0]);
+      break;
+      case CMD_FRAG:
+        //fragments can not be nested
+        if(nested){
+          resp=ERR_BAD_PK;
+          break;
+        }
+        //add fragment to reassembly buffer
+        if((frag=BUS_frag_rx(addr,ptr,len,&resp))!=NULL){
+          //get message command
+          cmd=frag->cmd;
+          //message is not in a receive slot so callbacks can not hold it
+          BUS_cmd_no_hold=1;
+          //handle message like a separate command
+          rec_resp=ARC_bus_cmd(addr,cmd,frag->dat,frag->len,flags,nack,1);
+          BUS_cmd_no_hold=0;
+          //done with message
+          BUS_frag_free(frag);
+          //report errors for message
+          ARC_bus_cmd_resp(addr,cmd,rec_resp,nack);
+        }
+      break;
+      case CMD_RPC_REQ:
+        //requests can not be nested
+        if(nested){
+          resp=ERR_BAD_PK;
+          break;
+        }
+        //check for request header
+        if(len<BUS_RPC_HDR_LEN){
+          resp=ERR_PK_LEN;
+          break;
+        }
+        //callbacks can reply to the request
+        BUS_rpc_begin(addr,ptr[1]);
+        //handle request like a separate command, the response is sent instead of a NACK
+        rec_resp=ARC_bus_cmd(addr,ptr[0],ptr+BUS_RPC_HDR_LEN,len-BUS_RPC_HDR_LEN,flags,0,1);
+        //report errors for request
+        ARC_bus_cmd_resp(addr,ptr[0],rec_resp,0);
+        //send status if the callback did not reply and the request was not passed to a worker
+        BUS_rpc_end(rec_resp);
+      break;
+      case CMD_RPC_RESP:
+        //wake up the task waiting for the response
+        resp=BUS_rpc_resp_rx(addr,ptr,len);
+      break;
+      case CMD_BATCH:
+        //batch commands can not be nested
+        if(nested){
+          resp=ERR_BAD_PK;
+          break;
+        }
+        //loop through records
+        while(len>0){
+          //check for record header
+          if(len<BUS_BATCH_REC_HDR_LEN){
+            resp=ERR_PK_LEN;
+            break;
+          }
+          //get record length
+          rec_len=ptr[1]&BUS_BATCH_REC_LEN_MASK;
+          //check that the record fits in the packet
+          if(rec_len+BUS_BATCH_REC_HDR_LEN>len){
+            resp=ERR_PK_LEN;
+            break;
+          }
+          //handle record like a separate command
+          rec_resp=ARC_bus_cmd(addr,ptr[0],ptr+BUS_BATCH_REC_HDR_LEN,rec_len,flags,ptr[1]&BUS_BATCH_REC_NACK,1);
+          //report errors for record
+          ARC_bus_cmd_resp(addr,ptr[0],rec_resp,ptr[1]&BUS_BATCH_REC_NACK);
+          //next record
+          ptr+=rec_len+BUS_BATCH_REC_HDR_LEN;
+          len-=rec_len+BUS_BATCH_REC_HDR_LEN;
+        }
+      break;
+      default:
+      #ifdef CDH_LIB
+        if(cmd==CMD_SUB_POWERUP){
+          char vresp;
+          //check that the version fits, fragmented commands can be longer than one packet
+          if(len>BUS_VERSION_LEN){
+            resp=ERR_PK_LEN;
+            break;
+          }
+          //copy into temporary word aligned variable
+          memcpy(tmp,ptr,len);
+          //compare to version string
+          if((vresp=BUS_version_cmp((BUS_VERSION*)tmp,len))){
+              //version mismatch
+              report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_SUBSYSTEM_VERSION_MISMATCH,(((unsigned short)vresp)<<8)|addr);
+          }
+          //set length to zero
+          len=0;
+        }
+      #endif
+        //pass command to subsystem callbacks
+        resp=cmd_parse_dispatch(addr,cmd,ptr,len,flags,nack);
+      break;
+    }
+  return resp;
+}
+
+//check and handle a received packet
+static void ARC_bus_pk(I2C_PACKET *pk){
+  unsigned char len;
+  unsigned char addr,cmd,flags;
+  int resp;
+  unsigned char *ptr;
+  unsigned short crc;
+  //get len
+  len=pk->len;
+  //compute crc
+  crc=crc7(pk->dat,len-1);
+  //get length of payload
+  len=len-BUS_I2C_CRC_LEN-BUS_I2C_HDR_LEN;
+  //get sender address
+  addr=CMD_ADDR_MASK&pk->dat[0];
+  //get packet flags
+  flags=pk->flags;
+  //get command type
+  cmd=pk->dat[1];
+  //point to the first payload byte
+  ptr=&pk->dat[2];
+  //check crc for packet
+  if(ptr[len]==crc){
+    //handle command based on command type
+    resp=ARC_bus_cmd(addr,cmd,ptr,len,flags,pk->dat[0]&CMD_TX_NACK,0);
+    //report errors and send NACK
+    ARC_bus_cmd_resp(addr,cmd,resp,pk->dat[0]&CMD_TX_NACK);
+  }else{
+    //CRC failed, report error
+    report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_CMD_CRC,cmd);
+    //if command was not a NACK command send NACK
+    if(cmd!=CMD_NACK){
+      //send NACK
+      BUS_send_nack(addr,cmd,ERR_BAD_CRC);
+    }
+  }
+}
+
+//ARC bus Task, do ARC bus stuff
+static void ARC_bus_run(void *p) __toplevel{
+  unsigned int e;
+  unsigned short crc;
+  I2C_PACKET *pk;
+  unsigned short batch;
   SPI_addr=0;
+  SPI_buf=NULL;
   //Initialize ErrorLib
   error_recording_start();
   //init error request mutex
   ctl_mutex_init(&err_req.mutex);
   //initialize helper events
   ctl_events_init(&BUS_helper_events,0);
+  //start worker tasks for deferred callbacks
+  cmd_worker_init();
   //start helper task
   ctl_task_run(&ARC_bus_helper_task,BUS_PRI_ARCBUS_HELPER,ARC_bus_helper,NULL,"ARC_Bus_helper",sizeof(helper_stack)/sizeof(helper_stack[0])-2,helper_stack+1,0);
   //zero buffer busy count
   i2c_buf_busy_cnt=0;
   //event loop
   for(;;){
-    //wait for something to happen
-    e = ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS_WITH_AUTO_CLEAR,&BUS_INT_events,BUS_INT_EV_ALL,CTL_TIMEOUT_NONE,0);
+    //check if SPI data is being received
+    if(SPI_buf!=NULL && SPI_addr){
+      //wake up every tick to add received data to the CRC
+      e = ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS_WITH_AUTO_CLEAR,&BUS_INT_events,BUS_INT_EV_ALL,CTL_TIMEOUT_DELAY,1);
+      //add data received so far
+      SPI_crc_chase(&SPI_crc,arcBus_stat.spi_stat.len+BUS_SPI_CRC_LEN);
+    }else{
+      //wait for something to happen
+      e = ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS_WITH_AUTO_CLEAR,&BUS_INT_events,BUS_INT_EV_ALL,CTL_TIMEOUT_NONE,0);
+    }
     //check if buffer can be unlocked
     if(e&BUS_INT_EV_BUFF_UNLOCK){
-      SPI_buf=NULL;
       //unlock buffer
       BUS_free_buffer();
     }
@@ -216,480 +718,98 @@ static void ARC_bus_run(void *p) __toplevel{
         //assemble CRC
         crc=SPI_buf[arcBus_stat.spi_stat.len+1];//LSB
         crc|=(((unsigned short)SPI_buf[arcBus_stat.spi_stat.len])<<8);//MSB
-        //check CRC
-        if(crc!=crc16(SPI_buf,arcBus_stat.spi_stat.len)){
+        //check CRC, most of the data was added during the transfer
+        if(crc!=SPI_crc_finish(&SPI_crc)){
           //Bad CRC
-          //clear buffer pointer
-          SPI_buf=NULL;
-          //free buffer
-          BUS_free_buffer();
-          //send event
-          ctl_events_set_clear(&SUB_events,SUB_EV_SPI_ERR_CRC,0);
           //set return value for SPI complete packet
           arcBus_stat.spi_stat.nack=ERR_BAD_CRC;
+          //check for a registered destination
+          if(SPI_buf_idx<0){
+            //tell destination
+            BUS_SPI_dest_done(ERR_BAD_CRC);
+          }else{
+            //free buffer
+            BUS_buf_rx_free(SPI_buf_idx);
+            //send event
+            ctl_events_set_clear(&SUB_events,SUB_EV_SPI_ERR_CRC,0);
+          }
+        }else if(SPI_buf_idx<0){
+          //data is in place, tell destination
+          BUS_SPI_dest_done(RET_SUCCESS);
+          //set return value for SPI complete packet
+          arcBus_stat.spi_stat.nack=RET_SUCCESS;
         }else{
           //tell subsystem, SPI data received
-          //Subsystem must signal to free the buffer
-          ctl_events_set_clear(&SUB_events,SUB_EV_SPI_DAT,0);
+          //Subsystem must signal to free the buffer, the next transfer uses another buffer
+          BUS_buf_rx_ready(SPI_buf_idx,arcBus_stat.spi_stat.len);
           //set return value for SPI complete packet
           arcBus_stat.spi_stat.nack=RET_SUCCESS;
         }
+        //buffer now belongs to the subsystem
+        SPI_buf=NULL;
         //tell helper thread to send SPI complete command
         ctl_events_set_clear(&BUS_helper_events,BUS_HELPER_EV_SPI_COMPLETE_CMD,0);
       }
     }
     //check if an I2C command has been received
     if(e&BUS_INT_EV_I2C_CMD_RX){
-        //check if packet is complete
-        if(I2C_rx_buf[I2C_rx_out].stat!=I2C_PACKET_STAT_COMPLETE){
-            //report error
-            report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_RX_BUF_STAT,I2C_rx_buf[I2C_rx_out].stat);
-            //disable interrupts
-            ctl_global_interrupts_set(0);
-            //put UCB0 into reset state
-            UCB0CTL1|=UCSWRST;   
-            //initialize I2C packet queue to empty state
-            for(i=0;i<BUS_I2C_PACKET_QUEUE_LEN;i++){
-                I2C_rx_buf[i].stat=I2C_PACKET_STAT_EMPTY;
-            }
-            //I2C mutex init
-            ctl_mutex_init(&arcBus_stat.i2c_stat.mutex);
-            //set I2C to idle mode
-            arcBus_stat.i2c_stat.mode=BUS_I2C_IDLE;
-            //initialize I2C packet queue pointers
-            I2C_rx_in=I2C_rx_out=0;
-            //bring UCB0 out of reset state
-            UCB0CTL1&=~UCSWRST;
-            //re-enable interrupts
-            ctl_global_interrupts_enable();
-        }else{
+      //handle packets until the queue is empty or the batch limit is reached
+      //the event can be set when there is no packet left
+      //control commands are handled first so they are not delayed by bulk traffic
+      for(batch=0;batch<BUS_I2C_RX_BATCH_MAX;){
         //zero buffer busy count
         i2c_buf_busy_cnt=0;
-        //clear response
-        resp=0;
-        //get len
-        len=I2C_rx_buf[I2C_rx_out].len;
-        //compute crc
-        crc=crc7(I2C_rx_buf[I2C_rx_out].dat,len-1);
-        //get length of payload
-        len=len-BUS_I2C_CRC_LEN-BUS_I2C_HDR_LEN;
-        //get sender address
-        addr=CMD_ADDR_MASK&I2C_rx_buf[I2C_rx_out].dat[0];
-        //get packet flags
-        flags=I2C_rx_buf[I2C_rx_out].flags;
-        //get command type
-        cmd=I2C_rx_buf[I2C_rx_out].dat[1];
-        //point to the first payload byte
-        ptr=&I2C_rx_buf[I2C_rx_out].dat[2];
-        //check crc for packet
-        if(ptr[len]==crc){
-          //handle command based on command type
-          switch(cmd){
-            case CMD_SUB_ON:            
-                //check for proper length
-                if(len!=0){
-                  resp=ERR_PK_LEN;
-                }
-                //set new power status
-                powerState=SUB_PWR_ON;
-                //inform subsystem
-                ctl_events_set_clear(&SUB_events,SUB_EV_PWR_ON,0);
-            break;
-            case CMD_SUB_OFF:
-              //check to make sure that the command is directed to this subsystem
-              if(len==1 && BUS_OA_check(ptr[0])==RET_SUCCESS){
-                //set new power status
-                powerState=SUB_PWR_OFF;
-                //inform subsystem
-                ctl_events_set_clear(&SUB_events,SUB_EV_PWR_OFF,0);
-              }else{
-                //error with command
-                resp=ERR_BAD_PK;
-              }
-            break;
-            case CMD_SUB_STAT:
-              //check for proper length
-              if(len!=4){
-                resp=ERR_PK_LEN;
-              }                
-              #ifndef CDH_LIB //only update time on subsystem boards
-                  //assemble time from packet
-                  nt=ptr[3];
-                  nt|=((ticker)ptr[2])<<8;
-                  nt|=((ticker)ptr[1])<<16;
-                  nt|=((ticker)ptr[0])<<24;
-                  //update time
-                  ot=setget_ticker_time(nt);
-                  //tell subsystem to send status
-                  ctl_events_set_clear(&SUB_events,SUB_EV_SEND_STAT,0);
-                  //trigger any alarms that were skipped
-                  BUS_alarm_ticker_update(nt,ot);
-              #else
-                  //if CMD_SUB_STAT is recived by CDH, report an error
-                  report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_CDH_SUB_STAT_REC,addr);
-                  resp=ERR_ILLEAGLE_COMMAND;
-              #endif
-            break;
-            case CMD_RESET:          
-              //check for proper length
-              if(len!=0){
-                resp=ERR_PK_LEN;
-              }
-              //reset msp430
-              reset(ERR_LEV_INFO,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_RESET,0);
-              //code should never get here, report error
-              report_error(ERR_LEV_CRITICAL,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_RESET_FAIL,0);
-              break;
-            case CMD_SPI_RDY:
-              //check length
-              if(len!=2){
-                resp=ERR_PK_LEN;
-                break;
-              }
-              //assemble length
-              arcBus_stat.spi_stat.len=ptr[1];//LSB
-              arcBus_stat.spi_stat.len|=(((unsigned short)ptr[0])<<8);//MSB
-              //check length account for 16bit CRC
-              if(arcBus_stat.spi_stat.len+2>BUS_get_buffer_size()){
-                //length is too long
-                //cause NACK to be sent
-                resp=ERR_SPI_LEN;
-                break;
-              }
-              //check if already transmitting
-              if(SPI_buf!=NULL){
-                resp=ERR_SPI_BUSY;
-                break;
-              }
-              SPI_buf=BUS_get_buffer(CTL_TIMEOUT_NOW,0);
-              //check if buffer was locked
-              if(SPI_buf==NULL){
-                //buffer locked, set event
-                ctl_events_set_clear(&SUB_events,SUB_EV_SPI_ERR_BUSY,0);
-                //set response
-                resp=ERR_BUFFER_BUSY;
-                //stop SPI setup
-                break;
-              }
-              //disable DMA
-              DMA0CTL&=~DMAEN;
-              DMA1CTL&=~DMAEN;
-              DMA2CTL&=~DMAEN;
-              //save address of SPI slave
-              SPI_addr=addr;
-              //setup SPI structure
-              arcBus_stat.spi_stat.rx=SPI_buf;
-              arcBus_stat.spi_stat.tx=NULL;
-              //Setup SPI bus to exchange data as master
-              SPI_master_setup();
-              //============[setup DMA for transfer]============
-              //setup source trigger
-              DMACTL0 &=~(DMA0TSEL_31|DMA1TSEL_31);
-              DMACTL0 |= (DMA0TSEL__USCIA0RX|DMA1TSEL__USCIA0TX);
-              DMACTL1 = DMA2TSEL__USCIA0RX;
-              //DMA9 workaround, use a dummy channel with lower priority and the same trigger
-              //setup dummy channel: read and write from unused space in the SPI registers
-              *((unsigned int*)&DMA2SA) = EUSCI_A0_BASE + 0x02;
-              *((unsigned int*)&DMA2DA) = EUSCI_A0_BASE + 0x04;
-              // only one byte
-              DMA2SZ = 1;
-              // Configure the DMA transfer, repeated byte transfer with no increment
-              DMA2CTL = DMADT_4|DMASBDB|DMAEN|DMASRCINCR_0|DMADSTINCR_0;
-
-              // Source DMA address: receive register.
-              *((unsigned int*)&DMA0SA) = (unsigned short)(&UCA0RXBUF);
-              // Destination DMA address: rx buffer.
-              *((unsigned int*)&DMA0DA) = (unsigned short)SPI_buf;
-              // The size of the block to be transferred
-              DMA0SZ = arcBus_stat.spi_stat.len+BUS_SPI_CRC_LEN;
-              // Configure the DMA transfer, single byte transfer with destination increment
-              DMA0CTL = DMAIE|DMADT_0|DMASBDB|DMAEN|DMASRCINCR_0|DMADSTINCR_3;
-
-              // Source DMA address: SPI transmit buffer, constant data will be sent
-              *((unsigned int*)&DMA1SA) = (unsigned int)(&UCA0TXBUF);
-              // Destination DMA address: the transmit buffer.
-              *((unsigned int*)&DMA1DA) = (unsigned int)(&UCA0TXBUF);
-              // The size of the block to be transferred
-              DMA1SZ = arcBus_stat.spi_stat.len+BUS_SPI_CRC_LEN-1;
-              // Configure the DMA transfer, single byte transfer with no increment
-              DMA1CTL=DMADT_0|DMASBDB|DMAEN|DMASRCINCR_0|DMADSTINCR_0;
-              //write the Tx buffer to start transfer
-              UCA0TXBUF=BUS_SPI_DUMMY_DATA;
-            break;
-            
-            case CMD_SPI_ABORT:
-              //check length
-              if(len!=0){
-                resp=ERR_PK_LEN;
-                break;
-              }
-              //check SPI mode
-              if(arcBus_stat.spi_stat.mode!=BUS_SPI_MASTER){
-                resp=ERR_SPI_NOT_RUNNING;
-                break;
-              }
-              //check SPI address
-              if(SPI_addr!=addr){
-                resp=ERR_SPI_WRONG_ADDR;
-                break;
-              }
-              //disable DMA
-              DMA0CTL&=~DMAEN;
-              DMA1CTL&=~DMAEN;
-              DMA2CTL&=~DMAEN;
-              //turn off SPI
-              SPI_deactivate();              
-              //clear buffer pointer
-              SPI_buf=NULL;
-              //free buffer
-              BUS_free_buffer();
-              //clear address
-              SPI_addr=0;
-              //retport error
-              report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_SPI_ABORT,addr);
-            break;
-
-            case CMD_SPI_COMPLETE:
-              //check length
-              if(len!=1){
-                resp=ERR_PK_LEN;
-                break;
-              }
-#ifndef CDH_LIB
-              //check if a SPI transaction was in progress
-              if(arcBus_stat.spi_stat.mode!=BUS_SPI_SLAVE){
-#else
-              //check if a SPI transaction was in progress
-              if(arcBus_stat.spi_stat.mode!=BUS_SPI_MASTER && arcBus_stat.spi_stat.mode!=BUS_SPI_SLAVE){
-#endif
-                //SPI is in the wrong state so send busy error
-                resp=ERR_SPI_NOT_RUNNING;
-                //send NACK
-                break;
-              }
-
-              //check that the command came from the correct subsystem
-              if(arcBus_stat.spi_stat.mode==BUS_SPI_MASTER && SPI_addr!=addr){
-                  //wrong address sent for complete command
-                  resp=ERR_SPI_WRONG_ADDR;
-                  //send NACK
-                  break;
-              }
-              //disable DMA
-              DMA0CTL&=~DMAEN;
-              DMA1CTL&=~DMAEN;
-              DMA2CTL&=~DMAEN;
-              //turn off SPI
-              SPI_deactivate();
-              //SPI transfer is done, see if there was an error
-              arcBus_stat.spi_stat.nack=ptr[0];
-              //notify CDH board
-#ifndef CDH_LIB
-              ctl_events_set_clear(&BUS_helper_events,BUS_HELPER_EV_SPI_CLEAR_CMD,0);
-#endif
-              //notify calling task
-              ctl_events_set_clear(&arcBus_stat.events,BUS_EV_SPI_COMPLETE,0);
-            break;
-            case CMD_ASYNC_SETUP:
-              //check length
-              if(len!=1){
-                resp=ERR_PK_LEN;
-                break;
-              }
-              switch(ptr[0]){
-                case ASYNC_OPEN:
-                  //open remote connection
-                  async_open_remote(addr);
-                break;
-                case ASYNC_CLOSE:
-                  //check if sending address corosponds to async address
-                  if(async_addr!=addr){
-                    //report error
-                    report_error(ERR_LEV_ERROR,BUS_ERR_SRC_ASYNC,ASYNC_ERR_CLOSE_WRONG_ADDR,(((unsigned short)addr)<<8)|async_addr);
-                    break;
-                  }
-                  //tell helper thread to close connection
-                  ctl_events_set_clear(&BUS_helper_events,BUS_HELPER_EV_ASYNC_CLOSE,0);
-                break;
-              }
-            break;
-            case CMD_ASYNC_DAT:
-              //post bytes to queue
-              ctl_byte_queue_post_multi_nb(&async_rxQ,len,ptr);
-            break;
-            case CMD_NACK:
-              //TODO: handle this better somehow?
-              //check length
-              if(len!=2){
-                resp=ERR_PK_LEN;
-                break;
-              }
-              //set event 
-              ctl_events_set_clear(&arcBus_stat.events,BUS_EV_CMD_NACK,0);
-              //report error
-              report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_NACK_REC,(((unsigned short)ptr[0])<<8)|((unsigned short)ptr[1]));
-              //check which packet was nacked
-              switch(ptr[0]){
-                  case CMD_SPI_RDY:
-                    //set SPI nack reason
-                    arcBus_stat.spi_stat.nack=ptr[1];
-                    //send event to spi code
-                    ctl_events_set_clear(&arcBus_stat.events,BUS_EV_SPI_NACK,0);
-                  break;
-              }
-            break;
-            case CMD_ERR_REQ:
-              if(len<1){
-                resp=ERR_PK_LEN;
-                break;
-              }
-              if(!ctl_mutex_lock(&err_req.mutex,CTL_TIMEOUT_NOW,0)){
-                resp=ERR_BUSY;
-                break;
-              }
-              //request type
-              err_req.type=ptr[0];
-              //address to send data to
-              err_req.dest=addr;
-              switch(ptr[0]){
-                case ERR_REQ_REPLAY:
-                    err_req.size=(((unsigned short)ptr[1])<<8)|((unsigned short)ptr[2]);
-                    err_req.level=ptr[3];
-                break;
-                default:
-                    resp=ERR_INVALID_ARGUMENT;
-                break;
-              }
-              //check if the packet was parsed
-              if(!resp){
-                //send event to process request
-                ctl_events_set_clear(&BUS_helper_events,BUS_HELPER_EV_ERR_REQ,0);
-              }
-            ctl_mutex_unlock(&err_req.mutex);
-            break;
-            case CMD_PING:
-                //this is a dummy command that does nothing
-            break;
-            default:
-            #ifdef CDH_LIB
-              if(cmd==CMD_SUB_POWERUP){
-                char vresp;
-                //copy into temporary word aligned variable
-                memcpy(tmp,ptr,len);
-                //compare to version string
-                if((vresp=BUS_version_cmp((BUS_VERSION*)tmp,len))){
-                    //version mismatch
-                    report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_SUBSYSTEM_VERSION_MISMATCH,(((unsigned short)vresp)<<8)|addr);
-                }
-                //set length to zero
-                len=0;
-              }
-            #endif
-              //get callback structure list
-              parse_ptr=cmd_parse_list;
-              //get mask from packet flags
-              parse_mask=flags;
-              //set response to unknown command
-              resp=ERR_UNKNOWN_CMD;
-              //loop through list and check for commands
-              while(parse_ptr!=NULL && ((BUS_FLAGS_SW_GC|CMD_PARSE_GC_ADDR)&parse_mask || resp==ERR_UNKNOWN_CMD)){                
-                //check for general call command
-                if((BUS_FLAGS_SW_GC|CMD_PARSE_GC_ADDR)&parse_mask){
-                  //check for the sender of a software GC
-                  if((BUS_FLAGS_SW_GC&parse_mask) && parse_ptr->flags&(parse_mask&(~BUS_FLAGS_SW_GC))){
-                    //this callback handles the software GC address that sent the packet, skip this callback
-                  }else{
-                    //check if this callback handles GC addresses
-                    if(CMD_PARSE_GC_ADDR&parse_ptr->flags){
-                      int tmp_resp;
-                      //check for subsystem command
-                      tmp_resp=parse_ptr->cb(addr,cmd,ptr,len,flags);
-                      //overwrite resp if resp is not success
-                      if(resp!=RET_SUCCESS){
-                        resp=tmp_resp;
-                      }
-                    }
-                  }
-                }else{//not a general call command, find the right callback
-                  //check if flags match
-                  if(parse_ptr->flags&parse_mask){
-                    //check for subsystem command
-                    resp=parse_ptr->cb(addr,cmd,ptr,len,flags);
-                  }
-                }
-                //get next callback structure
-                parse_ptr=parse_ptr->next;
-              }
-            break;
-          }
-          //check if command was recognized
-          if(resp!=0){
-            report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_BAD_CMD,(((unsigned short)resp)<<8)|((unsigned short)cmd));
-            //check packet to see if NACK should be sent
-            if(I2C_rx_buf[I2C_rx_out].dat[0]&CMD_TX_NACK){
-              //check NACK address to see if a nack can be sent
-              if(nack_info.addr==0){
-                //set address
-                nack_info.addr=addr;
-                //setup command
-                ptr=BUS_cmd_init(nack_info.dat,CMD_NACK);
-                //sent command
-                *ptr++=cmd;
-                //send NACK reason
-                *ptr++=resp;
-                //tell helper thread to send packet
-                ctl_events_set_clear(&BUS_helper_events,BUS_HELPER_EV_NACK,0);
-              }else{
-                //can't send nack, report error
-                report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_NACK_BUSY,(((unsigned short)addr)<<8)|resp);
-              }
-            }
-          }
+        //check control lane
+        if((pk=I2C_rx_ctl_peek())!=NULL){
+          //handle packet
+          ARC_bus_pk(pk);
+          //done with packet, give it back to the ISR
+          I2C_rx_ctl_done();
+        }else if((pk=BUS_bcast_peek())!=NULL){
+          //handle general call packet sent by this board
+          ARC_bus_pk(pk);
+          //done with packet, release the shared frame
+          BUS_bcast_done();
+        }else if((pk=I2C_rx_peek())!=NULL){
+          //handle packet
+          ARC_bus_pk(pk);
+          //done with packet, give it back to the ISR
+          I2C_rx_done();
         }else{
-          //CRC failed, report error
-          report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_CMD_CRC,cmd);
-          //if command was not a NACK command send NACK
-          if(cmd!=CMD_NACK){
-            //check NACK address to see if a nack can be sent
-            if(nack_info.addr==0){
-              //set address
-              nack_info.addr=addr;
-              //setup command
-              ptr=BUS_cmd_init(nack_info.dat,CMD_NACK);
-              //sent command
-              *ptr++=cmd;
-              //send NACK reason
-              *ptr++=ERR_BAD_CRC;
-              //tell helper thread to send packet
-              ctl_events_set_clear(&BUS_helper_events,BUS_HELPER_EV_NACK,0);
-            }else{
-              //can't send nack, report error
-              report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_NACK_BUSY,(((unsigned short)addr)<<8)|ERR_BAD_CRC);
-            }
-          }
-        }
-        //done with packet set status
-        I2C_rx_buf[I2C_rx_out].stat=I2C_PACKET_STAT_EMPTY;
-        //increment index
-        I2C_rx_out++;
-        //check for wraparound
-        if(I2C_rx_out>=BUS_I2C_PACKET_QUEUE_LEN){
-          I2C_rx_out=0;
+          //all lanes are empty
+          break;
         }
-        //check next packet status
-        if(I2C_rx_buf[I2C_rx_out].stat==I2C_PACKET_STAT_COMPLETE){   
-          //There is still a packet set event again
-          ctl_events_set_clear(&BUS_INT_events,BUS_INT_EV_I2C_CMD_RX,0);
+        //count packet
+        batch++;
+        //check if a task is waiting on another event
+        if(BUS_INT_events&BUS_INT_EV_URGENT){
+          //stop so other events are not delayed by a long burst
+          break;
         }
       }
+      //save batch size
+      I2C_rx_batch(batch);
+      //tell senders to start again if they were stopped
+      BUS_link_rx_check();
+      //check for another packet
+      if(I2C_rx_ctl_peek()!=NULL || BUS_bcast_peek()!=NULL || I2C_rx_peek()!=NULL){   
+        //There is still a packet set event again
+        ctl_events_set_clear(&BUS_INT_events,BUS_INT_EV_I2C_CMD_RX,0);
+      }
     }
     //check for errors and report
     if(e&BUS_INT_EV_I2C_RX_BUSY){
       report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_I2C_RX_BUSY,0);
+      //tell senders to stop until there is space
+      BUS_link_rx_busy();
+      //save time of first error since a packet was handled
+      if(i2c_buf_busy_cnt==0){
+        i2c_buf_busy_time=ctl_get_current_time();
+      }
       //keep track of rx busy errors
       i2c_buf_busy_cnt++;
-      //check for too many errors
-      if(i2c_buf_busy_cnt>MAX_I2C_BUF_BUSY){
+      //only reset if no packets have been handled for a long time, packets are being handled during bursts
+      if(i2c_buf_busy_cnt>MAX_I2C_BUF_BUSY && (ctl_get_current_time()-i2c_buf_busy_time)>BUS_I2C_RX_STALL_TIME){
         reset(ERR_LEV_CRITICAL,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_I2C_RX_BUSY_CNT,i2c_buf_busy_cnt);
       }
     }
@@ -783,6 +903,20 @@ static void ARC_bus_helper(void *p) __toplevel{
         report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_SPI_CLEAR_FAIL,resp);
       }
     }
+    //stream segment received
+    if(e&BUS_HELPER_EV_SPI_STREAM){
+      //pass segments to the sink
+      BUS_SPI_stream_consume();
+    }
+    //stream segment took too long
+    if(e&BUS_HELPER_EV_SPI_STREAM_TIMEOUT){
+      //stop the stream if the segment is still running
+      BUS_SPI_stream_timeout();
+    }
+    //batch timer timed out, send batch packets
+    if(e&BUS_HELPER_EV_BATCH_FLUSH){
+      BUS_batch_flush();
+    }
     if(e&BUS_HELPER_EV_ASYNC_CLOSE){      
       //close async connection
       async_close_remote();
@@ -837,23 +971,6 @@ static void ARC_bus_helper(void *p) __toplevel{
           report_error(ERR_LEV_ERROR,BUS_ERR_SRC_ERR_REQ,ERR_REQ_ERR_MUTEX_TIMEOUT,0);
         }
     }
-    if(e&BUS_HELPER_EV_NACK){
-      //double check address
-      if(nack_info.addr){
-        //send the command
-        resp=BUS_cmd_tx(nack_info.addr,nack_info.dat,2,0);
-        //check response
-        if(resp!=RET_SUCCESS){
-          //error sending packet, report error
-          report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_TX_NACK_FAIL,resp);
-        }
-        //clear the address
-        nack_info.addr=0;
-      }else{
-        //no nack packet? report error
-        report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_UNEXPECTED_NACK_EV,0);
-      }
-    }
   }
 }
 
@@ -0,0 +1,166 @@
+#include <stddef.h>
+#include "ring.h"
+
+//initialize ring indexes
+void BUS_ring_init(BUS_RING *ring,unsigned short size){
+  ring->in=ring->out=0;
+  //size is a power of two so mask is one less
+  ring->mask=size-1;
+  //clear counters
+  ring->hwm=0;
+  ring->full=0;
+}
+
+//return the number of slots in use
+unsigned short BUS_ring_used(const BUS_RING *ring){
+  //indexes are free running so the difference is the number of slots used
+  return (unsigned short)(ring->in-ring->out);
+}
+
+//return the index of the slot to fill or -1 if the ring is full
+short BUS_ring_prod_slot(BUS_RING *ring){
+  unsigned short in=ring->in;
+  //check if all slots are in use
+  if((unsigned short)(in-ring->out)>ring->mask){
+    //count full events
+    ring->full++;
+    return -1;
+  }
+  //return slot index
+  return in&ring->mask;
+}
+
+//make the filled slot visible to the consumer
+void BUS_ring_publish(BUS_RING *ring){
+  unsigned short used;
+  //make sure slot contents are written before the index
+  BUS_RING_BARRIER();
+  //advance producer index
+  ring->in++;
+  //update high water mark
+  used=ring->in-ring->out;
+  if(used>ring->hwm){
+    ring->hwm=used;
+  }
+}
+
+//return the index of the oldest published slot or -1 if the ring is empty
+short BUS_ring_cons_slot(const BUS_RING *ring){
+  unsigned short out=ring->out;
+  //check for empty ring
+  if(ring->in==out){
+    return -1;
+  }
+  //make sure slot contents are read after the index
+  BUS_RING_BARRIER();
+  //return slot index
+  return out&ring->mask;
+}
+
+//return the oldest slot to the producer
+void BUS_ring_consume(BUS_RING *ring){
+  //make sure slot contents are read before the slot is given back
+  BUS_RING_BARRIER();
+  //advance consumer index
+  ring->out++;
+}
+
+//initialize arena
+void BUS_arena_init(BUS_ARENA *arena,unsigned char *buf,unsigned short size){
+  arena->buf=buf;
+  arena->in=arena->out=0;
+  //size is a power of two so mask is one less
+  arena->mask=size-1;
+  arena->pad=0;
+  arena->rec_in=arena->rec_out=0;
+  //clear counters
+  arena->hwm=0;
+  arena->full=0;
+}
+
+//return the number of records in use
+unsigned short BUS_arena_used(const BUS_ARENA *arena){
+  return (unsigned short)(arena->rec_in-arena->rec_out);
+}
+
+//reserve contiguous space for a record of up to max bytes
+unsigned char *BUS_arena_reserve(BUS_ARENA *arena,unsigned short max){
+  unsigned short idx=arena->in&arena->mask;
+  //bytes left before the end of the buffer
+  unsigned short contig=arena->mask+1-idx;
+  //free bytes in the buffer
+  unsigned short free=arena->mask+1-(unsigned short)(arena->in-arena->out);
+  //add space for length byte
+  max+=1;
+  //check if the record fits before the end of the buffer
+  if(contig<max){
+    //pad to the end and put the record at the start
+    arena->pad=contig;
+  }else{
+    arena->pad=0;
+  }
+  //check for enough free space
+  if(free<arena->pad+max){
+    //count full events
+    arena->full++;
+    return NULL;
+  }
+  //return record location after length byte
+  return &arena->buf[((arena->in+arena->pad)&arena->mask)+1];
+}
+
+//make the reserved record visible to the consumer
+void BUS_arena_publish(BUS_ARENA *arena,unsigned char len){
+  unsigned short used;
+  //check if padding is needed
+  if(arena->pad){
+    //mark padding
+    arena->buf[arena->in&arena->mask]=0;
+  }
+  //set record length
+  arena->buf[(arena->in+arena->pad)&arena->mask]=len;
+  //make sure record contents are written before the index
+  BUS_RING_BARRIER();
+  //advance producer index past padding, length and record
+  arena->in+=arena->pad+1+len;
+  arena->pad=0;
+  //count records
+  arena->rec_in++;
+  //update high water mark
+  used=arena->rec_in-arena->rec_out;
+  if(used>arena->hwm){
+    arena->hwm=used;
+  }
+}
+
+//return the oldest published record or NULL if the arena is empty
+unsigned char *BUS_arena_peek(BUS_ARENA *arena){
+  unsigned short idx;
+  for(;;){
+    //check for empty arena
+    if(arena->in==arena->out){
+      return NULL;
+    }
+    //make sure record contents are read after the index
+    BUS_RING_BARRIER();
+    idx=arena->out&arena->mask;
+    //check for padding
+    if(arena->buf[idx]!=0){
+      //return record after length byte
+      return &arena->buf[idx+1];
+    }
+    //skip padding to the start of the buffer
+    arena->out+=arena->mask+1-idx;
+  }
+}
+
+//return the space used by the oldest record to the producer
+void BUS_arena_consume(BUS_ARENA *arena){
+  unsigned char len=arena->buf[arena->out&arena->mask];
+  //make sure record contents are read before the space is given back
+  BUS_RING_BARRIER();
+  //count records
+  arena->rec_out++;
+  //advance consumer index past length and record
+  arena->out+=1+len;
+}
@@ -0,0 +1,90 @@
+#ifndef __RING_H
+#define __RING_H
+
+//Single producer, single consumer ring indexes and byte arenas
+//The ring only manages indexes, the caller owns the storage for the slots.
+//The arena packs variable length records into a caller supplied byte buffer.
+//Only the producer writes in and only the consumer writes out so no locking is needed.
+//This file does not depend on the MSP430 or CTL headers so it can be built on the host
+
+//barrier used to order slot accesses against index updates
+#ifdef __GNUC__
+  #define BUS_RING_BARRIER()    __sync_synchronize()
+#else
+  //call to a function in another file so the compiler can not move memory accesses across it
+  #define BUS_RING_BARRIER()    BUS_ring_barrier()
+#endif
+
+//ring index structure
+typedef struct{
+  //producer index, free running, only written by the producer
+  volatile unsigned short in;
+  //consumer index, free running, only written by the consumer
+  volatile unsigned short out;
+  //mask for slot index, number of slots must be a power of two
+  unsigned short mask;
+  //maximum number of slots that have been in use, written by the producer
+  volatile unsigned short hwm;
+  //number of times the producer found the ring full, written by the producer
+  volatile unsigned short full;
+}BUS_RING;
+
+//byte arena structure
+//records are stored as a length byte followed by the record, records never wrap
+//a length byte of zero marks padding to the end of the buffer
+typedef struct{
+  //buffer for records
+  unsigned char *buf;
+  //producer byte index, free running, only written by the producer
+  volatile unsigned short in;
+  //consumer byte index, free running, only written by the consumer
+  volatile unsigned short out;
+  //mask for byte index, size must be a power of two
+  unsigned short mask;
+  //padding needed before the reserved record, only used by the producer
+  unsigned short pad;
+  //records published and consumed, used to count records in use
+  volatile unsigned short rec_in,rec_out;
+  //maximum number of records that have been in use, written by the producer
+  volatile unsigned short hwm;
+  //number of times the producer found the arena full, written by the producer
+  volatile unsigned short full;
+}BUS_ARENA;
+
+//compiler barrier for compilers that don't have one
+//defined in ring_barrier.c, it must not be in the same file as its callers or it can be inlined away
+void BUS_ring_barrier(void);
+
+//initialize ring indexes, size must be a power of two
+void BUS_ring_init(BUS_RING *ring,unsigned short size);
+
+//return the number of slots in use
+unsigned short BUS_ring_used(const BUS_RING *ring);
+
+//producer : return the index of the slot to fill or -1 if the ring is full
+short BUS_ring_prod_slot(BUS_RING *ring);
+//producer : make the filled slot visible to the consumer
+void BUS_ring_publish(BUS_RING *ring);
+
+//consumer : return the index of the oldest published slot or -1 if the ring is empty
+short BUS_ring_cons_slot(const BUS_RING *ring);
+//consumer : return the oldest slot to the producer
+void BUS_ring_consume(BUS_RING *ring);
+
+//initialize arena, size must be a power of two
+void BUS_arena_init(BUS_ARENA *arena,unsigned char *buf,unsigned short size);
+
+//return the number of records in use
+unsigned short BUS_arena_used(const BUS_ARENA *arena);
+
+//producer : reserve contiguous space for a record of up to max bytes, returns NULL if there is not enough space
+unsigned char *BUS_arena_reserve(BUS_ARENA *arena,unsigned short max);
+//producer : make the reserved record visible to the consumer, len is the number of bytes actually used
+void BUS_arena_publish(BUS_ARENA *arena,unsigned char len);
+
+//consumer : return the oldest published record or NULL if the arena is empty
+unsigned char *BUS_arena_peek(BUS_ARENA *arena);
+//consumer : return the space used by the oldest record to the producer
+void BUS_arena_consume(BUS_ARENA *arena);
+
+#endif
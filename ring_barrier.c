@@ -0,0 +1,6 @@
+#include "ring.h"
+
+//compiler barrier, kept apart from the ring code so the call can not be inlined
+//the compiler must assume the call reads and writes any memory
+void BUS_ring_barrier(void){
+}
@@ -0,0 +1,253 @@
+#include <ctl.h>
+#include <msp430.h>
+#include <string.h>
+#include "ARCbus.h"
+
+#include "ARCbus_internal.h"
+
+//request that this task is handling, each worker task has its own
+static __thread BUS_RPC_CTX BUS_rpc_ctx;
+
+//requests waiting for a response
+static BUS_RPC *BUS_rpc_pending[BUS_RPC_MAX];
+//sequence number for the next request
+static unsigned char BUS_rpc_seq=0;
+
+//initialize pending request table
+void BUS_rpc_init(void){
+  int i;
+  for(i=0;i<BUS_RPC_MAX;i++){
+    BUS_rpc_pending[i]=NULL;
+  }
+}
+
+//remove a request from the pending table
+static void BUS_rpc_remove(BUS_RPC *rpc){
+  int i,en;
+  //disable interrupts so the table is not changed while searching
+  en=ctl_global_interrupts_disable();
+  for(i=0;i<BUS_RPC_MAX;i++){
+    if(BUS_rpc_pending[i]==rpc){
+      BUS_rpc_pending[i]=NULL;
+      break;
+    }
+  }
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+}
+
+//send a request and return without waiting for the response
+int BUS_call_start(BUS_RPC *rpc,unsigned char addr,unsigned char cmd,const void *args,unsigned short len,void *reply,unsigned short size){
+  unsigned char hdr[BUS_RPC_HDR_LEN];
+  BUS_IOVEC iov[2];
+  int i,en,resp;
+  //responses from the general call address can not be matched
+  if(addr==BUS_ADDR_GC){
+    return ERR_BAD_ADDR;
+  }
+  //check that the request fits in one packet
+  if(len>BUS_I2C_MAX_PACKET_LEN-BUS_RPC_HDR_LEN){
+    return ERR_PACKET_TOO_LONG;
+  }
+  //setup request
+  rpc->addr=addr;
+  rpc->cmd=cmd;
+  rpc->reply=reply;
+  rpc->size=size;
+  rpc->len=0;
+  rpc->status=0;
+  rpc->done=0;
+  ctl_events_init(&rpc->e,0);
+  //disable interrupts so the table and sequence number are changed together
+  en=ctl_global_interrupts_disable();
+  //find a free slot
+  for(i=0;i<BUS_RPC_MAX;i++){
+    if(BUS_rpc_pending[i]==NULL){
+      //get sequence number
+      rpc->seq=BUS_rpc_seq++;
+      //add to table
+      BUS_rpc_pending[i]=rpc;
+      break;
+    }
+  }
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  //check if table is full
+  if(i>=BUS_RPC_MAX){
+    return ERR_BUSY;
+  }
+  //request header is the command and sequence number
+  hdr[0]=cmd;
+  hdr[1]=rpc->seq;
+  iov[0].ptr=hdr;
+  iov[0].len=BUS_RPC_HDR_LEN;
+  //arguments follow the header
+  iov[1].ptr=args;
+  iov[1].len=len;
+  //send request, the response is used instead of a NACK
+  if((resp=BUS_cmd_txv(addr,CMD_RPC_REQ,iov,2,0))!=RET_SUCCESS){
+    //request was not sent, no response will come
+    BUS_rpc_remove(rpc);
+    return resp;
+  }
+  return RET_SUCCESS;
+}
+
+//wait for the response to a request started with BUS_call_start
+int BUS_call_wait(BUS_RPC *rpc,CTL_TIMEOUT_t t,CTL_TIME_t timeout){
+  //the response is handled by the ARCbus task so it can not wait
+  if(ctl_task_executing==&ARC_bus_task){
+    BUS_rpc_remove(rpc);
+    return ERR_INVALID_ARGUMENT;
+  }
+  //wait for response
+  if(!ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS,&rpc->e,BUS_RPC_EV_DONE,t,timeout)){
+    //no response, remove request so a late response is ignored
+    BUS_rpc_remove(rpc);
+    //the response could have come before the request was removed
+    if(!rpc->done){
+      return ERR_TIMEOUT;
+    }
+  }
+  //check if the command failed
+  if(rpc->status!=0){
+    return ERR_CMD_NACK;
+  }
+  return RET_SUCCESS;
+}
+
+//send a request and wait for the response
+int BUS_call(unsigned char addr,unsigned char cmd,const void *args,unsigned short len,void *reply,unsigned short *reply_len,CTL_TIME_t timeout){
+  BUS_RPC rpc;
+  int resp;
+  //send request
+  if((resp=BUS_call_start(&rpc,addr,cmd,args,len,reply,(reply_len!=NULL)?*reply_len:0))!=RET_SUCCESS){
+    return resp;
+  }
+  //wait for response
+  resp=BUS_call_wait(&rpc,CTL_TIMEOUT_DELAY,timeout);
+  //return response length
+  if(reply_len!=NULL){
+    *reply_len=rpc.len;
+  }
+  return resp;
+}
+
+//handle a response packet, called from the ARCbus task
+int BUS_rpc_resp_rx(unsigned char addr,const unsigned char *dat,unsigned short len){
+  BUS_RPC *rpc=NULL;
+  int i,en;
+  //check for response header
+  if(len<BUS_RPC_HDR_LEN){
+    return ERR_PK_LEN;
+  }
+  //disable interrupts so the request is not removed while it is being found
+  en=ctl_global_interrupts_disable();
+  //find the request the response belongs to
+  for(i=0;i<BUS_RPC_MAX;i++){
+    if(BUS_rpc_pending[i]!=NULL && BUS_rpc_pending[i]->addr==addr && BUS_rpc_pending[i]->seq==dat[0]){
+      rpc=BUS_rpc_pending[i];
+      //remove from table
+      BUS_rpc_pending[i]=NULL;
+      break;
+    }
+  }
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  //check for a match
+  if(rpc==NULL){
+    //request timed out or the response is a duplicate
+    return RET_SUCCESS;
+  }
+  //get status
+  rpc->status=dat[1];
+  //get reply length
+  len-=BUS_RPC_HDR_LEN;
+  //check if reply fits in buffer
+  if(len>rpc->size){
+    len=rpc->size;
+  }
+  //copy reply
+  if(len>0){
+    memcpy(rpc->reply,dat+BUS_RPC_HDR_LEN,len);
+  }
+  rpc->len=len;
+  rpc->done=1;
+  //wake up the caller
+  ctl_events_set_clear(&rpc->e,BUS_RPC_EV_DONE,0);
+  return RET_SUCCESS;
+}
+
+//send a response for a request
+static int BUS_rpc_send(const BUS_RPC_CTX *ctx,unsigned char status,const void *dat,unsigned short len){
+  unsigned char buf[BUS_I2C_HDR_LEN+BUS_I2C_MAX_PACKET_LEN+BUS_I2C_CRC_LEN],*ptr;
+  int resp;
+  //setup command
+  ptr=BUS_cmd_init(buf,CMD_RPC_RESP);
+  //response header is the sequence number and status
+  *ptr++=ctx->seq;
+  *ptr++=status;
+  //copy reply
+  memcpy(ptr,dat,len);
+  //queue packet, the ARCbus task must not wait for the bus
+  if((resp=BUS_cmd_tx_async(ctx->addr,buf,len+BUS_RPC_HDR_LEN,0,NULL))!=RET_SUCCESS){
+    //can't send response, report error
+    report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_RPC_RESP_FAIL,(((unsigned short)ctx->addr)<<8)|ctx->seq);
+  }
+  return resp;
+}
+
+//send the reply for the request being handled, only call from a command callback
+int BUS_rpc_reply(const void *dat,unsigned short len){
+  //check that the callback is handling a request
+  if(BUS_rpc_ctx.state!=BUS_RPC_CTX_OPEN){
+    return ERR_INVALID_ARGUMENT;
+  }
+  //check length
+  if(len>BUS_RPC_MAX_REPLY){
+    return ERR_PACKET_TOO_LONG;
+  }
+  //only one response is sent
+  BUS_rpc_ctx.state=BUS_RPC_CTX_DONE;
+  return BUS_rpc_send(&BUS_rpc_ctx,0,dat,len);
+}
+
+//start handling a request in this task
+void BUS_rpc_begin(unsigned char addr,unsigned char seq){
+  BUS_rpc_ctx.addr=addr;
+  BUS_rpc_ctx.seq=seq;
+  BUS_rpc_ctx.state=BUS_RPC_CTX_OPEN;
+}
+
+//pass the request being handled to another task, ctx is set to none if there is no request
+void BUS_rpc_take(BUS_RPC_CTX *ctx){
+  //copy request
+  *ctx=BUS_rpc_ctx;
+  //the other task sends the response
+  if(BUS_rpc_ctx.state==BUS_RPC_CTX_OPEN){
+    BUS_rpc_ctx.state=BUS_RPC_CTX_DONE;
+  }else{
+    ctx->state=BUS_RPC_CTX_NONE;
+  }
+}
+
+//continue handling a request passed with BUS_rpc_take
+void BUS_rpc_resume(const BUS_RPC_CTX *ctx){
+  BUS_rpc_ctx=*ctx;
+}
+
+//done handling a request, sends a response with the status if the callback did not reply
+void BUS_rpc_end(int resp){
+  //check if a response is needed
+  if(BUS_rpc_ctx.state==BUS_RPC_CTX_OPEN){
+    BUS_rpc_send(&BUS_rpc_ctx,resp,NULL,0);
+  }
+  //not handling a request
+  BUS_rpc_ctx.state=BUS_RPC_CTX_NONE;
+}
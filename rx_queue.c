@@ -0,0 +1,354 @@
+#include <ctl.h>
+#include <msp430.h>
+#include <stddef.h>
+#include <string.h>
+#include "ARCbus.h"
+
+#include "ARCbus_internal.h"
+
+//batch counters, only written by the ARCbus task
+static struct{
+  unsigned long wakeups;
+  unsigned long packets;
+  unsigned short last;
+  unsigned short max;
+}I2C_rx_batch_stat;
+
+//buffer for bus control commands
+static I2C_PACKET I2C_rx_ctl_buf[BUS_I2C_CTL_QUEUE_LEN];
+//ring indexes for the control lane
+//the I2C ISR is the producer and the ARCbus task is the consumer
+static BUS_RING I2C_rx_ctl_ring;
+
+static void I2C_rx_publish(I2C_PACKET *pk);
+
+//nonzero while a reassembled message is parsed, only used by the ARCbus task
+unsigned char BUS_cmd_no_hold=0;
+
+//initialize control lane to empty state
+static void I2C_rx_ctl_init(void){
+  BUS_ring_init(&I2C_rx_ctl_ring,BUS_I2C_CTL_QUEUE_LEN);
+}
+
+//check if a packet is a command that is handled by the bus and used for bus control
+static int I2C_rx_is_ctl(const I2C_PACKET *pk){
+  switch(pk->dat[1]){
+    case CMD_NACK:
+    case CMD_RESET:
+    case CMD_SPI_RDY:
+    case CMD_SPI_RDY_TYPE:
+    case CMD_SPI_COMPLETE:
+    case CMD_SPI_ABORT:
+    case CMD_SPI_STREAM:
+    case CMD_CREDIT:
+    case CMD_RPC_RESP:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+//publish the packet returned by I2C_rx_start
+void I2C_rx_commit(I2C_PACKET *pk){
+  I2C_PACKET *ctl;
+  short idx;
+  //check for a bus control command
+  if(I2C_rx_is_ctl(pk)){
+    //get free slot in control lane
+    idx=BUS_ring_prod_slot(&I2C_rx_ctl_ring);
+    //check if control lane is full
+    if(idx>=0){
+      ctl=&I2C_rx_ctl_buf[idx];
+      //copy packet
+      ctl->len=pk->len;
+      ctl->flags=pk->flags;
+      memcpy(ctl->dat,pk->dat,pk->len);
+      //publish packet
+      BUS_ring_publish(&I2C_rx_ctl_ring);
+      //the bulk packet is not published so it is reused for the next packet
+      return;
+    }
+    //control lane is full, packet goes in bulk queue
+  }
+  I2C_rx_publish(pk);
+}
+
+//get the oldest control command packet, returns NULL if the control lane is empty
+I2C_PACKET *I2C_rx_ctl_peek(void){
+  short idx;
+  //get oldest slot
+  idx=BUS_ring_cons_slot(&I2C_rx_ctl_ring);
+  //check if lane is empty
+  if(idx<0){
+    return NULL;
+  }
+  return &I2C_rx_ctl_buf[idx];
+}
+
+//done with the packet returned by I2C_rx_ctl_peek
+void I2C_rx_ctl_done(void){
+  BUS_ring_consume(&I2C_rx_ctl_ring);
+}
+
+//record the number of packets handled on one wakeup
+void I2C_rx_batch(unsigned short n){
+  //count wakeups and packets
+  I2C_rx_batch_stat.wakeups++;
+  I2C_rx_batch_stat.packets+=n;
+  //save batch size
+  I2C_rx_batch_stat.last=n;
+  //update maximum batch size
+  if(n>I2C_rx_batch_stat.max){
+    I2C_rx_batch_stat.max=n;
+  }
+}
+
+//copy batch counters into stats structure
+static void I2C_rx_batch_stats(BUS_RX_STATS *stats){
+  stats->wakeups=I2C_rx_batch_stat.wakeups;
+  stats->packets=I2C_rx_batch_stat.packets;
+  stats->batch_last=I2C_rx_batch_stat.last;
+  stats->batch_max=I2C_rx_batch_stat.max;
+  //control lane counters
+  stats->ctl_used=BUS_ring_used(&I2C_rx_ctl_ring);
+  stats->ctl_hwm=I2C_rx_ctl_ring.hwm;
+  stats->ctl_full=I2C_rx_ctl_ring.full;
+  //shared frame counters
+  BUS_bcast_stats(stats);
+}
+
+#ifdef BUS_I2C_RX_ARENA
+
+//storage for the receive arena
+static unsigned char I2C_rx_arena_buf[BUS_I2C_RX_ARENA_SIZE];
+//arena for ISR command receive
+//the I2C ISR is the producer and the ARCbus task is the consumer
+BUS_ARENA I2C_rx_arena;
+
+//initialize I2C receive queue to empty state
+void I2C_rx_init(void){
+  I2C_rx_ctl_init();
+  BUS_arena_init(&I2C_rx_arena,I2C_rx_arena_buf,BUS_I2C_RX_ARENA_SIZE);
+}
+
+//get a packet to receive into, returns NULL if the queue is full
+I2C_PACKET *I2C_rx_start(void){
+  //reserve space for the longest packet, only the used part is kept at commit
+  return (I2C_PACKET*)BUS_arena_reserve(&I2C_rx_arena,sizeof(I2C_PACKET));
+}
+
+//publish a packet in the bulk queue
+static void I2C_rx_publish(I2C_PACKET *pk){
+  //only keep the header and the received bytes
+  BUS_arena_publish(&I2C_rx_arena,offsetof(I2C_PACKET,dat)+pk->len);
+}
+
+//get the oldest received packet, returns NULL if the queue is empty
+I2C_PACKET *I2C_rx_peek(void){
+  return (I2C_PACKET*)BUS_arena_peek(&I2C_rx_arena);
+}
+
+//done with the packet returned by I2C_rx_peek
+void I2C_rx_done(void){
+  BUS_arena_consume(&I2C_rx_arena);
+}
+
+//return the number of packets that can be received before the arena is full
+unsigned short I2C_rx_free(void){
+  //count space for the longest packets
+  return (I2C_rx_arena.mask+1-(unsigned short)(I2C_rx_arena.in-I2C_rx_arena.out))/(sizeof(I2C_PACKET)+1);
+}
+
+//hold the current packet, records in the arena can not be skipped so only shared frames can be held
+int BUS_cmd_hold(void){
+  int token;
+  //only the ARCbus task parses commands
+  if(ctl_task_executing!=&ARC_bus_task){
+    return ERR_INVALID_ARGUMENT;
+  }
+  //reassembled messages are freed when the callback returns
+  if(BUS_cmd_no_hold){
+    return ERR_NOT_SUPPORTED;
+  }
+  //check for a shared general call frame
+  if((token=BUS_bcast_hold())==ERR_INVALID_ARGUMENT){
+    return ERR_NOT_SUPPORTED;
+  }
+  return token;
+}
+
+//release a held packet, only shared frames can be held
+int BUS_cmd_release(int token){
+  return BUS_bcast_release(token);
+}
+
+//get I2C receive queue statistics
+void BUS_get_rx_stats(BUS_RX_STATS *stats){
+  stats->used=BUS_arena_used(&I2C_rx_arena);
+  stats->hwm=I2C_rx_arena.hwm;
+  stats->full=I2C_rx_arena.full;
+  I2C_rx_batch_stats(stats);
+}
+
+#else
+
+//buffer for ISR command receive
+I2C_PACKET I2C_rx_buf[BUS_I2C_PACKET_QUEUE_LEN];
+//ring indexes for the receive buffer
+//the I2C ISR is the producer and the ARCbus task is the consumer
+BUS_RING I2C_rx_ring;
+//number of holds on each slot, held slots are skipped by the producer
+//incremented by the ARCbus task and decremented by any task with interrupts disabled
+static volatile unsigned char I2C_rx_held[BUS_I2C_PACKET_QUEUE_LEN];
+//set by the producer for slots that were published empty because they were held
+static unsigned char I2C_rx_skip[BUS_I2C_PACKET_QUEUE_LEN];
+
+//initialize I2C receive queue to empty state
+void I2C_rx_init(void){
+  int i;
+  I2C_rx_ctl_init();
+  BUS_ring_init(&I2C_rx_ring,BUS_I2C_PACKET_QUEUE_LEN);
+  //release all slots
+  for(i=0;i<BUS_I2C_PACKET_QUEUE_LEN;i++){
+    I2C_rx_held[i]=0;
+    I2C_rx_skip[i]=0;
+  }
+}
+
+//get a packet to receive into, returns NULL if the queue is full
+I2C_PACKET *I2C_rx_start(void){
+  short idx;
+  for(;;){
+    //get free slot
+    idx=BUS_ring_prod_slot(&I2C_rx_ring);
+    //check if queue is full
+    if(idx<0){
+      return NULL;
+    }
+    //check if the slot is held by a command callback
+    if(!I2C_rx_held[idx]){
+      //slot has a packet
+      I2C_rx_skip[idx]=0;
+      return &I2C_rx_buf[idx];
+    }
+    //publish slot as empty so the consumer skips it
+    I2C_rx_skip[idx]=1;
+    BUS_ring_publish(&I2C_rx_ring);
+  }
+}
+
+//publish a packet in the bulk queue
+static void I2C_rx_publish(I2C_PACKET *pk){
+  //slot is fixed size, length is already in the packet
+  BUS_ring_publish(&I2C_rx_ring);
+}
+
+//get the oldest received packet, returns NULL if the queue is empty
+I2C_PACKET *I2C_rx_peek(void){
+  short idx;
+  for(;;){
+    //get oldest slot
+    idx=BUS_ring_cons_slot(&I2C_rx_ring);
+    //check if queue is empty
+    if(idx<0){
+      return NULL;
+    }
+    //check if slot has a packet
+    if(!I2C_rx_skip[idx]){
+      return &I2C_rx_buf[idx];
+    }
+    //slot was skipped because it was held, give it back
+    BUS_ring_consume(&I2C_rx_ring);
+  }
+}
+
+//done with the packet returned by I2C_rx_peek
+void I2C_rx_done(void){
+  BUS_ring_consume(&I2C_rx_ring);
+}
+
+//return the number of packets that can be received before the queue is full
+unsigned short I2C_rx_free(void){
+  return BUS_I2C_PACKET_QUEUE_LEN-BUS_ring_used(&I2C_rx_ring);
+}
+
+//hold the packet that is currently being parsed
+int BUS_cmd_hold(void){
+  short idx;
+  int i,held=0,en;
+  //only the ARCbus task parses commands
+  if(ctl_task_executing!=&ARC_bus_task){
+    return ERR_INVALID_ARGUMENT;
+  }
+  //reassembled messages are freed when the callback returns
+  if(BUS_cmd_no_hold){
+    return ERR_NOT_SUPPORTED;
+  }
+  //check for a shared general call frame
+  if((i=BUS_bcast_hold())!=ERR_INVALID_ARGUMENT){
+    return i;
+  }
+  //get current slot
+  idx=BUS_ring_cons_slot(&I2C_rx_ring);
+  //check that there is a packet
+  if(idx<0){
+    return ERR_INVALID_ARGUMENT;
+  }
+  //count held slots
+  for(i=0;i<BUS_I2C_PACKET_QUEUE_LEN;i++){
+    if(I2C_rx_held[i]){
+      held++;
+    }
+  }
+  //check if too many slots are held, slot can always be held again for general call callbacks
+  if(!I2C_rx_held[idx] && held>=BUS_I2C_RX_HOLD_MAX){
+    return ERR_BUSY;
+  }
+  //disable interrupts so a release from another task can not interfere
+  en=ctl_global_interrupts_disable();
+  //add hold
+  I2C_rx_held[idx]++;
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  //slot index is the token
+  return idx;
+}
+
+//release a held packet
+int BUS_cmd_release(int token){
+  int en,resp=RET_SUCCESS;
+  //check for a shared general call frame
+  if(token>=BUS_BCAST_TOKEN_BASE){
+    return BUS_bcast_release(token);
+  }
+  //check token range
+  if(token<0 || token>=BUS_I2C_PACKET_QUEUE_LEN){
+    return ERR_INVALID_ARGUMENT;
+  }
+  //disable interrupts so the check and update happen together
+  en=ctl_global_interrupts_disable();
+  //check that the slot is held
+  if(I2C_rx_held[token]){
+    //remove hold
+    I2C_rx_held[token]--;
+  }else{
+    resp=ERR_INVALID_ARGUMENT;
+  }
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  return resp;
+}
+
+//get I2C receive queue statistics
+void BUS_get_rx_stats(BUS_RX_STATS *stats){
+  stats->used=BUS_ring_used(&I2C_rx_ring);
+  stats->hwm=I2C_rx_ring.hwm;
+  stats->full=I2C_rx_ring.full;
+  I2C_rx_batch_stats(stats);
+}
+
+#endif
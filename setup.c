@@ -271,7 +271,6 @@ extern CTL_TASK_t idle_task;
 extern CTL_MUTEX_t crc_mutex;
 
 void initARCbus(unsigned char addr){
-  int i;
   //kick watchdog
   WDT_KICK();
   //===[initialize globals]===
@@ -279,8 +278,14 @@ void initARCbus(unsigned char addr){
   ctl_events_init(&arcBus_stat.events,0);     //bus events
   ctl_events_init(&SUB_events,0);             //subsystem events
   ctl_events_init(&DMA_events,0);
-  //I2C mutex init
-  ctl_mutex_init(&arcBus_stat.i2c_stat.mutex);
+  //set all DMA channels to free
+  BUS_DMA_init();
+  //no destinations are limited
+  BUS_link_init();
+  //initialize shared general call frames
+  BUS_bcast_init();
+  //I2C bus arbiter init
+  BUS_arb_init();
   //crc mutex init
   ctl_mutex_init(&crc_mutex);
   //set I2C to idle mode
@@ -288,11 +293,15 @@ void initARCbus(unsigned char addr){
   //set I2C master to idle mode
   arcBus_stat.i2c_stat.tx.stat=BUS_I2C_MASTER_IDLE;
   //initialize I2C packet queue to empty state
-  for(i=0;i<BUS_I2C_PACKET_QUEUE_LEN;i++){
-    I2C_rx_buf[i].stat=I2C_PACKET_STAT_EMPTY;
-  }
-  //initialize I2C packet queue pointers
-  I2C_rx_in=I2C_rx_out=0;
+  I2C_rx_init();
+  //init transmit queue
+  BUS_tx_init();
+  //init batch buffers
+  BUS_batch_init();
+  //init reassembly buffers
+  BUS_frag_init();
+  //no RPC requests are waiting
+  BUS_rpc_init();
   //set SPI to idle mode
   arcBus_stat.spi_stat.mode=BUS_SPI_IDLE;
   //startup with power off
@@ -331,6 +340,8 @@ void initARCbus(unsigned char addr){
   UCB0I2COA0=UCOAEN|addr;
   //enable general call address
   UCB0I2COA0|=UCGCEN;
+  //seed backoff jitter from own address
+  BUS_backoff_init(addr);
   //configure ports
   P3SEL0|=BUS_PINS_I2C;
   //bring UCB0 out of reset state
@@ -422,7 +433,6 @@ void BUS_pin_enable(void){
 }
 
 void initARCbus_pd(unsigned char addr){
-  int i;
   //kick watchdog
   WDT_KICK();
   //===[initialize globals]===
@@ -430,16 +440,26 @@ void initARCbus_pd(unsigned char addr){
   ctl_events_init(&arcBus_stat.events,0);     //bus events
   ctl_events_init(&SUB_events,0);             //subsystem events
   ctl_events_init(&DMA_events,0);
-  //I2C mutex init
-  ctl_mutex_init(&arcBus_stat.i2c_stat.mutex);
+  //set all DMA channels to free
+  BUS_DMA_init();
+  //no destinations are limited
+  BUS_link_init();
+  //initialize shared general call frames
+  BUS_bcast_init();
+  //I2C bus arbiter init
+  BUS_arb_init();
   //set I2C to idle mode
   arcBus_stat.i2c_stat.mode=BUS_I2C_IDLE;
   //initialize I2C packet queue to empty state
-  for(i=0;i<BUS_I2C_PACKET_QUEUE_LEN;i++){
-    I2C_rx_buf[i].stat=I2C_PACKET_STAT_EMPTY;
-  }
-  //initialize I2C packet queue pointers
-  I2C_rx_in=I2C_rx_out=0;
+  I2C_rx_init();
+  //init transmit queue
+  BUS_tx_init();
+  //init batch buffers
+  BUS_batch_init();
+  //init reassembly buffers
+  BUS_frag_init();
+  //no RPC requests are waiting
+  BUS_rpc_init();
   //set SPI to idle mode
   arcBus_stat.spi_stat.mode=BUS_SPI_IDLE;
   //startup with power off
@@ -457,6 +477,8 @@ void initARCbus_pd(unsigned char addr){
   UCB0I2COA0=UCOAEN|addr;
   //enable general call address
   UCB0I2COA0|=UCGCEN;
+  //seed backoff jitter from own address
+  BUS_backoff_init(addr);
   //============[setup SPI]============
   //put UCA0 into reset state
   UCA0CTLW0|=UCSWRST;
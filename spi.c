@@ -1,5 +1,8 @@
 #include <msp430.h>
 #include "ARCbus.h"
+#include "DMA.h"
+#include "crc.h"
+#include "spi.h"
 #include "ARCbus_internal.h"
 
 //==============[SPI mode switching commands]==============
@@ -44,6 +47,8 @@ void SPI_slave_setup(void){
 void SPI_deactivate(void){
   //put UCA0 into reset state
   UCA0CTLW0|=UCSWRST;
+  //give back DMA channel used for the DMA9 workaround
+  BUS_DMA_release(BUS_DMA_CH2,BUS_DMA_OWNER_SPI);
   //set pins as inputs
   P3SEL0&=~(BUS_PINS_SPI);
   #ifdef CDH_LIB
@@ -53,3 +58,50 @@ void SPI_deactivate(void){
   //set mode
   arcBus_stat.spi_stat.mode=BUS_SPI_IDLE;
 }
+
+//==============[CRC while receiving]==============
+
+//start a running CRC over len bytes of buf
+void SPI_crc_start(SPI_CRC *c,const void *buf,unsigned short len){
+  c->buf=buf;
+  c->len=len;
+  c->done=0;
+  c->crc=crc16_init();
+}
+
+//add data DMA0 has received so far, n is the DMA0 block size
+void SPI_crc_chase(SPI_CRC *c,unsigned short n){
+  unsigned short rx;
+  //check if DMA is still running, the size is reloaded when the block is done
+  if(!(DMA0CTL&DMAEN)){
+    return;
+  }
+  //get count of received bytes
+  rx=n-DMA0SZ;
+  //leave the last byte, it may not have been written yet
+  if(rx<=1){
+    return;
+  }
+  rx--;
+  //don't include the CRC bytes
+  if(rx>c->len){
+    rx=c->len;
+  }
+  //check for new data
+  if(rx<=c->done){
+    return;
+  }
+  //add new data to the CRC
+  c->crc=crc16_update(c->crc,c->buf+c->done,rx-c->done);
+  c->done=rx;
+}
+
+//add the rest of the data once the DMA is done and return the CRC
+unsigned short SPI_crc_finish(SPI_CRC *c){
+  //add data that has not been checked
+  if(c->done<c->len){
+    c->crc=crc16_update(c->crc,c->buf+c->done,c->len-c->done);
+    c->done=c->len;
+  }
+  return crc16_final(c->crc);
+}
@@ -8,4 +8,23 @@ void SPI_slave_setup(void);
 //put UCA0 into reset state
 void SPI_deactivate(void);
 
+//running CRC of data that DMA0 is receiving
+typedef struct{
+  //receive buffer
+  const unsigned char *buf;
+  //data length, not including the CRC
+  unsigned short len;
+  //bytes already in the CRC
+  unsigned short done;
+  //running CRC
+  unsigned short crc;
+}SPI_CRC;
+
+//start a running CRC over len bytes of buf
+void SPI_crc_start(SPI_CRC *c,const void *buf,unsigned short len);
+//add data DMA0 has received so far, n is the DMA0 block size
+void SPI_crc_chase(SPI_CRC *c,unsigned short n);
+//add the rest of the data once the DMA is done and return the CRC
+unsigned short SPI_crc_finish(SPI_CRC *c);
+
 #endif
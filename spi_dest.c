@@ -0,0 +1,121 @@
+#include <ctl.h>
+#include <msp430.h>
+#include "ARCbus.h"
+
+#include "ARCbus_internal.h"
+
+//registered destination
+typedef struct{
+  //data type or zero for any type
+  unsigned char type;
+  //sender address or zero for any sender
+  unsigned char addr;
+  //destination, NULL if the entry is free
+  const BUS_SPI_DEST *dest;
+}BUS_SPI_DEST_ENTRY;
+
+//destination table, only changed with interrupts disabled
+static BUS_SPI_DEST_ENTRY BUS_SPI_dest_tbl[BUS_SPI_DESTS];
+
+//transfer that is going into a destination buffer, only used by the ARCbus task
+static struct{
+  const BUS_SPI_DEST *dest;
+  unsigned char addr;
+  unsigned char type;
+  unsigned char *buf;
+  unsigned short len;
+}BUS_SPI_dest_cur;
+
+//register a destination for SPI data of type from addr, zero matches any type or sender, NULL dest removes it
+int BUS_SPI_dest_register(unsigned char type,unsigned char addr,const BUS_SPI_DEST *dest){
+  int i,free=-1,en,resp=RET_SUCCESS;
+  //disable interrupts so the table is not read while it is changed
+  en=ctl_global_interrupts_disable();
+  //look for an entry with the same type and sender
+  for(i=0;i<BUS_SPI_DESTS;i++){
+    if(BUS_SPI_dest_tbl[i].dest!=NULL && BUS_SPI_dest_tbl[i].type==type && BUS_SPI_dest_tbl[i].addr==addr){
+      break;
+    }
+    //remember first free entry
+    if(BUS_SPI_dest_tbl[i].dest==NULL && free<0){
+      free=i;
+    }
+  }
+  //check for a match
+  if(i<BUS_SPI_DESTS){
+    //replace or remove destination
+    BUS_SPI_dest_tbl[i].dest=dest;
+  }else if(dest==NULL){
+    //nothing to remove
+    resp=ERR_INVALID_ARGUMENT;
+  }else if(free<0){
+    //table is full
+    resp=ERR_BUSY;
+  }else{
+    //add entry
+    BUS_SPI_dest_tbl[free].type=type;
+    BUS_SPI_dest_tbl[free].addr=addr;
+    BUS_SPI_dest_tbl[free].dest=dest;
+  }
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  return resp;
+}
+
+//get destination buffer for a transfer, returns NULL if the pool buffer should be used
+//called from the ARCbus task
+unsigned char *BUS_SPI_dest_get(unsigned char addr,unsigned char type,unsigned short len){
+  const BUS_SPI_DEST *dest=NULL;
+  unsigned char *buf;
+  int i,score,best=0;
+  //find the most specific destination, type and sender match before type only before sender only
+  for(i=0;i<BUS_SPI_DESTS;i++){
+    if(BUS_SPI_dest_tbl[i].dest==NULL){
+      continue;
+    }
+    //check type
+    if(BUS_SPI_dest_tbl[i].type!=0 && (type==0 || BUS_SPI_dest_tbl[i].type!=type)){
+      continue;
+    }
+    //check sender
+    if(BUS_SPI_dest_tbl[i].addr!=0 && BUS_SPI_dest_tbl[i].addr!=addr){
+      continue;
+    }
+    //score match
+    score=1+(BUS_SPI_dest_tbl[i].addr!=0)+2*(BUS_SPI_dest_tbl[i].type!=0);
+    if(score>best){
+      best=score;
+      dest=BUS_SPI_dest_tbl[i].dest;
+    }
+  }
+  //check for destination
+  if(dest==NULL){
+    return NULL;
+  }
+  //ask destination for memory, it can refuse and the pool is used
+  if((buf=dest->get(addr,type,len,dest->arg))==NULL){
+    return NULL;
+  }
+  //save transfer
+  BUS_SPI_dest_cur.dest=dest;
+  BUS_SPI_dest_cur.addr=addr;
+  BUS_SPI_dest_cur.type=type;
+  BUS_SPI_dest_cur.buf=buf;
+  BUS_SPI_dest_cur.len=len;
+  return buf;
+}
+
+//give the destination buffer back, result is RET_SUCCESS if the data is good
+//called from the ARCbus task
+void BUS_SPI_dest_done(int result){
+  const BUS_SPI_DEST *dest=BUS_SPI_dest_cur.dest;
+  //check for transfer
+  if(dest==NULL){
+    return;
+  }
+  BUS_SPI_dest_cur.dest=NULL;
+  //tell destination
+  dest->done(BUS_SPI_dest_cur.addr,BUS_SPI_dest_cur.type,BUS_SPI_dest_cur.buf,BUS_SPI_dest_cur.len,result,dest->arg);
+}
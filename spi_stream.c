@@ -0,0 +1,335 @@
+#include <ctl.h>
+#include <msp430.h>
+#include "ARCbus.h"
+#include "crc.h"
+#include "spi.h"
+#include "DMA.h"
+
+#include "ARCbus_internal.h"
+
+//receive state for a streamed SPI transfer
+static struct{
+  //sender address, zero if no stream is running
+  unsigned char addr;
+  //nonzero if the stream was aborted by the sender
+  volatile unsigned char abort;
+  //half being filled by DMA and next half to pass to the sink
+  unsigned char fill,use;
+  //nonzero while DMA is filling a half
+  volatile unsigned char busy;
+  //double buffer, each half is BUS_SPI_STREAM_SEG bytes
+  unsigned char *buf;
+  //pool index of the buffer
+  int buf_idx;
+  //total length of the stream
+  unsigned short len;
+  //bytes requested from the sender
+  unsigned short rx;
+  //bytes passed to the sink
+  unsigned short done;
+  //CRC sent by the sender
+  unsigned short crc;
+  //CRC of the bytes passed to the sink
+  unsigned short run;
+  //number of bytes in each half, zero if the half is empty
+  volatile unsigned short seg[2];
+  //length of the segment being filled
+  unsigned short cur;
+  //result passed to the sink when the stream ends
+  int result;
+}BUS_SPI_stream;
+
+//sink for streamed data
+static const BUS_SPI_SINK *BUS_SPI_sink=NULL;
+
+//time left for the segment being received in ticks, zero if no segment is running
+volatile unsigned short BUS_SPI_stream_timer=0;
+
+//set the sink for streamed SPI data, NULL stops streams from being accepted
+int BUS_SPI_stream_sink(const BUS_SPI_SINK *sink){
+  //sink can not change while a stream is running
+  if(BUS_SPI_stream.addr){
+    return ERR_BUSY;
+  }
+  BUS_SPI_sink=sink;
+  return RET_SUCCESS;
+}
+
+//start DMA for the next segment into the fill half, interrupts must be disabled
+static void BUS_SPI_stream_seg(void){
+  unsigned short n;
+  //get segment length
+  n=BUS_SPI_stream.len-BUS_SPI_stream.rx;
+  if(n>BUS_SPI_STREAM_SEG){
+    n=BUS_SPI_STREAM_SEG;
+  }
+  //disable DMA
+  DMA0CTL&=~DMAEN;
+  DMA1CTL&=~DMAEN;
+  // Destination DMA address: fill half
+  *((unsigned int*)&DMA0DA) = (unsigned short)(BUS_SPI_stream.buf+BUS_SPI_stream.fill*BUS_SPI_STREAM_SEG);
+  // The size of the block to be transferred
+  DMA0SZ = n;
+  // Configure the DMA transfer, single byte transfer with destination increment
+  DMA0CTL = DMAIE|DMADT_0|DMASBDB|DMAEN|DMASRCINCR_0|DMADSTINCR_3;
+  //the first byte is written below
+  if(n>1){
+    // The size of the block to be transferred
+    DMA1SZ = n-1;
+    // Configure the DMA transfer, single byte transfer with no increment
+    DMA1CTL=DMADT_0|DMASBDB|DMAEN|DMASRCINCR_0|DMADSTINCR_0;
+  }
+  //save segment length
+  BUS_SPI_stream.cur=n;
+  BUS_SPI_stream.rx+=n;
+  BUS_SPI_stream.busy=1;
+  //sender must finish the segment in time
+  BUS_SPI_stream_timer=BUS_SPI_STREAM_SEG_TIME;
+  //write the Tx buffer to start transfer
+  UCA0TXBUF=BUS_SPI_DUMMY_DATA;
+}
+
+//start receiving a stream as SPI master, returns zero or a NACK reason
+int BUS_SPI_stream_start(unsigned char addr,const unsigned char *ptr){
+  unsigned short len;
+  int en;
+  //assemble length
+  len=ptr[1];//LSB
+  len|=(((unsigned short)ptr[0])<<8);//MSB
+  //check for a sink
+  if(BUS_SPI_sink==NULL){
+    return ERR_SPI_NO_SINK;
+  }
+  //check length
+  if(len==0){
+    return ERR_SPI_LEN;
+  }
+  //check that the buffer can be split in two segments
+  if(BUS_get_buffer_size()<2*BUS_SPI_STREAM_SEG){
+    return ERR_SPI_LEN;
+  }
+  //check if already streaming or a SPI transfer or BUS_SPI_txrx is running
+  if(BUS_SPI_stream.addr || arcBus_stat.spi_stat.mode!=BUS_SPI_IDLE){
+    return ERR_SPI_BUSY;
+  }
+  //take DMA channel used for the DMA9 workaround
+  if(BUS_DMA_claim(BUS_DMA_CH2,BUS_DMA_OWNER_SPI)!=RET_SUCCESS){
+    return ERR_SPI_BUSY;
+  }
+  //get buffer to use for the two halves
+  if((BUS_SPI_stream.buf_idx=BUS_buf_rx_get())<0){
+    //give back DMA channel
+    BUS_DMA_release(BUS_DMA_CH2,BUS_DMA_OWNER_SPI);
+    return ERR_BUFFER_BUSY;
+  }
+  BUS_SPI_stream.buf=BUS_buf_ptr(BUS_SPI_stream.buf_idx);
+  //setup stream
+  BUS_SPI_stream.addr=addr;
+  BUS_SPI_stream.abort=0;
+  BUS_SPI_stream.len=len;
+  BUS_SPI_stream.rx=0;
+  BUS_SPI_stream.done=0;
+  BUS_SPI_stream.crc=(((unsigned short)ptr[2])<<8)|ptr[3];
+  BUS_SPI_stream.run=crc16_init();
+  BUS_SPI_stream.seg[0]=0;
+  BUS_SPI_stream.seg[1]=0;
+  BUS_SPI_stream.fill=0;
+  BUS_SPI_stream.use=0;
+  BUS_SPI_stream.result=RET_SUCCESS;
+  //disable DMA
+  DMA0CTL&=~DMAEN;
+  DMA1CTL&=~DMAEN;
+  DMA2CTL&=~DMAEN;
+  //setup SPI structure
+  arcBus_stat.spi_stat.len=len;
+  arcBus_stat.spi_stat.rx=BUS_SPI_stream.buf;
+  arcBus_stat.spi_stat.tx=NULL;
+  //Setup SPI bus to exchange data as master
+  SPI_master_setup();
+  //============[setup DMA for transfer]============
+  //setup source trigger
+  DMACTL0 &=~(DMA0TSEL_31|DMA1TSEL_31);
+  DMACTL0 |= (DMA0TSEL__USCIA0RX|DMA1TSEL__USCIA0TX);
+  DMACTL1 = DMA2TSEL__USCIA0RX;
+  //DMA9 workaround, use a dummy channel with lower priority and the same trigger
+  //setup dummy channel: read and write from unused space in the SPI registers
+  *((unsigned int*)&DMA2SA) = EUSCI_A0_BASE + 0x02;
+  *((unsigned int*)&DMA2DA) = EUSCI_A0_BASE + 0x04;
+  // only one byte
+  DMA2SZ = 1;
+  // Configure the DMA transfer, repeated byte transfer with no increment
+  DMA2CTL = DMADT_4|DMASBDB|DMAEN|DMASRCINCR_0|DMADSTINCR_0;
+  // Source DMA address: receive register.
+  *((unsigned int*)&DMA0SA) = (unsigned short)(&UCA0RXBUF);
+  // Source DMA address: SPI transmit buffer, constant data will be sent
+  *((unsigned int*)&DMA1SA) = (unsigned int)(&UCA0TXBUF);
+  // Destination DMA address: the transmit buffer.
+  *((unsigned int*)&DMA1DA) = (unsigned int)(&UCA0TXBUF);
+  //disable interrupts so the DMA interrupt sees a complete segment
+  en=ctl_global_interrupts_disable();
+  //start first segment
+  BUS_SPI_stream_seg();
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  return RET_SUCCESS;
+}
+
+//segment received, called from the DMA interrupt, returns zero if no stream is running
+int BUS_SPI_stream_dma(void){
+  //check for stream
+  if(!BUS_SPI_stream.addr || !BUS_SPI_stream.busy){
+    return 0;
+  }
+  //half is full
+  BUS_SPI_stream.busy=0;
+  //no deadline while waiting for the sink
+  BUS_SPI_stream_timer=0;
+  BUS_SPI_stream.seg[BUS_SPI_stream.fill]=BUS_SPI_stream.cur;
+  //switch halves
+  BUS_SPI_stream.fill^=1;
+  //start the next segment right away if the other half has been passed to the sink
+  if(BUS_SPI_stream.rx<BUS_SPI_stream.len && !BUS_SPI_stream.seg[BUS_SPI_stream.fill]){
+    BUS_SPI_stream_seg();
+  }
+  //tell helper task to pass the segment to the sink
+  ctl_events_set_clear(&BUS_helper_events,BUS_HELPER_EV_SPI_STREAM,0);
+  return 1;
+}
+
+//stop a stream from addr because the sender aborted, called from the ARCbus task
+int BUS_SPI_stream_abort(unsigned char addr){
+  //check for stream from addr
+  if(!BUS_SPI_stream.addr || BUS_SPI_stream.addr!=addr){
+    return ERR_SPI_WRONG_ADDR;
+  }
+  //disable DMA
+  DMA0CTL&=~DMAEN;
+  DMA1CTL&=~DMAEN;
+  DMA2CTL&=~DMAEN;
+  //turn off SPI
+  SPI_deactivate();
+  //no more segments
+  BUS_SPI_stream.busy=0;
+  BUS_SPI_stream.abort=1;
+  BUS_SPI_stream_timer=0;
+  //helper task ends the stream
+  ctl_events_set_clear(&BUS_helper_events,BUS_HELPER_EV_SPI_STREAM,0);
+  return RET_SUCCESS;
+}
+
+//return nonzero if a stream is being received
+int BUS_SPI_stream_busy(void){
+  return BUS_SPI_stream.addr!=0;
+}
+
+//stop a stream if the sender did not finish a segment in time, called from the helper task
+void BUS_SPI_stream_timeout(void){
+  int en;
+  //disable interrupts so the DMA interrupt does not start a segment at the same time
+  en=ctl_global_interrupts_disable();
+  //check that the segment is still running and the deadline was not moved by a new segment
+  if(BUS_SPI_stream.addr && BUS_SPI_stream.busy && !BUS_SPI_stream_timer){
+    //disable DMA
+    DMA0CTL&=~DMAEN;
+    DMA1CTL&=~DMAEN;
+    DMA2CTL&=~DMAEN;
+    //turn off SPI
+    SPI_deactivate();
+    //no more segments
+    BUS_SPI_stream.busy=0;
+    BUS_SPI_stream.abort=1;
+  }
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  //end the stream
+  BUS_SPI_stream_consume();
+}
+
+//pass received segments to the sink and end the stream when it is done, called from the helper task
+void BUS_SPI_stream_consume(void){
+  unsigned char pk[BUS_I2C_HDR_LEN+1+BUS_I2C_CRC_LEN],*ptr;
+  const BUS_SPI_SINK *sink=BUS_SPI_sink;
+  unsigned short n;
+  int en,resp;
+  //check for stream
+  if(!BUS_SPI_stream.addr){
+    return;
+  }
+  //pass full halves to the sink in order
+  while(!BUS_SPI_stream.abort && (n=BUS_SPI_stream.seg[BUS_SPI_stream.use])!=0){
+    ptr=BUS_SPI_stream.buf+BUS_SPI_stream.use*BUS_SPI_STREAM_SEG;
+    //update CRC
+    BUS_SPI_stream.run=crc16_update(BUS_SPI_stream.run,ptr,n);
+    //pass data to sink unless it failed before
+    if(BUS_SPI_stream.result==RET_SUCCESS && (resp=sink->seg(BUS_SPI_stream.addr,ptr,n,BUS_SPI_stream.done,sink->arg))!=RET_SUCCESS){
+      //keep receiving so the sender finishes but don't pass any more data
+      BUS_SPI_stream.result=resp;
+    }
+    BUS_SPI_stream.done+=n;
+    //disable interrupts so the DMA interrupt does not start a segment at the same time
+    en=ctl_global_interrupts_disable();
+    //half is empty
+    BUS_SPI_stream.seg[BUS_SPI_stream.use]=0;
+    //start the next segment if DMA was waiting for this half
+    if(!BUS_SPI_stream.busy && BUS_SPI_stream.rx<BUS_SPI_stream.len && BUS_SPI_stream.fill==BUS_SPI_stream.use){
+      BUS_SPI_stream_seg();
+    }
+    //enable interrupts
+    if(en){
+      ctl_global_interrupts_enable();
+    }
+    //next half
+    BUS_SPI_stream.use^=1;
+  }
+  //check if stream is finished
+  if(!BUS_SPI_stream.abort && BUS_SPI_stream.done<BUS_SPI_stream.len){
+    return;
+  }
+  if(BUS_SPI_stream.abort){
+    //sender gave up or stopped sending
+    BUS_SPI_stream.result=ERR_TIMEOUT;
+  }else{
+    //disable DMA
+    DMA0CTL&=~DMAEN;
+    DMA1CTL&=~DMAEN;
+    DMA2CTL&=~DMAEN;
+    //turn off SPI
+    SPI_deactivate();
+    //check CRC
+    if(crc16_final(BUS_SPI_stream.run)!=BUS_SPI_stream.crc){
+      BUS_SPI_stream.result=ERR_BAD_CRC;
+    }
+    //tell sender the stream is done
+    ptr=BUS_cmd_init(pk,CMD_SPI_COMPLETE);
+    //send result, zero for success
+    if(BUS_SPI_stream.result==RET_SUCCESS || BUS_SPI_stream.result==ERR_BAD_CRC){
+      *ptr=BUS_SPI_stream.result;
+    }else{
+      //sink did not take all the data
+      *ptr=ERR_SPI_SINK_FAIL;
+    }
+    //send data
+    resp=BUS_cmd_tx(BUS_SPI_stream.addr,pk,1,0);
+    //check if command was successful and try again if it failed
+    if(resp!=RET_SUCCESS){
+      resp=BUS_cmd_tx(BUS_SPI_stream.addr,pk,1,0);
+    }
+    //check if command sent successfully
+    if(resp!=RET_SUCCESS){
+      //report error
+      report_error(ERR_LEV_ERROR,BUS_ERR_SRC_MAIN_LOOP,MAIN_LOOP_ERR_SPI_COMPLETE_FAIL,resp);
+    }
+  }
+  //tell sink the stream is done
+  if(sink->done!=NULL){
+    sink->done(BUS_SPI_stream.addr,BUS_SPI_stream.done,BUS_SPI_stream.result,sink->arg);
+  }
+  //give back buffer
+  BUS_buf_rx_free(BUS_SPI_stream.buf_idx);
+  //stream is done
+  BUS_SPI_stream.addr=0;
+}
@@ -0,0 +1,118 @@
+//host benchmark for the packed receive arena
+//compares how many packets a burst can put in the arena against fixed I2C_PACKET slots in the same RAM
+#include <stdio.h>
+#include <stddef.h>
+#include "../ring.h"
+
+//same as ARCbus.h
+#define BUS_I2C_CRC_LEN             (1)
+#define BUS_I2C_HDR_LEN             (2)
+#define BUS_I2C_MAX_PACKET_LEN      (30)
+
+//same as BUS_I2C_RX_ARENA_SIZE in ARCbus_internal.h
+#define ARENA_SIZE      512
+
+//same layout as I2C_PACKET in ARCbus_internal.h
+typedef struct{
+  unsigned char len;
+  unsigned char flags;
+  unsigned char dat[BUS_I2C_HDR_LEN+BUS_I2C_MAX_PACKET_LEN+BUS_I2C_CRC_LEN];
+}I2C_PACKET;
+
+//traffic mix, payload lengths picked in turn
+typedef struct{
+  const char *name;
+  const unsigned char *len;
+  int n;
+}MIX;
+
+static const unsigned char mix_ping[]={0};
+static const unsigned char mix_small[]={0,1,3,1,0,2};
+static const unsigned char mix_mixed[]={0,1,3,10,1,30,2,6};
+static const unsigned char mix_full[]={30};
+
+static const MIX mixes[]={
+  {"ping (0 byte payload)",mix_ping,sizeof(mix_ping)},
+  {"small commands (0-3)",mix_small,sizeof(mix_small)},
+  {"mixed (0-30)",mix_mixed,sizeof(mix_mixed)},
+  {"max length (30)",mix_full,sizeof(mix_full)},
+};
+
+static unsigned char buf[ARENA_SIZE];
+
+//fill the arena the same way rx_queue.c does until it is full
+//returns the number of packets held
+static int fill(BUS_ARENA *a,const MIX *m,int *next){
+  I2C_PACKET *pk;
+  int held=0,i;
+  for(;;){
+    //the ISR reserves space for the longest packet
+    if((pk=(I2C_PACKET*)BUS_arena_reserve(a,sizeof(I2C_PACKET)))==NULL){
+      return held;
+    }
+    //received bytes are header, payload and CRC
+    pk->len=BUS_I2C_HDR_LEN+m->len[(*next)++%m->n]+BUS_I2C_CRC_LEN;
+    pk->flags=0;
+    for(i=0;i<pk->len;i++){
+      pk->dat[i]=(unsigned char)(held+i);
+    }
+    //only the used part is kept
+    BUS_arena_publish(a,offsetof(I2C_PACKET,dat)+pk->len);
+    held++;
+  }
+}
+
+//drain n packets and check their contents, returns zero if all are good
+static int drain(BUS_ARENA *a,int n){
+  I2C_PACKET *pk;
+  int i,j;
+  for(j=0;j<n;j++){
+    if((pk=(I2C_PACKET*)BUS_arena_peek(a))==NULL){
+      return -1;
+    }
+    for(i=0;i<pk->len;i++){
+      if(pk->dat[i]!=(unsigned char)(j+i)){
+        return -1;
+      }
+    }
+    BUS_arena_consume(a);
+  }
+  return 0;
+}
+
+int main(void){
+  BUS_ARENA a;
+  int k,r,held,slots,next;
+  unsigned long total;
+  //fixed slots that fit in the same RAM
+  slots=ARENA_SIZE/sizeof(I2C_PACKET);
+  printf("%d bytes of RAM, fixed slot %u bytes holds %d packets (%.3f packets/byte)\n",ARENA_SIZE,(unsigned)sizeof(I2C_PACKET),slots,(double)slots/ARENA_SIZE);
+  printf("%-24s %8s %14s %8s\n","traffic","arena","packets/byte","gain");
+  for(k=0;k<(int)(sizeof(mixes)/sizeof(mixes[0]));k++){
+    BUS_arena_init(&a,buf,ARENA_SIZE);
+    total=0;
+    next=0;
+    //repeat bursts so records wrap around the end of the buffer
+    for(r=0;r<100;r++){
+      held=fill(&a,&mixes[k],&next);
+      total+=held;
+      //numbers restart for each burst
+      if(drain(&a,held)){
+        fprintf(stderr,"%s: bad record in burst %d\n",mixes[k].name,r);
+        return 1;
+      }
+      //leave the arena part full so the next burst starts somewhere else
+      fill(&a,&mixes[k],&next);
+      if(drain(&a,BUS_arena_used(&a)/2)){
+        fprintf(stderr,"%s: bad record in partial burst %d\n",mixes[k].name,r);
+        return 1;
+      }
+      //empty the rest
+      while(BUS_arena_peek(&a)!=NULL){
+        BUS_arena_consume(&a);
+      }
+    }
+    printf("%-24s %8.1f %14.3f %7.2fx\n",mixes[k].name,total/100.0,total/100.0/ARENA_SIZE,total/100.0/slots);
+  }
+  return 0;
+}
@@ -0,0 +1,260 @@
+//host multi-master simulation for I2C arbitration backoff
+//several boards send packets to one destination as fast as they can
+//each board runs its own copy of backoff.c and the results are compared with the old fixed retry time
+//the old retry time is shorter than a packet so losers start again together when the bus is free
+//backoff lowers the arbitration losses and restarts each packet costs the sending boards
+#include <stdio.h>
+#include <string.h>
+#include "ARCbus.h"
+#include "ARCbus_internal.h"
+
+//each copy of backoff.c is built with its names changed to nodeN_...
+#define NODE_DECL(n) \
+  BUS_STAT node##n##_stat; \
+  void node##n##_backoff_init(unsigned char addr); \
+  void node##n##_backoff_start(void); \
+  unsigned short node##n##_backoff_collision(void); \
+  unsigned short node##n##_backoff_retry(void); \
+  void node##n##_get_arb_stats(BUS_ARB_STATS *stats);
+
+NODE_DECL(0)
+NODE_DECL(1)
+NODE_DECL(2)
+NODE_DECL(3)
+
+#define MAX_NODES       4
+
+//functions for one copy of backoff.c
+typedef struct{
+  BUS_STAT *stat;
+  void (*init)(unsigned char addr);
+  void (*start)(void);
+  unsigned short (*collision)(void);
+  unsigned short (*retry)(void);
+  void (*get_stats)(BUS_ARB_STATS *stats);
+}BACKOFF_COPY;
+
+#define NODE_COPY(n) {&node##n##_stat,node##n##_backoff_init,node##n##_backoff_start,node##n##_backoff_collision,node##n##_backoff_retry,node##n##_get_arb_stats}
+
+static const BACKOFF_COPY copies[MAX_NODES]={NODE_COPY(0),NODE_COPY(1),NODE_COPY(2),NODE_COPY(3)};
+
+//sending boards, the lowest address wins arbitration on the source address byte
+static const unsigned char addrs[MAX_NODES]={0x11,0x12,0x13,0x16};
+
+//bit time at 50 kbit/s in us
+#define BIT_US          20
+//bytes after the address, header, payload and CRC
+#define PK_LEN          10
+//frame time in us: start, address, data and ACKs, stop
+#define FRAME_US        ((2+9*(1+PK_LEN))*BIT_US)
+//arbitration is lost on the source address, the first data byte
+#define AL_US           ((1+9+8)*BIT_US)
+//start and completion timeouts in BUS_cmd_tx, 50 ticks of 1024 Hz
+#define TIMEOUT_US      (50*1000000L/1024)
+//simulated time in us
+#define RUN_US          (10*1000000L)
+
+//32.768 kHz clocks to us
+#define CLK_US(c)       ((long)(c)*1000000L/32768)
+
+//interrupts are always enabled on the host
+int ctl_global_interrupts_disable(void){
+  return 0;
+}
+
+void ctl_global_interrupts_enable(void){
+}
+
+static int fails;
+
+enum{NODE_WAIT,NODE_PENDING,NODE_TX};
+
+//state of one simulated board
+typedef struct{
+  int state;
+  //time the next packet is queued
+  long ready;
+  //start condition is waiting for the bus
+  int start;
+  //retry timer
+  int timer_en;
+  long timer;
+  //time arbitration loss is seen, zero if none
+  long al;
+  //packet start time and time of the first start condition, zero if not started
+  long begin,started;
+  //results
+  unsigned long sent,dropped,collisions,retries;
+  unsigned char max_collisions;
+}NODE;
+
+//results of one run
+typedef struct{
+  unsigned long sent,dropped,collisions,retries,min_sent;
+  unsigned char max_collisions;
+}RESULT;
+
+//time to wait after arbitration is lost or before starting again in us
+static long delay_us(const BACKOFF_COPY *b,int backoff,int collision){
+  unsigned short d;
+  if(collision){
+    d=b->collision();
+  }else{
+    d=b->retry();
+  }
+  //old code always used the base wait time
+  return CLK_US(backoff?d:BUS_I2C_WAIT_TIME);
+}
+
+static RESULT run(int n,int backoff,long task_us){
+  NODE nodes[MAX_NODES];
+  RESULT r;
+  long t,bus_end=0,arb_end=0;
+  int i,owner=-1,contenders;
+  BUS_ARB_STATS st,st0[MAX_NODES];
+  memset(nodes,0,sizeof(nodes));
+  for(i=0;i<n;i++){
+    copies[i].init(addrs[i]);
+    copies[i].get_stats(&st0[i]);
+    nodes[i].state=NODE_WAIT;
+    nodes[i].ready=1;
+  }
+  for(t=1;t<RUN_US;t++){
+    for(i=0;i<n;i++){
+      NODE *nd=&nodes[i];
+      //task queues the next packet
+      if(nd->state==NODE_WAIT && t>=nd->ready){
+        copies[i].start();
+        nd->state=NODE_PENDING;
+        nd->start=1;
+        nd->begin=t;
+        nd->started=0;
+      }
+      //arbitration lost, interrupt sets retry timer
+      if(nd->al && t>=nd->al){
+        nd->al=0;
+        nd->collisions++;
+        nd->timer=t+delay_us(&copies[i],backoff,1);
+        nd->timer_en=1;
+      }
+      //retry timer
+      if(nd->timer_en && t>=nd->timer){
+        if(nd->state==NODE_PENDING){
+          nd->start=1;
+          nd->retries++;
+          nd->timer+=delay_us(&copies[i],backoff,0);
+        }else{
+          nd->timer_en=0;
+        }
+      }
+      //BUS_cmd_tx gives up
+      if(nd->state==NODE_PENDING && ((!nd->started && t-nd->begin>=TIMEOUT_US) || (nd->started && t-nd->started>=TIMEOUT_US))){
+        nd->dropped++;
+        if(copies[i].stat->i2c_stat.tx.collisions>nd->max_collisions){
+          nd->max_collisions=copies[i].stat->i2c_stat.tx.collisions;
+        }
+        nd->state=NODE_WAIT;
+        nd->start=0;
+        nd->ready=t+task_us;
+      }
+    }
+    //packet finished
+    if(owner>=0 && t>=bus_end){
+      nodes[owner].sent++;
+      nodes[owner].state=NODE_WAIT;
+      nodes[owner].ready=t+task_us;
+      if(copies[owner].stat->i2c_stat.tx.collisions>nodes[owner].max_collisions){
+        nodes[owner].max_collisions=copies[owner].stat->i2c_stat.tx.collisions;
+      }
+      owner=-1;
+      //stop condition, the slave stop handler restarts pending packets
+      //the old code restarted every pending packet so the losers all started again on the same edge
+      //with backoff a packet that lost arbitration waits for its timer
+      for(i=0;i<n;i++){
+        if(nodes[i].state==NODE_PENDING && !nodes[i].start && (!backoff || !nodes[i].timer_en)){
+          nodes[i].start=1;
+          nodes[i].retries++;
+          copies[i].retry();
+        }
+      }
+    }
+    //bus is free, start conditions inside one bit time collide
+    if(owner<0 && t>=bus_end){
+      if(!arb_end){
+        for(i=0;i<n;i++){
+          if(nodes[i].start){
+            arb_end=t+BIT_US;
+            break;
+          }
+        }
+      }
+      if(arb_end && t>=arb_end){
+        arb_end=0;
+        contenders=0;
+        for(i=0;i<n;i++){
+          if(!nodes[i].start){
+            continue;
+          }
+          nodes[i].start=0;
+          //first start condition of the packet
+          if(!nodes[i].started){
+            nodes[i].started=t;
+          }
+          if(contenders++==0){
+            //lowest address wins
+            owner=i;
+          }else{
+            //loses on the source address byte
+            nodes[i].al=t+AL_US;
+          }
+        }
+        nodes[owner].state=NODE_TX;
+        bus_end=t+FRAME_US;
+      }
+    }
+  }
+  memset(&r,0,sizeof(r));
+  r.min_sent=~0UL;
+  for(i=0;i<n;i++){
+    r.sent+=nodes[i].sent;
+    r.dropped+=nodes[i].dropped;
+    r.collisions+=nodes[i].collisions;
+    r.retries+=nodes[i].retries;
+    if(nodes[i].sent<r.min_sent){
+      r.min_sent=nodes[i].sent;
+    }
+    //check the counters kept by backoff.c
+    copies[i].get_stats(&st);
+    if(st.collisions-st0[i].collisions!=nodes[i].collisions || st.retries-st0[i].retries!=nodes[i].retries){
+      printf("node %d: backoff.c counters do not match the simulation\n",i);
+      fails++;
+    }
+    if(nodes[i].max_collisions>r.max_collisions){
+      r.max_collisions=nodes[i].max_collisions;
+    }
+  }
+  return r;
+}
+
+int main(void){
+  const long tasks[]={300,6000};
+  RESULT f,b;
+  int n,k;
+  printf("%d byte packets to one destination, %ld s\n",PK_LEN,RUN_US/1000000L);
+  printf("gap us  boards  policy   dropped  collisions/packet  restarts/packet  slowest board/s  most collisions\n");
+  for(k=0;k<sizeof(tasks)/sizeof(tasks[0]);k++){
+    for(n=2;n<=MAX_NODES;n++){
+      f=run(n,0,tasks[k]);
+      b=run(n,1,tasks[k]);
+      printf("%6ld  %6d  fixed    %7lu  %17.2f  %15.2f  %15.1f  %15u\n",tasks[k],n,f.dropped,(double)f.collisions/f.sent,(double)f.retries/f.sent,f.min_sent*1e6/RUN_US,f.max_collisions);
+      printf("%6ld  %6d  backoff  %7lu  %17.2f  %15.2f  %15.1f  %15u\n",tasks[k],n,b.dropped,(double)b.collisions/b.sent,(double)b.retries/b.sent,b.min_sent*1e6/RUN_US,b.max_collisions);
+      //backoff must not lose arbitration more often than the old retry time
+      //and must at least halve the losses when packets lose arbitration often
+      if(b.collisions>f.collisions || (f.collisions*10>f.sent && b.collisions*2>f.collisions)){
+        printf("backoff does not lower arbitration losses\n");
+        fails++;
+      }
+    }
+  }
+  return fails?1:0;
+}
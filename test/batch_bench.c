@@ -0,0 +1,60 @@
+//host bus time model for CMD_BATCH
+//counts the I2C bit times needed to send small commands to one node one at a time and packed the way BUS_cmd_tx_batch packs them
+#include <stdio.h>
+#include "ARCbus.h"
+
+//bus clock, SMCLK over UCB0BRW=400 from setup.c
+#define BIT_RATE        50000.0
+//bit times for start and stop conditions
+#define START_STOP_BITS 2
+//commands sent in each run
+#define COMMANDS        10000
+
+//payload lengths of the commands, picked in turn
+static const unsigned char mix[]={0,1,3,0,2,1,0,4};
+
+//bit times for one frame with n bytes after the address
+static double frame_bits(unsigned n){
+  //address byte and each data byte are 8 bits and an ACK
+  return START_STOP_BITS+9*(1+n);
+}
+
+int main(void){
+  const double gaps[]={0,100e-6,500e-6};
+  unsigned i,len,frames_single,frames_batch,fill;
+  double bits_single,bits_batch,t_single,t_batch;
+  int g;
+  //send each command on its own
+  bits_single=0;
+  frames_single=0;
+  for(i=0;i<COMMANDS;i++){
+    bits_single+=frame_bits(BUS_I2C_HDR_LEN+mix[i%sizeof(mix)]+BUS_I2C_CRC_LEN);
+    frames_single++;
+  }
+  //pack records until the next one does not fit, same rule as BUS_cmd_tx_batch
+  bits_batch=0;
+  frames_batch=0;
+  fill=0;
+  for(i=0;i<COMMANDS;i++){
+    len=BUS_BATCH_REC_HDR_LEN+mix[i%sizeof(mix)];
+    if(fill+len>BUS_I2C_MAX_PACKET_LEN){
+      bits_batch+=frame_bits(BUS_I2C_HDR_LEN+fill+BUS_I2C_CRC_LEN);
+      frames_batch++;
+      fill=0;
+    }
+    fill+=len;
+  }
+  if(fill){
+    bits_batch+=frame_bits(BUS_I2C_HDR_LEN+fill+BUS_I2C_CRC_LEN);
+    frames_batch++;
+  }
+  printf("%u commands to one node at %.0f bit/s, %u frames single, %u frames batched\n",COMMANDS,BIT_RATE,frames_single,frames_batch);
+  printf("%10s %16s %16s %16s %16s %8s\n","gap (us)","single frames/s","single cmds/s","batch frames/s","batch cmds/s","gain");
+  //gap is the time between frames for arbitration and the sender's software
+  for(g=0;g<(int)(sizeof(gaps)/sizeof(gaps[0]));g++){
+    t_single=bits_single/BIT_RATE+frames_single*gaps[g];
+    t_batch=bits_batch/BIT_RATE+frames_batch*gaps[g];
+    printf("%10.0f %16.1f %16.1f %16.1f %16.1f %7.2fx\n",gaps[g]*1e6,frames_single/t_single,COMMANDS/t_single,frames_batch/t_batch,COMMANDS/t_batch,t_single/t_batch);
+  }
+  return 0;
+}
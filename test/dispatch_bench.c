@@ -0,0 +1,94 @@
+//host benchmark for command dispatch
+//compares a command found in the per-command table against one handled by the last callback in cmd_parse_list
+#include <stdio.h>
+#include <time.h>
+#include "ARCbus.h"
+#include "ARCbus_internal.h"
+
+//number of dispatches timed for each point
+#define RUNS        1000000L
+//command handled by the callback at the end of the list
+#define CMD_LIST    0x90
+//command handled through the table
+#define CMD_TABLE   0x91
+//most callbacks registered
+#define MAX_CB      32
+
+//calls to each kind of callback
+static unsigned long other_calls,list_calls,table_calls;
+
+//deferred callbacks are not used here
+int cmd_worker_post(CMD_PARSE_DAT *parse,unsigned char addr,unsigned char cmd,unsigned char *dat,unsigned short len,unsigned char flags,unsigned char nack){
+  return ERR_BUSY;
+}
+
+//callback for some other subsystem, does not know the command
+static int cb_other(unsigned char src,unsigned char cmd,unsigned char *dat,unsigned short len,unsigned char flags){
+  other_calls++;
+  return ERR_UNKNOWN_CMD;
+}
+
+//callback at the end of the list
+static int cb_list(unsigned char src,unsigned char cmd,unsigned char *dat,unsigned short len,unsigned char flags){
+  if(cmd!=CMD_LIST){
+    return ERR_UNKNOWN_CMD;
+  }
+  list_calls++;
+  return RET_SUCCESS;
+}
+
+//callback found in the table
+static int cb_table(unsigned char src,unsigned char cmd,unsigned char *dat,unsigned short len,unsigned char flags){
+  table_calls++;
+  return RET_SUCCESS;
+}
+
+static CMD_PARSE_DAT other[MAX_CB-1];
+static CMD_PARSE_DAT list_dat={cb_list,CMD_PARSE_ADDR0,0,NULL,NULL};
+static CMD_PARSE_DAT table_dat={cb_table,CMD_PARSE_ADDR0,0,NULL,NULL};
+
+//time RUNS dispatches of cmd, returns nanoseconds per dispatch or a negative number if a dispatch failed
+static double time_cmd(unsigned char cmd){
+  struct timespec t0,t1;
+  unsigned char dat[4]={0};
+  long i;
+  clock_gettime(CLOCK_MONOTONIC,&t0);
+  for(i=0;i<RUNS;i++){
+    if(cmd_parse_dispatch(0x12,cmd,dat,sizeof(dat),CMD_PARSE_ADDR0,0)!=RET_SUCCESS){
+      return -1;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC,&t1);
+  return ((t1.tv_sec-t0.tv_sec)*1e9+(t1.tv_nsec-t0.tv_nsec))/RUNS;
+}
+
+int main(void){
+  int n,i;
+  double t_list,t_table;
+  //lowest priority so every other callback is in front of it
+  BUS_register_cmd_callback(&list_dat);
+  if(BUS_register_cmd_handler(CMD_TABLE,&table_dat)!=RET_SUCCESS){
+    fprintf(stderr,"table registration failed\n");
+    return 1;
+  }
+  printf("%10s %14s %14s\n","callbacks","list ns/cmd","table ns/cmd");
+  for(n=1,i=0;n<=MAX_CB;n*=2){
+    //add callbacks in front of cb_list until there are n in the list
+    for(;i<n-1;i++){
+      other[i].cb=cb_other;
+      other[i].flags=CMD_PARSE_ADDR0;
+      other[i].priority=1+i;
+      BUS_register_cmd_callback(&other[i]);
+    }
+    other_calls=list_calls=table_calls=0;
+    t_list=time_cmd(CMD_LIST);
+    t_table=time_cmd(CMD_TABLE);
+    //check that the right callbacks ran
+    if(t_list<0 || t_table<0 || list_calls!=RUNS || table_calls!=RUNS || other_calls!=(unsigned long)RUNS*(n-1)){
+      fprintf(stderr,"wrong callbacks called with %d callbacks\n",n);
+      return 1;
+    }
+    printf("%10d %14.1f %14.1f\n",n,t_list,t_table);
+  }
+  return 0;
+}
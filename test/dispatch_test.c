@@ -0,0 +1,85 @@
+//host test for deferred command callbacks
+//a deferred callback must only take the commands it says it handles
+#include <stdio.h>
+#include "ARCbus.h"
+#include "ARCbus_internal.h"
+
+//commands used in the test
+#define CMD_DEFERRED    0x90
+#define CMD_LATER       0x91
+#define CMD_TABLE       0x92
+
+//commands posted to the worker queue and calls to each callback
+static int posted,inline_calls,later_calls;
+static CMD_PARSE_DAT *posted_dat;
+
+//stand in for the worker queue
+int cmd_worker_post(CMD_PARSE_DAT *parse,unsigned char addr,unsigned char cmd,unsigned char *dat,unsigned short len,unsigned char flags,unsigned char nack){
+  posted++;
+  posted_dat=parse;
+  return RET_SUCCESS;
+}
+
+//deferred callback, only knows CMD_DEFERRED and CMD_TABLE
+static int cb_deferred(unsigned char src,unsigned char cmd,unsigned char *dat,unsigned short len,unsigned char flags){
+  inline_calls++;
+  return (cmd==CMD_DEFERRED || cmd==CMD_TABLE)?RET_SUCCESS:ERR_UNKNOWN_CMD;
+}
+
+//lower priority callback that handles CMD_LATER
+static int cb_later(unsigned char src,unsigned char cmd,unsigned char *dat,unsigned short len,unsigned char flags){
+  if(cmd!=CMD_LATER){
+    return ERR_UNKNOWN_CMD;
+  }
+  later_calls++;
+  return RET_SUCCESS;
+}
+
+static unsigned char mask[CMD_PARSE_MASK_LEN];
+static CMD_PARSE_DAT masked={cb_deferred,CMD_PARSE_ADDR0|CMD_PARSE_GC_ADDR|CMD_PARSE_DEFERRED|CMD_PARSE_CMD_MASK,10,NULL,mask};
+static CMD_PARSE_DAT unmasked={cb_deferred,CMD_PARSE_ADDR1|CMD_PARSE_DEFERRED,10,NULL,NULL};
+static CMD_PARSE_DAT table={cb_deferred,CMD_PARSE_ADDR0|CMD_PARSE_DEFERRED,0,NULL,NULL};
+static CMD_PARSE_DAT later={cb_later,CMD_PARSE_ADDR0|CMD_PARSE_ADDR1|CMD_PARSE_GC_ADDR,1,NULL,NULL};
+
+static int fails;
+
+//dispatch a command and check the result
+static void check(const char *name,unsigned char cmd,unsigned char flags,int resp,int npost,int ninline,int nlater){
+  unsigned char dat[2]={0};
+  int r;
+  posted=inline_calls=later_calls=0;
+  r=cmd_parse_dispatch(0x12,cmd,dat,sizeof(dat),flags,1);
+  if(r!=resp || posted!=npost || inline_calls!=ninline || later_calls!=nlater){
+    printf("FAIL %s: resp %d posted %d inline %d later %d\n",name,r,posted,inline_calls,later_calls);
+    fails++;
+  }
+}
+
+int main(void){
+  CMD_PARSE_MASK_SET(mask,CMD_DEFERRED);
+  BUS_register_cmd_callback(&masked);
+  BUS_register_cmd_callback(&unmasked);
+  BUS_register_cmd_callback(&later);
+  BUS_register_cmd_handler(CMD_TABLE,&table);
+  //command in the mask is posted
+  check("masked command",CMD_DEFERRED,CMD_PARSE_ADDR0,RET_SUCCESS,1,0,0);
+  //command outside the mask falls through to the later callback
+  check("command after masked",CMD_LATER,CMD_PARSE_ADDR0,RET_SUCCESS,0,0,1);
+  //unknown command is still unknown
+  check("unknown command",0x93,CMD_PARSE_ADDR0,ERR_UNKNOWN_CMD,0,0,0);
+  //deferred callback without a mask runs now so it can pass on commands
+  check("unmasked deferred",CMD_LATER,CMD_PARSE_ADDR1,RET_SUCCESS,0,1,1);
+  //table callback is posted
+  check("table command",CMD_TABLE,CMD_PARSE_ADDR0,RET_SUCCESS,1,0,0);
+  if(posted_dat!=&table){
+    printf("FAIL table command: wrong callback posted\n");
+    fails++;
+  }
+  //general call outside the mask does not take a worker job
+  check("general call",CMD_LATER,CMD_PARSE_GC_ADDR,RET_SUCCESS,0,0,1);
+  if(fails){
+    return 1;
+  }
+  printf("dispatch: deferred callbacks ok\n");
+  return 0;
+}
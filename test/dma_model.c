@@ -0,0 +1,224 @@
+//host register model for DMA driven I2C master transmit
+//runs dma.c against a model of eUSCI_B0 and DMA channel 2 and checks the bytes on the bus
+#include <stdio.h>
+#include <string.h>
+#include "ARCbus.h"
+#include "ARCbus_internal.h"
+#include "DMA.h"
+
+//registers used by dma.c
+volatile unsigned short DMACTL0,DMACTL1;
+volatile unsigned short DMA0CTL,DMA1CTL,DMA2CTL;
+volatile unsigned short DMA2SZ;
+volatile unsigned long DMA2SA,DMA2DA;
+volatile unsigned short UCB0CTLW0,UCB0IE,UCB0IFG,UCB0STATW;
+volatile unsigned short UCB0TXBUF,UCB0RXBUF,UCB0ADDRX,UCB0I2COA0;
+
+BUS_STAT arcBus_stat;
+
+//transmit buffer value when the shift register has taken the last byte
+#define TXBUF_EMPTY     0xFFFF
+
+//bytes seen on the bus
+static unsigned char wire[256];
+static int nwire;
+//size DMA2SZ is reloaded with when a block finishes, zero if no block is running
+static unsigned short dma_size;
+//interrupt calls
+static int tx_isr_calls,dma_isr_calls;
+//nonzero if the DMA interrupt is held off
+static int dma_isr_masked;
+//nonzero once the stop condition has been sent
+static int stopped;
+
+static int fails;
+
+//interrupts are always enabled in the model
+int ctl_global_interrupts_disable(void){
+  return 0;
+}
+
+void ctl_global_interrupts_enable(void){
+}
+
+//no more segments in the model
+int BUS_I2C_tx_next(void){
+  return 0;
+}
+
+//master part of the transmit case in bus_I2C_isr
+static void tx_isr(void){
+  tx_isr_calls++;
+  if(arcBus_stat.i2c_stat.tx.len>arcBus_stat.i2c_stat.tx.idx || BUS_I2C_tx_next()){
+    //in master mode try to send the rest of the packet with DMA
+    if(UCB0CTLW0&UCMST && BUS_I2C_tx_dma_start()){
+      return;
+    }
+    UCB0TXBUF=arcBus_stat.i2c_stat.tx.ptr[arcBus_stat.i2c_stat.tx.idx++];
+  }else{
+    //generate stop condition
+    UCB0CTL1|=UCTXSTP;
+  }
+}
+
+//channel 2 part of the DMA interrupt
+static void dma_isr(void){
+  dma_isr_calls++;
+  DMA2CTL&=~DMAIFG;
+  BUS_I2C_tx_dma_done();
+}
+
+//one byte time on the bus
+static void bus_step(void){
+  //transmit flag is set while the buffer is empty
+  if(UCB0TXBUF==TXBUF_EMPTY && !(UCB0CTL1&UCTXSTP)){
+    if(DMA2CTL&DMAEN && DMACTL1==DMA2TSEL__USCIB0TX){
+      //DMA answers the trigger, the flag is cleared by the write
+      if(!dma_size){
+        dma_size=DMA2SZ;
+      }
+      UCB0TXBUF=*(const unsigned char*)(unsigned long)DMA2SA;
+      DMA2SA++;
+      if(--DMA2SZ==0){
+        //block done, size is reloaded and the channel is disabled
+        DMA2SZ=dma_size;
+        dma_size=0;
+        DMA2CTL&=~DMAEN;
+        DMA2CTL|=DMAIFG;
+        if(DMA2CTL&DMAIE && !dma_isr_masked){
+          dma_isr();
+        }
+      }
+    }else if(UCB0IE&UCTXIE0){
+      tx_isr();
+    }
+  }
+  //shift register takes the byte
+  if(UCB0TXBUF!=TXBUF_EMPTY){
+    wire[nwire++]=UCB0TXBUF;
+    UCB0TXBUF=TXBUF_EMPTY;
+  }else if(UCB0CTL1&UCTXSTP){
+    stopped=1;
+  }
+}
+
+//start a master transmit of len bytes
+static void tx_start(const unsigned char *pk,short len){
+  memset(&arcBus_stat.i2c_stat.tx,0,sizeof(arcBus_stat.i2c_stat.tx));
+  arcBus_stat.i2c_stat.tx.ptr=pk;
+  arcBus_stat.i2c_stat.tx.len=len;
+  UCB0CTLW0=UCMST|UCTR;
+  UCB0IE=UCTXIE0;
+  UCB0TXBUF=TXBUF_EMPTY;
+  DMA2CTL=0;
+  dma_size=0;
+  nwire=0;
+  tx_isr_calls=dma_isr_calls=0;
+  stopped=0;
+}
+
+//run the bus until the stop condition, at most limit byte times
+static void run(int limit){
+  while(!stopped && limit-->0){
+    bus_step();
+  }
+}
+
+static void check(const char *name,int ok){
+  if(!ok){
+    printf("FAIL %s\n",name);
+    fails++;
+  }
+}
+
+//check that the bus saw the whole packet once and the channel is free
+static void check_done(const char *name,const unsigned char *pk,int len,int owner_free){
+  char msg[80];
+  snprintf(msg,sizeof(msg),"%s: packet on the bus",name);
+  check(msg,stopped && nwire==len && !memcmp(wire,pk,len));
+  snprintf(msg,sizeof(msg),"%s: index at end",name);
+  check(msg,arcBus_stat.i2c_stat.tx.idx==len);
+  snprintf(msg,sizeof(msg),"%s: transmit interrupt on",name);
+  check(msg,UCB0IE&UCTXIE0);
+  if(owner_free){
+    snprintf(msg,sizeof(msg),"%s: channel free",name);
+    check(msg,BUS_DMA_claim(BUS_DMA_CH2,BUS_DMA_OWNER_USER)==RET_SUCCESS);
+    BUS_DMA_release(BUS_DMA_CH2,BUS_DMA_OWNER_USER);
+  }
+}
+
+int main(void){
+  static unsigned char pk[64];
+  int i,written;
+  //register addresses are stored in 32 bits by dma.c
+  if((unsigned long)pk>0xFFFFFFFFUL || (unsigned long)&UCB0TXBUF>0xFFFFFFFFUL){
+    printf("build with -no-pie so data addresses fit in 32 bits\n");
+    return 1;
+  }
+  for(i=0;i<sizeof(pk);i++){
+    pk[i]=i*7+1;
+  }
+  BUS_DMA_init();
+
+  //long packet goes out with DMA
+  tx_start(pk,40);
+  run(100);
+  check_done("dma",pk,40,1);
+  check("dma: interrupts",tx_isr_calls==2 && dma_isr_calls==1);
+  printf("40 byte packet: %d transmit interrupts and %d DMA interrupt, %d without DMA\n",tx_isr_calls,dma_isr_calls,40+1);
+
+  //short packet is sent from the interrupt
+  tx_start(pk,BUS_I2C_TX_DMA_MIN-1);
+  run(100);
+  check_done("short",pk,BUS_I2C_TX_DMA_MIN-1,1);
+  check("short: interrupts",tx_isr_calls==BUS_I2C_TX_DMA_MIN && dma_isr_calls==0);
+
+  //SPI has the channel so the interrupt sends every byte
+  check("spi claim",BUS_DMA_claim(BUS_DMA_CH2,BUS_DMA_OWNER_SPI)==RET_SUCCESS);
+  tx_start(pk,20);
+  run(100);
+  check_done("spi owner",pk,20,0);
+  check("spi owner: interrupts",tx_isr_calls==21 && dma_isr_calls==0);
+  check("spi second claim",BUS_DMA_claim(BUS_DMA_CH2,BUS_DMA_OWNER_SPI)==ERR_BUSY);
+  BUS_DMA_release(BUS_DMA_CH2,BUS_DMA_OWNER_SPI);
+
+  //NACK part way through, index must count every byte written to the buffer
+  tx_start(pk,30);
+  for(i=0;i<10;i++){
+    bus_step();
+  }
+  BUS_I2C_tx_dma_stop();
+  written=nwire+(UCB0TXBUF!=TXBUF_EMPTY);
+  check("nack: index",arcBus_stat.i2c_stat.tx.idx==written);
+  check("nack: DMA off",!(DMA2CTL&(DMAEN|DMAIE|DMAIFG)));
+
+  //SPI takes the channel part way through, the interrupt finishes the packet
+  tx_start(pk,30);
+  for(i=0;i<10;i++){
+    bus_step();
+  }
+  check("spi takes channel",BUS_DMA_claim(BUS_DMA_CH2,BUS_DMA_OWNER_SPI)==RET_SUCCESS);
+  run(100);
+  check_done("spi takes channel",pk,30,0);
+  check("spi takes channel: no DMA interrupt",dma_isr_calls==0);
+  BUS_DMA_release(BUS_DMA_CH2,BUS_DMA_OWNER_SPI);
+
+  //stop after the last DMA byte but before the DMA interrupt, the size has been reloaded
+  tx_start(pk,12);
+  dma_isr_masked=1;
+  for(i=0;i<12 && !(DMA2CTL&DMAIFG);i++){
+    bus_step();
+  }
+  dma_isr_masked=0;
+  BUS_I2C_tx_dma_stop();
+  check("reload: index",arcBus_stat.i2c_stat.tx.idx==12);
+  run(100);
+  check_done("reload",pk,12,1);
+
+  if(fails){
+    printf("%d failures\n",fails);
+    return 1;
+  }
+  printf("dma_model passed\n");
+  return 0;
+}
@@ -0,0 +1,5 @@
+#ifndef __ERROR_H
+#define __ERROR_H
+//error levels used in the library headers
+enum{ERR_LEV_DEBUG=0,ERR_LEV_INFO=20,ERR_LEV_WARNING=40,ERR_LEV_ERROR=60,ERR_LEV_CRITICAL=80};
+#endif
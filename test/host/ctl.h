@@ -0,0 +1,14 @@
+#ifndef __CTL_H
+#define __CTL_H
+//just enough of the CTL types for the library headers to build on the host
+typedef unsigned CTL_EVENT_SET_t;
+typedef unsigned long CTL_TIME_t;
+typedef enum{CTL_TIMEOUT_NONE,CTL_TIMEOUT_INFINITE,CTL_TIMEOUT_ABSOLUTE,CTL_TIMEOUT_DELAY,CTL_TIMEOUT_NOW}CTL_TIMEOUT_t;
+typedef struct CTL_TASK_s{unsigned char priority;}CTL_TASK_t;
+typedef struct{unsigned lock_count;CTL_TASK_t *locking_task;}CTL_MUTEX_t;
+typedef struct{unsigned char *q;unsigned s,front,n;}CTL_BYTE_QUEUE_t;
+typedef struct{void **q;unsigned s,front,n;}CTL_MESSAGE_QUEUE_t;
+//interrupt masking, a test that uses it defines it
+int ctl_global_interrupts_disable(void);
+void ctl_global_interrupts_enable(void);
+#endif
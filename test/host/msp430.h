@@ -0,0 +1,52 @@
+#ifndef __MSP430_H
+#define __MSP430_H
+//the host build only has the bit names used in the library headers
+//and the registers used by dma.c, a test that uses the registers defines them
+#define BIT0    (0x0001)
+#define BIT1    (0x0002)
+#define BIT2    (0x0004)
+#define BIT3    (0x0008)
+#define BIT4    (0x0010)
+#define BIT5    (0x0020)
+#define BIT6    (0x0040)
+#define BIT7    (0x0080)
+
+//DMA registers, address registers are wide enough for a host address
+extern volatile unsigned short DMACTL0,DMACTL1;
+extern volatile unsigned short DMA0CTL,DMA1CTL,DMA2CTL;
+extern volatile unsigned short DMA2SZ;
+extern volatile unsigned long DMA2SA,DMA2DA;
+
+//DMA control bits
+#define DMAREQ              (0x0001)
+#define DMAIE               (0x0004)
+#define DMAIFG              (0x0008)
+#define DMAEN               (0x0010)
+#define DMASBDB             (0x00C0)
+#define DMASRCINCR_0        (0x0000)
+#define DMASRCINCR_3        (0x0300)
+#define DMADSTINCR_0        (0x0000)
+#define DMADSTINCR_3        (0x0C00)
+#define DMADT_0             (0x0000)
+#define DMADT_4             (0x4000)
+
+//DMA triggers
+#define DMA2TSEL__USCIB0RX  (18)
+#define DMA2TSEL__USCIB0TX  (19)
+
+//eUSCI_B0 registers, UCB0CTL1 is the low byte of UCB0CTLW0
+extern volatile unsigned short UCB0CTLW0,UCB0IE,UCB0IFG,UCB0STATW;
+extern volatile unsigned short UCB0TXBUF,UCB0RXBUF,UCB0ADDRX,UCB0I2COA0;
+#define UCB0CTL1            (*(volatile unsigned char*)&UCB0CTLW0)
+
+//eUSCI_B0 bits
+#define UCSWRST             (0x0001)
+#define UCTXSTP             (0x0004)
+#define UCTR                (0x0010)
+#define UCMST               (0x0800)
+#define UCRXIE0             (0x0001)
+#define UCTXIE0             (0x0002)
+#define UCRXIFG0            (0x0001)
+#define UCTXIFG0            (0x0002)
+#define UCGC                (0x0020)
+#endif
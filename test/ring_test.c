@@ -0,0 +1,74 @@
+//host stress test for the SPSC ring
+//a producer thread stands in for bus_I2C_isr and fills slots while the main thread consumes them
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include "../ring.h"
+
+//number of slots, fewer than BUS_I2C_PACKET_QUEUE_LEN so the ring fills more often
+#define SLOTS       8
+//number of packets to send through the ring
+#define PACKETS     2000000UL
+//bytes in each slot
+#define SLOT_LEN    33
+
+static BUS_RING ring;
+static unsigned char slot[SLOTS][SLOT_LEN];
+
+//producer thread, fill each slot with the packet number
+static void *producer(void *arg){
+  unsigned long n=0;
+  short idx;
+  int i;
+  while(n<PACKETS){
+    //wait for a free slot
+    if((idx=BUS_ring_prod_slot(&ring))<0){
+      sched_yield();
+      continue;
+    }
+    //write whole slot so torn reads are found
+    for(i=0;i<SLOT_LEN;i++){
+      slot[idx][i]=(unsigned char)(n+i);
+    }
+    BUS_ring_publish(&ring);
+    n++;
+  }
+  return NULL;
+}
+
+int main(void){
+  pthread_t th;
+  unsigned long n=0;
+  short idx;
+  int i;
+  BUS_ring_init(&ring,SLOTS);
+  if(pthread_create(&th,NULL,producer,NULL)){
+    fprintf(stderr,"can't start producer\n");
+    return 1;
+  }
+  while(n<PACKETS){
+    //wait for a packet
+    if((idx=BUS_ring_cons_slot(&ring))<0){
+      sched_yield();
+      continue;
+    }
+    //check order and contents
+    for(i=0;i<SLOT_LEN;i++){
+      if(slot[idx][i]!=(unsigned char)(n+i)){
+        fprintf(stderr,"packet %lu byte %d bad : got %u expected %u\n",n,i,slot[idx][i],(unsigned char)(n+i));
+        return 1;
+      }
+    }
+    BUS_ring_consume(&ring);
+    n++;
+  }
+  pthread_join(th,NULL);
+  //ring must be empty
+  if(BUS_ring_used(&ring)!=0){
+    fprintf(stderr,"ring not empty at end\n");
+    return 1;
+  }
+  printf("ring: %lu packets ok, hwm %u of %u, full %u times\n",n,ring.hwm,SLOTS,ring.full);
+  return 0;
+}
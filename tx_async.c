@@ -0,0 +1,325 @@
+#include <ctl.h>
+#include <msp430.h>
+#include <string.h>
+#include "ARCbus.h"
+#include "crc.h"
+
+#include "ARCbus_internal.h"
+
+//packet waiting to be sent by the I2C interrupt
+typedef struct{
+  //destination address
+  unsigned char addr;
+  //length including header and CRC
+  unsigned char len;
+  //completion info, can be NULL
+  BUS_TX_DONE *done;
+  //packet data
+  unsigned char dat[BUS_I2C_HDR_LEN+BUS_I2C_MAX_PACKET_LEN+BUS_I2C_CRC_LEN];
+}BUS_TX_FRAME;
+
+//queued packets
+static BUS_TX_FRAME BUS_tx_buf[BUS_TX_QUEUE_LEN];
+//ring indexes for transmit queue
+//tasks are the producer with interrupts disabled and the I2C ISR is the consumer
+static BUS_RING BUS_tx_ring;
+
+//current owner of the I2C master
+static volatile unsigned char BUS_tx_owner;
+//set when BUS_cmd_tx is waiting for queued packets to finish
+static volatile unsigned char BUS_tx_sync_req;
+//timeout for the packet in progress in ticks
+static volatile unsigned short BUS_tx_timer;
+
+//initialize transmit queue to empty state
+void BUS_tx_init(void){
+  BUS_ring_init(&BUS_tx_ring,BUS_TX_QUEUE_LEN);
+  BUS_tx_owner=BUS_TX_OWNER_NONE;
+  BUS_tx_sync_req=0;
+  BUS_tx_timer=0;
+}
+
+//start the next queued packet if the master is free, interrupts must be disabled
+static void BUS_tx_start(void){
+  short idx;
+  BUS_TX_FRAME *frame;
+  //check if the master is free
+  if(BUS_tx_owner!=BUS_TX_OWNER_NONE || BUS_tx_sync_req){
+    return;
+  }
+  //get next packet
+  idx=BUS_ring_cons_slot(&BUS_tx_ring);
+  //check if there is a packet
+  if(idx<0){
+    return;
+  }
+  frame=&BUS_tx_buf[idx];
+  //take master
+  BUS_tx_owner=BUS_TX_OWNER_ASYNC;
+  //set slave address
+  UCB0I2CSA=frame->addr;
+  //set index
+  arcBus_stat.i2c_stat.tx.idx=0;
+  //set length
+  arcBus_stat.i2c_stat.tx.len=frame->len;
+  //set data
+  arcBus_stat.i2c_stat.tx.ptr=frame->dat;
+  //packet is in one buffer
+  arcBus_stat.i2c_stat.tx.iov=NULL;
+  arcBus_stat.i2c_stat.tx.base=0;
+  //clear backoff counters
+  BUS_backoff_start();
+  //set I2C master state
+  arcBus_stat.i2c_stat.tx.stat=BUS_I2C_MASTER_PENDING;
+  //set timeout
+  BUS_tx_timer=BUS_TX_ASYNC_TIMEOUT;
+  //check if a slave transaction is in progress
+  if(arcBus_stat.i2c_stat.mode!=BUS_I2C_IDLE){
+    //the stop interrupt will start the pending packet
+    return;
+  }
+  //set to transmit mode
+  UCB0CTLW0|=UCTR;
+  //set master mode
+  UCB0CTLW0|=UCMST;
+  //generate start condition
+  UCB0CTL1|=UCTXSTT;
+}
+
+//finish the packet in progress and start the next one, called from ISR
+static void BUS_tx_end(int result){
+  BUS_TX_DONE *done;
+  //get completion info
+  done=BUS_tx_buf[BUS_ring_cons_slot(&BUS_tx_ring)].done;
+  //set I2C master state
+  arcBus_stat.i2c_stat.tx.stat=BUS_I2C_MASTER_IDLE;
+  //stop timeout
+  BUS_tx_timer=0;
+  //give up master
+  BUS_tx_owner=BUS_TX_OWNER_NONE;
+  //done with packet
+  BUS_ring_consume(&BUS_tx_ring);
+  //notify sender
+  if(done!=NULL){
+    //save result
+    done->result=result;
+    //call callback
+    if(done->cb!=NULL){
+      done->cb(result,done->arg);
+    }
+    //set events
+    if(done->e!=NULL){
+      ctl_events_set_clear(done->e,done->event,0);
+    }
+  }
+  //check if BUS_cmd_tx is waiting
+  if(BUS_tx_sync_req){
+    //tell BUS_cmd_tx that the master is free
+    ctl_events_set_clear(&arcBus_stat.events,BUS_EV_I2C_TX_IDLE,0);
+  }else{
+    //chain next packet
+    BUS_tx_start();
+  }
+}
+
+//handle master stop condition, returns nonzero if the packet was queued by BUS_cmd_tx_async
+int BUS_tx_async_stop(unsigned short end_e){
+  //check if queued packet is in progress
+  if(BUS_tx_owner!=BUS_TX_OWNER_ASYNC){
+    return 0;
+  }
+  //convert end event to error
+  switch(end_e){
+    case BUS_EV_I2C_COMPLETE:
+      BUS_tx_end(RET_SUCCESS);
+    break;
+    case BUS_EV_I2C_NACK:
+      BUS_tx_end(ERR_I2C_NACK);
+    break;
+    case BUS_EV_I2C_ABORT:
+      BUS_tx_end(ERR_I2C_ABORT);
+    break;
+    case BUS_EV_I2C_TX_SELF:
+      BUS_tx_end(ERR_I2C_TX_SELF);
+    break;
+    case (unsigned short)ERR_I2C_CLL:
+      BUS_tx_end(ERR_I2C_CLL);
+    break;
+    default:
+      BUS_tx_end(ERR_UNKNOWN);
+    break;
+  }
+  return 1;
+}
+
+//give up a master packet that started but did not finish, called from ISR
+static void BUS_tx_abort(void){
+  //stop DMA transmit
+  BUS_I2C_tx_dma_stop();
+  //the slave can be holding the clock so a stop condition may never be sent
+  //put UCB0 into reset state, this releases the bus and ends master mode
+  UCB0CTLW0|=UCSWRST;
+  //go back to slave receiver
+  UCB0CTLW0&=~(UCMST|UCTR);
+  //take UCB0 out of reset state
+  UCB0CTLW0&=~UCSWRST;
+  //reset clears the interrupt enables, enable I2C state change interrupts
+  UCB0IE|=UCNACKIE|UCSTTIE|UCSTPIE|UCALIE|UCCLTOIE|UCTXIE0|UCRXIE0|UCTXIE1|UCRXIE1|UCTXIE2|UCRXIE2|UCTXIE3|UCRXIE3;
+  //set I2C master state so the transmit interrupt does not use the old packet
+  arcBus_stat.i2c_stat.tx.stat=BUS_I2C_MASTER_IDLE;
+  //no transaction in progress
+  arcBus_stat.i2c_stat.mode=BUS_I2C_IDLE;
+}
+
+//check for transmit timeout, called from tick ISR
+void BUS_tx_async_tick(void){
+  //check if timer is running
+  if(BUS_tx_timer){
+    BUS_tx_timer--;
+    //check for timeout
+    if(!BUS_tx_timer && BUS_tx_owner==BUS_TX_OWNER_ASYNC){
+      //clear start bit
+      UCB0CTL1&=~UCTXSTT;
+      //check if the packet started
+      if(arcBus_stat.i2c_stat.tx.stat==BUS_I2C_MASTER_IN_PROGRESS){
+        //release the bus before the next packet is started
+        BUS_tx_abort();
+        //packet started but did not complete
+        BUS_tx_end(ERR_TIMEOUT);
+      }else{
+        //packet did not start
+        BUS_tx_end(ERR_I2C_START_TIMEOUT);
+      }
+    }
+  }
+}
+
+//take the I2C master for BUS_cmd_tx, waits for the queued packet in progress to finish
+int BUS_tx_claim(void){
+  int en,resp=RET_SUCCESS;
+  //clear idle event
+  ctl_events_set_clear(&arcBus_stat.events,0,BUS_EV_I2C_TX_IDLE);
+  //disable interrupts
+  en=ctl_global_interrupts_disable();
+  //check if master is in use
+  if(BUS_tx_owner!=BUS_TX_OWNER_NONE){
+    //don't start any more queued packets
+    BUS_tx_sync_req=1;
+    //enable interrupts
+    if(en){
+      ctl_global_interrupts_enable();
+    }
+    //wait for the packet in progress to finish
+    ctl_events_wait(CTL_EVENT_WAIT_ANY_EVENTS_WITH_AUTO_CLEAR,&arcBus_stat.events,BUS_EV_I2C_TX_IDLE,CTL_TIMEOUT_DELAY,BUS_TX_ASYNC_TIMEOUT);
+    //disable interrupts
+    en=ctl_global_interrupts_disable();
+    //queued packets can be started again
+    BUS_tx_sync_req=0;
+  }
+  //check if master is free
+  if(BUS_tx_owner==BUS_TX_OWNER_NONE){
+    //take master
+    BUS_tx_owner=BUS_TX_OWNER_SYNC;
+  }else{
+    resp=ERR_BUSY;
+  }
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  return resp;
+}
+
+//give back the I2C master after BUS_cmd_tx and start any queued packets
+void BUS_tx_release(void){
+  int en;
+  //disable interrupts
+  en=ctl_global_interrupts_disable();
+  //give up master
+  BUS_tx_owner=BUS_TX_OWNER_NONE;
+  //start queued packets
+  BUS_tx_start();
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+}
+
+//queue packet to be sent by the I2C interrupt
+int BUS_cmd_tx_async(unsigned char addr,const void *buff,unsigned short len,unsigned short flags,BUS_TX_DONE *done){
+  BUS_TX_FRAME *frame;
+  short idx;
+  int en,resp;
+  //check address
+  if((resp=addr_chk(addr))!=RET_SUCCESS){
+    //return error if it occured
+    return resp;
+  }
+  //check packet length
+  if(len>BUS_I2C_MAX_PACKET_LEN){
+    return ERR_PACKET_TOO_LONG;
+  }
+  //add standard header length
+  len+=BUS_I2C_HDR_LEN;
+  //disable interrupts, other tasks may be queuing packets
+  en=ctl_global_interrupts_disable();
+  //get free slot
+  idx=BUS_ring_prod_slot(&BUS_tx_ring);
+  //check if queue is full
+  if(idx<0){
+    //enable interrupts
+    if(en){
+      ctl_global_interrupts_enable();
+    }
+    return ERR_BUSY;
+  }
+  frame=&BUS_tx_buf[idx];
+  //copy packet
+  memcpy(frame->dat,buff,len);
+  //add NACK flag if requested
+  if(flags&BUS_CMD_FL_NACK){
+    //request NACK
+    frame->dat[0]|=CMD_TX_NACK;
+  }else{
+    //clear NACK request
+    frame->dat[0]&=~CMD_TX_NACK;
+  }
+  //calculate CRC
+  frame->dat[len]=crc7(frame->dat,len);
+  //set length
+  frame->len=len+BUS_I2C_CRC_LEN;
+  //set address
+  frame->addr=addr;
+  //set completion info
+  frame->done=done;
+  //check if a software transmission should be done
+  if(!(flags&BUS_CMD_FL_NO_SW_TX) && (BUS_OA_check(addr)==ERR_BAD_ADDR && addr==BUS_ADDR_GC)){
+    //copy packet into receive queue
+    if((resp=BUS_cmd_loopback(addr,frame->dat,frame->len))!=RET_SUCCESS){
+      //enable interrupts
+      if(en){
+        ctl_global_interrupts_enable();
+      }
+      return resp;
+    }
+  }
+  //check for completion info
+  if(done!=NULL){
+    //not sent yet
+    done->result=ERR_BUSY;
+  }
+  //publish packet
+  BUS_ring_publish(&BUS_tx_ring);
+  //start packet if master is free
+  BUS_tx_start();
+  //enable interrupts
+  if(en){
+    ctl_global_interrupts_enable();
+  }
+  //check for software transmission
+  if(!(flags&BUS_CMD_FL_NO_SW_TX) && (BUS_OA_check(addr)==ERR_BAD_ADDR && addr==BUS_ADDR_GC)){
+    //set flag for new packet
+    ctl_events_set_clear(&BUS_INT_events,BUS_INT_EV_I2C_CMD_RX,0);
+  }
+  return RET_SUCCESS;
+}